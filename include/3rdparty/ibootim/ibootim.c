@@ -103,6 +103,15 @@ typedef struct ibootim {
 	ibootim_pixel_buffer_t pixels;
 } ibootim;
 
+typedef struct ibootim_iterator {
+	const uint8_t *buffer;
+	size_t length;
+	void *ownedBuffer;
+	unsigned int count;
+	unsigned int position;
+	size_t *offsets;
+} ibootim_iterator;
+
 static unsigned _adler32(unsigned adler, const unsigned char* data, unsigned len) {
 	unsigned s1 = adler & 0xffff;
 	unsigned s2 = (adler >> 16) & 0xffff;
@@ -174,15 +183,76 @@ int ibootim_load(const char *path, ibootim **handle) {
 	return ibootim_load_at_index(path, handle, 0);
 }
 
+static int _ibootim_decode(const struct ibootim_header *header, const void *compressedData, ibootim **handle) {
+	unsigned int width, height;
+	unsigned int pixelsCount, pixelSize, compressedSize;
+	ssize_t expectedUncompressedSize, actualUncompressedSize;
+	
+	//No integer overflow should occur, since header->width and header->height
+	//are uint16_t, all the following variables are unsigned int.
+	width = header->width;
+	height = header->height;
+	pixelsCount = width * height;
+	pixelSize = _ibootim_pixel_size_for_color_space(header->colorSpace);
+	//Finally we get to the compressed and uncompressed sizes, not verifying
+	//them yet.
+	compressedSize = header->compressedSize;
+	expectedUncompressedSize = pixelsCount * pixelSize;
+	
+	unsigned headerAdler = _adler32(1,
+									(void *)&header->compressionType,
+									sizeof(*header) - offsetof(struct ibootim_header, compressionType));
+	unsigned imageAdler = _adler32(headerAdler, compressedData, compressedSize);
+	if (header->adler != imageAdler) {
+		printf("[!] Checksum in the header is not valid (0x%08x != 0x%08x).\n", imageAdler, header->adler);
+	}
+	
+	//decompress pixel data
+	void *pixelData = malloc(expectedUncompressedSize);
+	if (!pixelData) {
+		printf("[-] Can not allocate memory for pixel data, aborting.\n");
+		return ENOMEM;
+	}
+	actualUncompressedSize = ibootim_lzss_decompress(pixelData,
+											 (unsigned int)expectedUncompressedSize,
+											 (uint8_t *)compressedData,
+											 compressedSize);
+	if (actualUncompressedSize <= 0) {
+		free(pixelData);
+		printf("[-] An error occurred during decompression of pixel data, aborting.\n");
+		return EFTYPE;
+	} else if (actualUncompressedSize != expectedUncompressedSize) {
+		printf("[!] Actual length of uncompressed pixel data is less than expected.");
+		memset(&pixelData[actualUncompressedSize], 0, expectedUncompressedSize - actualUncompressedSize);
+	}
+	
+	//finally allocate memory for ibootim structure and fill it
+	ibootim *image = malloc(sizeof(ibootim));
+	if (!image) {
+		free(pixelData);
+		printf("[-] Memory allocation error, aborting.\n");
+		return ENOMEM;
+	}
+	image->width = width;
+	image->height = height;
+	image->offsetX = header->offsetX;
+	image->offsetY = header->offsetY;
+	image->compressionType = header->compressionType;
+	image->colorSpace = header->colorSpace;
+	image->pixels.pointer = pixelData;
+	
+	//write handle and return the image gracefully
+	*handle = image;
+	return 0;
+}
+
 int ibootim_load_at_index(const char *path, ibootim **handle, unsigned int targetIndex) {
 	int rc;
 	const char *errorDesc;
 	ssize_t items;
 	FILE *inputFile;
 	struct ibootim_header header;
-	unsigned int width, height;
-	unsigned int pixelsCount, pixelSize, compressedSize;
-	ssize_t expectedUncompressedSize, actualUncompressedSize;
+	unsigned int compressedSize;
 	
 	if (targetIndex == UINT_MAX) {
 		printf("[-] INTERNAL ERROR: iBootIm image index is equal to UINT_MAX.");
@@ -234,18 +304,8 @@ int ibootim_load_at_index(const char *path, ibootim **handle, unsigned int targe
 		}
 	}
 	
-	//No integer overflow should occur, since header.width and header.height
-	//are uint16_t, all the following variables are unsigned int.
-	width = header.width;
-	height = header.height;
-	pixelsCount = width * height;
-	pixelSize = _ibootim_pixel_size_for_color_space(header.colorSpace);
-	//Finally we get to the compressed and uncompressed sizes, not verifying
-	//them yet.
-	compressedSize = header.compressedSize;
-	expectedUncompressedSize = pixelsCount * pixelSize;
-	
 	//Read compressed image data.
+	compressedSize = header.compressedSize;
 	void *compressedData = malloc(compressedSize);
 	if (!compressedData) {
 		fclose(inputFile);
@@ -253,8 +313,6 @@ int ibootim_load_at_index(const char *path, ibootim **handle, unsigned int targe
 		return ENOMEM;
 	}
 	items = fread(compressedData, 1, compressedSize, inputFile);
-	//nothing else will be read here, so close the file
-	fclose(inputFile);
 	if (items != compressedSize) {
 		//Determine what kind of error has occurred.
 		if (feof(inputFile)) {
@@ -265,53 +323,62 @@ int ibootim_load_at_index(const char *path, ibootim **handle, unsigned int targe
 			rc = EIO;
 		}
 		//clean up and return error code
+		fclose(inputFile);
 		free(compressedData);
 		return rc;
 	}
+	//nothing else will be read here, so close the file
+	fclose(inputFile);
 	
-	unsigned headerAdler = _adler32(1,
-									(void *)&header.compressionType,
-									sizeof(header) - offsetof(struct ibootim_header, compressionType));
-	unsigned imageAdler = _adler32(headerAdler, compressedData, compressedSize);
-	if (header.adler != imageAdler) {
-		printf("[!] Checksum in the header is not valid (0x%08x != 0x%08x).\n", imageAdler, header.adler);
-	}
-	
-	//decompress pixel data
-	void *pixelData = malloc(expectedUncompressedSize);
-	actualUncompressedSize = ibootim_lzss_decompress(pixelData,
-											 (unsigned int)expectedUncompressedSize,
-											 compressedData,
-											 compressedSize);
+	rc = _ibootim_decode(&header, compressedData, handle);
 	free(compressedData);
-	if (actualUncompressedSize <= 0) {
-		free(pixelData);
-		printf("[-] An error occurred during decompression of pixel data, aborting.\n");
-		return EFTYPE;
-	} else if (actualUncompressedSize != expectedUncompressedSize) {
-		printf("[!] Actual length of uncompressed pixel data is less than expected.");
-		memset(&pixelData[actualUncompressedSize], 0, expectedUncompressedSize - actualUncompressedSize);
+	return rc;
+};
+
+int ibootim_load_from_buffer(const void *buffer, size_t length, ibootim **handle) {
+	return ibootim_load_from_buffer_at_index(buffer, length, handle, 0);
+}
+
+int ibootim_load_from_buffer_at_index(const void *buffer, size_t length, ibootim **handle, unsigned int targetIndex) {
+	int rc;
+	const char *errorDesc;
+	struct ibootim_header header;
+	size_t offset = 0;
+	
+	if (targetIndex == UINT_MAX) {
+		printf("[-] INTERNAL ERROR: iBootIm image index is equal to UINT_MAX.");
+		return EINVAL;
+	}
+	if (!buffer) {
+		return EINVAL;
 	}
 	
-	//finally allocate memory for ibootim structure and fill it
-	ibootim *image = malloc(sizeof(ibootim));
-	if (!image) {
-		free(pixelData);
-		printf("[-] Memory allocation error, aborting.\n");
-		return ENOMEM;
+	for (unsigned int i = 0; i <= targetIndex; i++) {
+		if (length - offset < sizeof(header)) {
+			printf("[-] iBootIm buffer is either truncated or image index is out of bounds.\n");
+			return EFTYPE;
+		}
+		
+		//the buffer carries no alignment guarantees, so copy the header out
+		memcpy(&header, (const uint8_t *)buffer + offset, sizeof(header));
+		rc = _ibootim_sanity_check_header(&header, &errorDesc);
+		if (rc != 0) {
+			printf("[-] Invalid iBootIm image header: %s.\n", errorDesc);
+			return EFTYPE;
+		}
+		offset += sizeof(header);
+		
+		if (length - offset < header.compressedSize) {
+			printf("[-] iBootIm image data is truncated.\n");
+			return EFTYPE;
+		}
+		if (i != targetIndex) {
+			offset += header.compressedSize;
+		}
 	}
-	image->width = width;
-	image->height = height;
-	image->offsetX = header.offsetX;
-	image->offsetY = header.offsetY;
-	image->compressionType = header.compressionType;
-	image->colorSpace = header.colorSpace;
-	image->pixels.pointer = pixelData;
 	
-	//write handle and return the image gracefully
-	*handle = image;
-	return 0;
-};
+	return _ibootim_decode(&header, (const uint8_t *)buffer + offset, handle);
+}
 
 int ibootim_convert_to_colorspace(ibootim *image, ibootim_color_space_t targetColorSpace) {
 	int rc;
@@ -694,6 +761,8 @@ int ibootim_load_png(const char *path, ibootim **handle) {
 
 int ibootim_write_png(ibootim *image, const char *path) {
 	int ret = -1;
+	//volatile since it is read again after a longjmp from libpng
+	FILE * volatile outputFile = NULL;
 	
 	png_structp write_struct = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 	if (!write_struct) return -1;
@@ -703,7 +772,12 @@ int ibootim_write_png(ibootim *image, const char *path) {
 	
 	if (setjmp(png_jmpbuf(write_struct))) goto error;
 	
-	png_init_io(write_struct, fopen(path, "wb"));
+	outputFile = fopen(path, "wb");
+	if (!outputFile) {
+		printf("[-] Failed to open '%s' for writing: %s\n", path, strerror(errno));
+		goto error;
+	}
+	png_init_io(write_struct, outputFile);
 	//png_set_sig_bytes(write_struct, 8);
 	
 	uint32_t color_space = image->colorSpace;
@@ -741,6 +815,8 @@ int ibootim_write_png(ibootim *image, const char *path) {
 	
 error:
 	png_destroy_write_struct(&write_struct, &info_struct);
+	//the file is closed here so descriptors are not leaked when many images are written
+	if (outputFile && fclose(outputFile) != 0) ret = -1;
 	
 	return ret;
 }
@@ -879,6 +955,148 @@ int ibootim_count_images_in_file(const char *path, int *error) {
 	return ret;
 }
 
+int ibootim_count_images_in_buffer(const void *buffer, size_t length, int *error) {
+	struct ibootim_header header;
+	size_t offset = 0;
+	
+	if (!buffer) {
+		if (error) *error = EINVAL;
+		return -1;
+	}
+	
+	unsigned int count = 0;
+	while (length - offset >= sizeof(header)) {
+		memcpy(&header, (const uint8_t *)buffer + offset, sizeof(header));
+		if (_ibootim_sanity_check_header(&header, NULL) != 0) break;
+		offset += sizeof(header);
+		if (length - offset < header.compressedSize) break;
+		offset += header.compressedSize;
+		count++;
+	}
+	if (error) *error = 0;
+	
+	return count;
+}
+
+int ibootim_iterator_open_buffer(const void *buffer, size_t length, ibootim_iterator **iterator) {
+	struct ibootim_header header;
+	size_t offset = 0, capacity = 0;
+	
+	if (!buffer || !iterator) {
+		return EINVAL;
+	}
+	
+	ibootim_iterator *iter = malloc(sizeof(ibootim_iterator));
+	if (!iter) {
+		printf("[-] Memory allocation error, aborting.\n");
+		return ENOMEM;
+	}
+	memset(iter, 0, sizeof(ibootim_iterator));
+	iter->buffer = buffer;
+	iter->length = length;
+	
+	//Walk the concatenated headers once and remember where each image starts,
+	//so loading any image later does not need to seek through the ones before it.
+	while (length - offset >= sizeof(header)) {
+		memcpy(&header, iter->buffer + offset, sizeof(header));
+		if (_ibootim_sanity_check_header(&header, NULL) != 0) break;
+		if (length - offset - sizeof(header) < header.compressedSize) {
+			printf("[-] iBootIm image data at index %u is truncated.\n", iter->count);
+			ibootim_iterator_close(iter);
+			return EFTYPE;
+		}
+		
+		if (iter->count == capacity) {
+			capacity = capacity ? capacity * 2 : 4;
+			size_t *offsets = realloc(iter->offsets, capacity * sizeof(size_t));
+			if (!offsets) {
+				printf("[-] Memory allocation error, aborting.\n");
+				ibootim_iterator_close(iter);
+				return ENOMEM;
+			}
+			iter->offsets = offsets;
+		}
+		iter->offsets[iter->count++] = offset;
+		offset += sizeof(header) + header.compressedSize;
+	}
+	
+	*iterator = iter;
+	return 0;
+}
+
+int ibootim_iterator_open(const char *path, ibootim_iterator **iterator) {
+	int rc;
+	FILE *inputFile;
+	long fileSize;
+	
+	inputFile = fopen(path, "r");
+	if (!inputFile) {
+		printf("[-] Failed to open '%s': %s, aborting.\n", path, strerror(errno));
+		return ENOENT;
+	}
+	if (fseek(inputFile, 0, SEEK_END) != 0 || (fileSize = ftell(inputFile)) < 0 || fseek(inputFile, 0, SEEK_SET) != 0) {
+		printf("[-] An I/O error occurred while sizing '%s': %s.\n", path, strerror(errno));
+		fclose(inputFile);
+		return EIO;
+	}
+	
+	//Read the whole file in one go, every image is then served from memory
+	void *contents = malloc(fileSize ? fileSize : 1);
+	if (!contents) {
+		fclose(inputFile);
+		printf("[-] Can not allocate memory for iBootIm file contents, aborting.\n");
+		return ENOMEM;
+	}
+	if (fread(contents, 1, fileSize, inputFile) != (size_t)fileSize) {
+		printf("[-] An I/O error occurred while reading '%s'.\n", path);
+		fclose(inputFile);
+		free(contents);
+		return EIO;
+	}
+	fclose(inputFile);
+	
+	rc = ibootim_iterator_open_buffer(contents, fileSize, iterator);
+	if (rc != 0) {
+		free(contents);
+		return rc;
+	}
+	(*iterator)->ownedBuffer = contents;
+	return 0;
+}
+
+unsigned int ibootim_iterator_count(ibootim_iterator *iterator) {
+	return iterator->count;
+}
+
+int ibootim_iterator_load(ibootim_iterator *iterator, unsigned int index, ibootim **handle) {
+	struct ibootim_header header;
+	
+	if (index >= iterator->count) {
+		return ENOENT;
+	}
+	
+	//offsets were validated when the table was built
+	size_t offset = iterator->offsets[index];
+	memcpy(&header, iterator->buffer + offset, sizeof(header));
+	return _ibootim_decode(&header, iterator->buffer + offset + sizeof(header), handle);
+}
+
+int ibootim_iterator_next(ibootim_iterator *iterator, ibootim **handle) {
+	int rc = ibootim_iterator_load(iterator, iterator->position, handle);
+	if (rc == 0) {
+		iterator->position++;
+	}
+	return rc;
+}
+
+void ibootim_iterator_close(ibootim_iterator *iterator) {
+	if (iterator) {
+		if (iterator->offsets) free(iterator->offsets);
+		if (iterator->ownedBuffer) free(iterator->ownedBuffer);
+		free(iterator);
+	}
+}
+
 static inline void *_ibootim_pixel_ptr_at(ibootim *image, uint16_t x, uint16_t y) {
 	return (void *)image->pixels.pointer + (y * image->width + x) * ibootim_get_pixel_size(image);
 }
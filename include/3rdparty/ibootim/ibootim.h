@@ -28,6 +28,7 @@
 #define __ibootim_h__
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <errno.h>
 
@@ -37,6 +38,7 @@
 #endif
 
 typedef struct ibootim ibootim;
+typedef struct ibootim_iterator ibootim_iterator;
 
 typedef enum {
     ibootim_color_space_grayscale = 0x67726579, // 'grey'
@@ -81,6 +83,93 @@ extern int ibootim_load(const char *path, ibootim **handle);
 
 extern int ibootim_load_at_index(const char *path, ibootim **handle, unsigned int index);
 
+/*!
+ @function ibootim_load_from_buffer
+ @abstract Loads an iBoot Embedded Image from memory.
+ @discussion Same as ibootim_load() except the image is read from 'buffer' instead of a file. This is equivalent to ibootim_load_from_buffer_at_index(buffer, length, handle, 0).
+ @param buffer Pointer to the iBoot Embedded Image data.
+ @param length Length of the data in bytes.
+ @param handle A pointer where the handle is written on success.
+ @result UNIX error code or 0 on success.
+ */
+
+extern int ibootim_load_from_buffer(const void *buffer, size_t length, ibootim **handle);
+
+/*!
+ @function ibootim_load_from_buffer_at_index
+ @abstract Loads an iBoot Embedded Image from memory at given index.
+ @discussion Same as ibootim_load_at_index() except the images are read from 'buffer' instead of a file. The buffer is not retained after the call returns.
+ @param buffer Pointer to the iBoot Embedded Image data.
+ @param length Length of the data in bytes.
+ @param handle A pointer where the handle is written on success.
+ @param index Index of the image in the buffer.
+ @result UNIX error code or 0 on success.
+ */
+
+extern int ibootim_load_from_buffer_at_index(const void *buffer, size_t length, ibootim **handle, unsigned int index);
+
+/*!
+ @function ibootim_iterator_open_buffer
+ @abstract Prepares to walk every image in a concatenated iBoot Embedded Image buffer.
+ @discussion Walks the image headers in 'buffer' once and records where every image starts, so each image can then be loaded without re-reading the headers before it. The buffer must stay valid until the iterator is closed with ibootim_iterator_close(). A buffer that does not start with an iBootIm header yields an iterator with no images.
+ @param buffer Pointer to the iBoot Embedded Image data.
+ @param length Length of the data in bytes.
+ @param iterator A pointer where the iterator is written on success.
+ @result UNIX error code or 0 on success. EFTYPE is returned if an image is truncated.
+ */
+
+extern int ibootim_iterator_open_buffer(const void *buffer, size_t length, ibootim_iterator **iterator);
+
+/*!
+ @function ibootim_iterator_open
+ @abstract Prepares to walk every image in a concatenated iBoot Embedded Image file.
+ @discussion Reads the file located at path 'path' into memory with a single open and behaves like ibootim_iterator_open_buffer().
+ @param path Path to the iBoot Embedded Image file.
+ @param iterator A pointer where the iterator is written on success.
+ @result UNIX error code or 0 on success.
+ */
+
+extern int ibootim_iterator_open(const char *path, ibootim_iterator **iterator);
+
+/*!
+ @function ibootim_iterator_count
+ @abstract Returns the number of images found by the iterator.
+ @param iterator The iterator.
+ @result Number of images.
+ */
+
+extern unsigned int ibootim_iterator_count(ibootim_iterator *iterator);
+
+/*!
+ @function ibootim_iterator_load
+ @abstract Loads the image at given index from the iterator.
+ @discussion Uncompresses the image at 'index' and returns an ibootim image handle that must be closed with ibootim_close() function.
+ @param iterator The iterator.
+ @param index Index of the image.
+ @param handle A pointer where the handle is written on success.
+ @result UNIX error code or 0 on success. ENOENT is returned if the index is out of bounds.
+ */
+
+extern int ibootim_iterator_load(ibootim_iterator *iterator, unsigned int index, ibootim **handle);
+
+/*!
+ @function ibootim_iterator_next
+ @abstract Loads the next image from the iterator.
+ @param iterator The iterator.
+ @param handle A pointer where the handle is written on success.
+ @result UNIX error code or 0 on success. ENOENT is returned once every image has been loaded.
+ */
+
+extern int ibootim_iterator_next(ibootim_iterator *iterator, ibootim **handle);
+
+/*!
+ @function ibootim_iterator_close
+ @abstract Destroys an iterator.
+ @param iterator The iterator.
+ */
+
+extern void ibootim_iterator_close(ibootim_iterator *iterator);
+
 /*!
  @function ibootim_load
  @abstract Loads a PNG file and converts it into iBoot Embedded Image.
@@ -154,5 +243,6 @@ extern ibootim_compression_type_t ibootim_get_compression_type(ibootim *image);
 
 extern int ibootim_convert_to_colorspace(ibootim *image, ibootim_color_space_t targetColorSpace);
 extern int ibootim_count_images_in_file(const char *path, int *error);
+extern int ibootim_count_images_in_buffer(const void *buffer, size_t length, int *error);
 
 #endif /* defined(__ibootim__ibootim__) */
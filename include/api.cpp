@@ -7,164 +7,398 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <string>
+#include <mutex>
+#include <memory>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
 #include <curl/curl.h>
 #include <plist/plist.h>
 #include "utilities.hpp"
 #include "ipsw.hpp"
+#include "key_cache.hpp"
+#include "http_client.hpp"
 #include "api.hpp"
+#include "component_registry.hpp"
+#include "key_provider.hpp"
 
-size_t curl_write_cb(void* contents, size_t size, size_t nmemb, api_response_t* response) {
-    size_t total_size = (size * nmemb);
+/* Key tables by build, shared by every IPSW a process handles */
+static mutex key_memo_lock;
+static unordered_map<string, key_table_t> key_memo;
+
+/* A lookup of one build that's running, which every other lookup of that build waits on instead of making its own requests */
+typedef struct {
+    bool done;
+    ile_error_t result;
+    key_table_t table;
+} key_flight_t;
+
+static mutex key_flight_lock;
+static condition_variable key_flight_done;
+static unordered_map<string, shared_ptr<key_flight_t>> key_flights;
+
+/* Every request made for a build's keys, without the bodies, so its report only counts its own */
+static mutex key_request_lock;
+static unordered_map<string, vector<http_request_t>> key_requests;
+
+static bool manual_key_entry_enabled = true;
+
+/* Where wikiproxy requests go, set on first use if set_key_endpoint wasn't called */
+static string key_endpoint_base;
+
+void set_manual_key_entry(bool enabled) {
+    manual_key_entry_enabled = enabled;
+}
+
+bool get_manual_key_entry(void) {
+    return manual_key_entry_enabled;
+}
+
+/* Nobody can answer a prompt on a pipe or in a headless job */
+static bool prompt_allowed(void) {
+    if (!manual_key_entry_enabled) {
+        return false;
+    } else if (!isatty(STDIN_FILENO)) {
+        log_message(INFO, "Not asking for keys since standard input isn't a terminal");
+        return false;
+    }
     
-    /* Increase the buffer size to accomodate for the new data */
-    response->contents = (char*)realloc(response->contents, (response->size + total_size + 1));
-    if (!response->contents) {
-        return 0;
+    return true;
+}
+
+static string build_key(const char* product_type, const char* device_class, const char* product_build_version) {
+    return string(product_type) + "/" + device_class + "/" + product_build_version;
+}
+
+static bool find_memoized_keys(const string& build, key_table_t* table) {
+    lock_guard<mutex> guard(key_memo_lock);
+    auto it = key_memo.find(build);
+    if (it == key_memo.end()) {
+        return false;
     }
     
-    /* Copy the received data into the buffer */
-    memcpy(&(response->contents[response->size]), contents, total_size);
+    *table = it->second;
+    return true;
+}
+
+static void memoize_keys(const string& build, const key_table_t& table) {
+    lock_guard<mutex> guard(key_memo_lock);
+    key_memo[build] = table;
+}
+
+static void record_key_request(const string& build, http_request_t request) {
+    request.body.clear();
+    lock_guard<mutex> guard(key_request_lock);
+    key_requests[build].push_back(move(request));
+}
+
+void get_key_request_stats(const build_manifest_t& build_manifest, http_stats_t* stats) {
+    vector<http_request_t> requests;
+    {
+        lock_guard<mutex> guard(key_request_lock);
+        auto it = key_requests.find(build_key(build_manifest.product_type.data(), build_manifest.device_class.data(), build_manifest.product_build_version.data()));
+        if (it != key_requests.end()) {
+            requests = it->second;
+        }
+    }
     
-    /* Update the buffer size and null terminate it for safety */
-    response->size += total_size;
-    response->contents[response->size] = '\0';
+    http_stats_from_requests(requests, stats);
+}
+
+/* Keys from the key servers end up in the key cache too, so they're as good as cached */
+static bool is_cached_source(string_view source) {
+    return source == KEY_SOURCE_CACHE || source == KEY_SOURCE_WIKIPROXY || source == KEY_SOURCE_MIRROR;
+}
+
+void reject_keys(const build_manifest_t& build_manifest) {
+    {
+        lock_guard<mutex> guard(key_memo_lock);
+        key_memo.erase(build_key(build_manifest.product_type.data(), build_manifest.device_class.data(), build_manifest.product_build_version.data()));
+    }
     
-    return total_size;
+    /* A wrong key from a key file or typed in says nothing about the key cache */
+    bool cached = false;
+    for (size_t i = 0; i < build_manifest.keys.size() && !cached; i++) {
+        const firmware_key_t& firmware_key = build_manifest.keys[i];
+        if (!firmware_key.rejected) {
+            continue;
+        }
+        for (size_t j = 0; j < firmware_key.candidates.size() && !cached; j++) {
+            cached = is_cached_source(firmware_key.candidates[j].source);
+        }
+    }
+    if (cached && key_cache_remove(build_manifest.product_type.data(), build_manifest.device_class.data(), build_manifest.product_build_version.data()) != ILE_SUCCESS) {
+        log_message(WARNING, "Failed to remove the wrong firmware keys from the key cache");
+    }
+}
+
+/* Returns the running lookup of the build to wait on, or NULL after starting one that the caller must finish with finish_key_flight */
+static shared_ptr<key_flight_t> join_key_flight(const string& build) {
+    lock_guard<mutex> guard(key_flight_lock);
+    auto it = key_flights.find(build);
+    if (it != key_flights.end()) {
+        return it->second;
+    }
+    
+    shared_ptr<key_flight_t> flight = make_shared<key_flight_t>();
+    flight->done   = false;
+    flight->result = ILE_E_CACHE_MISS;
+    key_flights[build] = flight;
+    return NULL;
+}
+
+/* Successful results must be memoized first, so a lookup that just missed the flight finds them in the memo */
+static void finish_key_flight(const string& build, ile_error_t result, const key_table_t& table) {
+    {
+        lock_guard<mutex> guard(key_flight_lock);
+        auto it = key_flights.find(build);
+        if (it == key_flights.end()) {
+            return;
+        }
+        it->second->result = result;
+        it->second->table  = table;
+        it->second->done   = true;
+        key_flights.erase(it);
+    }
+    key_flight_done.notify_all();
+}
+
+static ile_error_t wait_for_key_flight(const shared_ptr<key_flight_t>& flight, key_table_t* table) {
+    unique_lock<mutex> guard(key_flight_lock);
+    key_flight_done.wait(guard, [&flight] { return flight->done; });
+    *table = flight->table;
+    return flight->result;
+}
+
+/* URLs are used as they are, curl reads file:// itself. Anything else is a folder in the same <ProductType>/<DeviceClass>/<Build> layout */
+static string endpoint_base(const char* endpoint) {
+    string base(endpoint);
+    while (base.size() > 1 && base.back() == '/') {
+        base.pop_back();
+    }
+    if (base.find("://") == string::npos) {
+        char cwd[PATH_MAX];
+        if (base[0] != '/' && getcwd(cwd, sizeof(cwd))) {
+            base = string(cwd) + "/" + base;
+        }
+        base = "file://" + base;
+    }
+    
+    return base;
+}
+
+static string endpoint_url(const string& base, const char* product_type, const char* device_class, const char* product_build_version) {
+    return base + "/" + product_type + "/" + device_class + "/" + product_build_version;
+}
+
+void set_key_endpoint(const char* endpoint) {
+    key_endpoint_base = endpoint_base(endpoint);
+}
+
+static string key_api_url(const char* product_type, const char* device_class, const char* product_build_version) {
+    if (key_endpoint_base.empty()) {
+        const char* endpoint = getenv(KEY_ENDPOINT_ENV);
+        key_endpoint_base = endpoint_base((endpoint && *endpoint) ? endpoint : KEY_ENDPOINT_DEFAULT);
+    }
+    
+    return endpoint_url(key_endpoint_base, product_type, device_class, product_build_version);
+}
+
+static ile_error_t check_key_response(const http_request_t& request) {
+    /* Builds wikiproxy doesn't know about come back as not found, or as a missing file from a folder */
+    if (request.result == CURLE_FILE_COULDNT_READ_FILE || (request.result == CURLE_OK && request.response_code == 404)) {
+        return ILE_E_KEYS_NOT_FOUND;
+    }
+    if (request.result != CURLE_OK) {
+        return ILE_E_CURL_PERFORM_FAILED;
+    }
+    
+    /* Verify the response integrity */
+    if (request.body.empty() || request.body.find(WIKIPROXY_SERVER_ERROR) != string::npos) {
+        return ILE_E_CURL_BAD_RESPONSE;
+    }
+    
+    return ILE_SUCCESS;
 }
 
 ile_error_t call_api(build_manifest_t build_manifest, api_response_t* response) {
     log_message(LOG, "Attempting to get firmware keys with wikiproxy...");
     
-    /* Initialize cURL */
-    CURL* handle = NULL;
-    CURLcode res = CURLE_OK;
-    curl_global_init(CURL_GLOBAL_ALL);
-    handle = curl_easy_init();
-    if (!handle) {
-        curl_global_cleanup();
-        return ILE_E_FAILED_TO_INITIALIZE_CURL;
+    /* Make the API request on the shared connection */
+    vector<http_request_t> requests(1);
+    requests[0].url = key_api_url(build_manifest.product_type.data(), build_manifest.device_class.data(), build_manifest.product_build_version.data());
+    requests[0].transient_body = WIKIPROXY_SERVER_ERROR;
+    ile_error_t ret = http_fetch_all(requests);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    record_key_request(build_key(build_manifest.product_type.data(), build_manifest.device_class.data(), build_manifest.product_build_version.data()), requests[0]);
+    ret = check_key_response(requests[0]);
+    if (ret != ILE_SUCCESS) {
+        return ret;
     }
     
-    /* Initialize the response structure */
-    response->size = 0;
-    response->contents = (char*)malloc(1);
+    /* Hand over a null terminated copy */
+    response->size     = requests[0].body.size();
+    response->contents = (char*)malloc(response->size + 1);
     if (!response->contents) {
-        curl_global_cleanup();
-        curl_easy_cleanup(handle);
         return ILE_E_OUT_OF_MEMORY;
-    } else {
-        response->contents[0] = '\0';
     }
+    memcpy(response->contents, requests[0].body.data(), response->size);
+    response->contents[response->size] = '\0';
     
-    /* Create the URL based on the details from the build manifest */
-    char* URL = NULL;
-    asprintf(&URL, "https://api.m1sta.xyz/wikiproxy/%s/%s/%s", build_manifest.product_type, build_manifest.device_class, build_manifest.product_build_version);
-    if (!URL) {
-        curl_global_cleanup();
-        curl_easy_cleanup(handle);
-        free(response->contents);
-        return ILE_E_OUT_OF_MEMORY;
-    } else {
-        /* Setup cURL options */
-        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, curl_write_cb);
-        curl_easy_setopt(handle, CURLOPT_WRITEDATA, response);
-        curl_easy_setopt(handle, CURLOPT_URL, URL);
-        
-        /* Make the API request */
-        res = curl_easy_perform(handle);
-        if (res != CURLE_OK) {
-            curl_global_cleanup();
-            curl_easy_cleanup(handle);
-            free(response->contents);
-            free(URL);
-            return ILE_E_CURL_PERFORM_FAILED;
-        } else {
-            /* Verify the response integrity */
-            char* p = strstr(response->contents, WIKIPROXY_SERVER_ERROR);
-            
-            if (response->size <= 0 || p) {
-                curl_global_cleanup();
-                curl_easy_cleanup(handle);
-                free(response->contents);
-                free(URL);
-                return ILE_E_CURL_BAD_RESPONSE;
-            }
-        }
+    return ILE_SUCCESS;
+}
+
+/* Same requests and responses as wikiproxy, ILE_E_CACHE_UNAVAILABLE if no mirror is set */
+static ile_error_t call_mirror(const build_manifest_t& build_manifest, key_table_t* table) {
+    const char* mirror = getenv(KEY_MIRROR_ENV);
+    if (!mirror || !*mirror) {
+        return ILE_E_CACHE_UNAVAILABLE;
     }
+    log_message(LOG, "Attempting to get firmware keys from the key mirror...");
     
-    /* Cleanup */
-    curl_global_cleanup();
-    curl_easy_cleanup(handle);
-    free(URL);
+    vector<http_request_t> requests(1);
+    requests[0].url = endpoint_url(endpoint_base(mirror), build_manifest.product_type.data(), build_manifest.device_class.data(), build_manifest.product_build_version.data());
+    requests[0].transient_body = WIKIPROXY_SERVER_ERROR;
+    ile_error_t ret = http_fetch_all(requests);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    record_key_request(build_key(build_manifest.product_type.data(), build_manifest.device_class.data(), build_manifest.product_build_version.data()), requests[0]);
+    ret = check_key_response(requests[0]);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
     
-    return ILE_SUCCESS;
+    return parse_key_response(requests[0].body.c_str(), requests[0].body.size(), KEY_SOURCE_MIRROR, table);
 }
 
-ile_error_t append_keys_to_build_manifest(build_manifest_t* build_manifest) {
-    /* Try to get firmware keys with wikiproxy */
-    api_response_t response;
-    ile_error_t ret = call_api(*build_manifest, &response);
-    if (ret == ILE_E_CURL_PERFORM_FAILED || ret == ILE_E_CURL_BAD_RESPONSE) {
-        log_message(ERROR, ile_strerror(ret));
+/* The key file and folder, then the key cache. Keys the user supplied come first so they're tried first, and aren't copied to the key cache */
+static bool lookup_local_keys(const char* product_type, const char* device_class, const char* product_build_version, key_table_t* table, string* source, bool* cached_out) {
+    string provider_source;
+    const bool provided = (key_providers_lookup(product_type, device_class, product_build_version, table, &provider_source) == ILE_SUCCESS);
+    key_table_t cached_table;
+    const bool cached   = (key_cache_lookup(product_type, device_class, product_build_version, &cached_table) == ILE_SUCCESS);
+    if (cached) {
+        key_table_merge(table, cached_table);
+    }
+    
+    if (source) {
+        *source = provided ? provider_source : "";
+        if (cached) {
+            *source += provided ? " and the key cache" : "the key cache";
+        }
+    }
+    if (cached_out) {
+        *cached_out = cached;
+    }
+    return provided || cached;
+}
+
+ile_error_t prefetch_keys(const vector<build_id_t>& builds) {
+    /* Only builds that aren't already known need the network */
+    vector<build_id_t> missing;
+    vector<http_request_t> requests;
+    vector<int> lock_fds;
+    unordered_set<string> seen;
+    for (size_t i = 0; i < builds.size(); i++) {
+        const build_id_t& build = builds[i];
+        const string memo_key = build_key(build.product_type.c_str(), build.device_class.c_str(), build.product_build_version.c_str());
+        key_table_t table;
+        if (!seen.insert(memo_key).second || find_memoized_keys(memo_key, &table)) {
+            continue;
+        }
+        /* Builds a local source knows are left to their IPSW's lookup, which knows what's encrypted and asks the key servers for whatever the local keys leave out */
+        if (lookup_local_keys(build.product_type.c_str(), build.device_class.c_str(), build.product_build_version.c_str(), &table, NULL, NULL)) {
+            continue;
+        }
         
-        char user_input[128];
-        printf("If you want to try entering keys manually, type 'yes' or anything else to exit: ");
-        fgets(user_input, sizeof(user_input), stdin); clean_user_input(user_input);
-        if (!strcmp(user_input, "yes")) {
-            log_message(WARNING, "iLogoExtractor is assuming all keys are correct which makes it more prone to failure");
-            
-            /* Setup a for loop to ask the user for every key and iv */
-            for (uint32_t i = 0; i < build_manifest->file_count; i++) {
-                /* Create a working struct */
-                firmware_key_t working_firmware_key_struct = { false, NULL, NULL };
-                
-                printf("\n[%s]\n[%s]\n", build_manifest->manifest_component_names[i], get_file_name_from_path(build_manifest->paths[i]));
-                printf("Type 'yes' if you have keys for this component or 'no' if otherwise: ");
-                fgets(user_input, sizeof(user_input), stdin); clean_user_input(user_input);
-                if (!strcmp(user_input, "yes")) {
-                    /* Keys are available */
-                    working_firmware_key_struct.available = true;
-                    
-                    /* Ask for the IV */
-                    printf("Enter the iv for [%s]: ", build_manifest->manifest_component_names[i]);
-                    fgets(user_input, sizeof(user_input), stdin); clean_user_input(user_input);
-                    working_firmware_key_struct.iv = strdup(user_input);
-                    
-                    /* Ask for the key */
-                    printf("Enter the key for [%s]: ", build_manifest->manifest_component_names[i]);
-                    fgets(user_input, sizeof(user_input), stdin); clean_user_input(user_input);
-                    working_firmware_key_struct.key = strdup(user_input);
-                    
-                } else if (!strcmp(user_input, "no")) {
-                    working_firmware_key_struct.available = false;
-                } else {
-                    return ILE_E_MISSING_KEYS;
-                }
-                
-                build_manifest->keys.push_back(working_firmware_key_struct);
-                log_message(LOG, "Keys updated successfully");
-            }
-            
-            /* Return early with an assumed success since the user provided keys instead of the API */
-            return ILE_SUCCESS;
-        } else {
-            /* Exit because no keys are available */
-            return ILE_E_MISSING_KEYS;
+        /* A build another process is looking up is left to its IPSW's lookup, which waits for that one. The key cache is read again in case it just finished */
+        int lock_fd = -1;
+        if (key_cache_lock(build.product_type.c_str(), build.device_class.c_str(), build.product_build_version.c_str(), false, &lock_fd) == ILE_E_CACHE_LOCKED) {
+            continue;
         }
-    } else if (ret != ILE_SUCCESS && ret != ILE_E_CURL_PERFORM_FAILED && ret != ILE_E_CURL_BAD_RESPONSE) {
-        return ret;
+        if (key_cache_lookup(build.product_type.c_str(), build.device_class.c_str(), build.product_build_version.c_str(), &table) == ILE_SUCCESS) {
+            key_cache_unlock(lock_fd);
+            continue;
+        }
+        
+        /* A build something else is already looking up is left to it */
+        if (join_key_flight(memo_key)) {
+            key_cache_unlock(lock_fd);
+            continue;
+        }
+        http_request_t request;
+        request.url = key_api_url(build.product_type.c_str(), build.device_class.c_str(), build.product_build_version.c_str());
+        request.transient_body = WIKIPROXY_SERVER_ERROR;
+        requests.push_back(request);
+        missing.push_back(build);
+        lock_fds.push_back(lock_fd);
+    }
+    if (requests.empty()) {
+        return ILE_SUCCESS;
     }
     
-    /* Convert the JSON into a plist */
-    plist_t root_node = NULL;
-    if (plist_from_json(response.contents, (uint32_t)response.size, &root_node) != PLIST_ERR_SUCCESS) {
-        free(response.contents);
-        return ILE_E_PLIST_CONVERSION_FAILED;
-    } else {
-        /* We don't need the original buffer anymore */
-        free(response.contents);
+    char* message = NULL;
+    asprintf(&message, "Fetching firmware keys for %zu builds with wikiproxy...", requests.size());
+    log_message(LOG, message ? message : "Fetching firmware keys with wikiproxy...");
+    free(message);
+    
+    /* All at once, over as few connections as the server and the rate limit allow */
+    const ile_error_t fetch_ret = http_fetch_all(requests);
+    
+    /* Anything that failed here is tried again, with the usual error handling, when its IPSW is processed, so lookups waiting on it are told to do their own */
+    for (size_t i = 0; i < requests.size(); i++) {
+        const build_id_t& build = missing[i];
+        const string memo_key   = build_key(build.product_type.c_str(), build.device_class.c_str(), build.product_build_version.c_str());
+        key_table_t table;
+        if (fetch_ret == ILE_SUCCESS) {
+            record_key_request(memo_key, requests[i]);
+        }
+        ile_error_t ret = (fetch_ret == ILE_SUCCESS) ? check_key_response(requests[i]) : fetch_ret;
+        if (ret == ILE_SUCCESS) {
+            ret = parse_key_response(requests[i].body.c_str(), requests[i].body.size(), KEY_SOURCE_WIKIPROXY, &table);
+        } else if (ret == ILE_E_KEYS_NOT_FOUND) {
+            ret = ILE_SUCCESS;
+        }
+        if (ret != ILE_SUCCESS) {
+            finish_key_flight(memo_key, ILE_E_CACHE_MISS, key_table_t());
+            key_cache_unlock(lock_fds[i]);
+            continue;
+        }
+        
+        memoize_keys(memo_key, table);
+        finish_key_flight(memo_key, ILE_SUCCESS, table);
+        if (key_cache_store(build.product_type.c_str(), build.device_class.c_str(), build.product_build_version.c_str(), table) != ILE_SUCCESS) {
+            log_message(WARNING, "Failed to save the firmware keys to the key cache");
+        }
+        key_cache_unlock(lock_fds[i]);
     }
     
+    return fetch_ret;
+}
+
+static bool get_string_item(plist_t dict, const char* name, string* value) {
+    plist_t node = plist_dict_get_item(dict, name);
+    if (!node || plist_get_node_type(node) != PLIST_STRING) {
+        return false;
+    }
+    
+    char* string_value = NULL;
+    plist_get_string_val(node, &string_value);
+    if (!string_value) {
+        return false;
+    }
+    value->assign(string_value);
+    free(string_value);
+    return true;
+}
+
+ile_error_t parse_key_node(plist_t root_node, const char* source, key_table_t* table) {
     /* Determine what kind of response it is - Does it have an array? */
     bool response_contains_array = false;
     plist_dict_iter root_iterator = NULL;
@@ -172,7 +406,6 @@ ile_error_t append_keys_to_build_manifest(build_manifest_t* build_manifest) {
     
     plist_t item = NULL; // If an array is found, this will hold that node
     if (!root_iterator) {
-        plist_free(root_node);
         return ILE_E_FAILED_TO_ITERATE_OVER_PLIST;
     } else {
         const uint32_t ROOT_NODE_SIZE = plist_dict_get_size(root_node);
@@ -180,6 +413,7 @@ ile_error_t append_keys_to_build_manifest(build_manifest_t* build_manifest) {
             /* Get the next item */
             char* key = NULL;
             plist_dict_next_item(root_node, root_iterator, &key, &item);
+            free(key);
             
             /* Check the type */
             if (plist_get_node_type(item) == PLIST_ARRAY) {
@@ -190,136 +424,395 @@ ile_error_t append_keys_to_build_manifest(build_manifest_t* build_manifest) {
         free(root_iterator);
     }
     
+    *table = key_table_t();
     if (response_contains_array) {
         log_message(INFO, "Response contains array: True");
         
-        /* We'll have to do iteration instead of directly looking for the iv and key in the response structure */
+        /* Every element names its image and may have an iv and key */
         const uint32_t KEYS_ARRAY_SIZE = plist_array_get_size(item);
-        
-        for (uint32_t i = 0; i < build_manifest->file_count; i++) {
-            /* Create a working struct */
-            firmware_key_t working_firmware_key_struct = { false, NULL, NULL };
-            
-            plist_array_iter keys_iterator = NULL;
-            plist_array_new_iter(item, &keys_iterator);
+        for (uint32_t i = 0; i < KEYS_ARRAY_SIZE; i++) {
+            plist_t component_key_node = plist_array_get_item(item, i);
+            key_record_t record;
+            record.source = source;
+            if (!component_key_node || !get_string_item(component_key_node, "image", &record.image)) {
+                return ILE_E_PLIST_OBJECT_NOT_FOUND;
+            }
             
-            if (!keys_iterator) {
-                plist_free(root_node);
-                return ILE_E_FAILED_TO_ITERATE_OVER_PLIST;
-            } else {
-                bool component_is_encrypted = false;
-                for (uint32_t j = 0; j < KEYS_ARRAY_SIZE; j++) {
-                    /* Get the next item */
-                    plist_t component_key_node = NULL;
-                    plist_array_next_item(item, keys_iterator, &component_key_node);
-                    
-                    if (!component_key_node) {
-                        free(keys_iterator);
-                        plist_free(root_node);
-                        return ILE_E_PLIST_OBJECT_NOT_FOUND;
-                    } else {
-                        /* Get the string value of image */
-                        plist_t image = plist_dict_get_item(component_key_node, "image");
-                        
-                        if (!image) {
-                            free(keys_iterator);
-                            plist_free(root_node);
-                            return ILE_E_PLIST_OBJECT_NOT_FOUND;
-                        } else {
-                            /* Get the string value */
-                            char* image_string_value = NULL;
-                            plist_get_string_val(image, &image_string_value);
-                            
-                            if (!image_string_value) {
-                                free(keys_iterator);
-                                plist_free(root_node);
-                                return ILE_E_FAILED_TO_GET_PLIST_STR_VAL;
-                            } else {
-                                /* Compare it against this index's name */
-                                if (!strcmp(build_manifest->manifest_component_names[i], image_string_value)) {
-                                    component_is_encrypted = true;
-                                    /* Try to get the IV and Key */
-                                    plist_t iv  = plist_dict_get_item(component_key_node, "iv");
-                                    plist_t key = plist_dict_get_item(component_key_node, "key");
-                                    
-                                    if (iv && key) {
-                                        /* Get their string values */
-                                        char* iv_string_value  = NULL; plist_get_string_val(iv, &iv_string_value);
-                                        char* key_string_value = NULL; plist_get_string_val(key, &key_string_value);
-                                        
-                                        if (iv_string_value && key_string_value) {
-                                            /* Update the working struct */
-                                            working_firmware_key_struct.available = true;
-                                            working_firmware_key_struct.iv        = iv_string_value;
-                                            working_firmware_key_struct.key       = key_string_value;
-                                        } else {
-                                            free(keys_iterator);
-                                            plist_free(root_node);
-                                            return ILE_E_FAILED_TO_GET_PLIST_STR_VAL;
-                                        }
-                                    }
-                                    
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                }
-                if (!component_is_encrypted) {
-                    working_firmware_key_struct.available = false;
-                }
-                
-                /* Push back */
-                build_manifest->keys.push_back(working_firmware_key_struct);
-                
-                free(keys_iterator);
+            /* Images without both are listed but not encrypted */
+            if (get_string_item(component_key_node, "iv", &record.iv) && get_string_item(component_key_node, "key", &record.key)) {
+                key_table_add(table, record);
             }
         }
     } else {
         log_message(INFO, "Response contains array: False");
+    }
+    
+    /* Every image has a <Name>IV and <Name>Key pair at the top level. Responses with an array can have them too, which are kept as more candidates when they disagree */
+    plist_dict_new_iter(root_node, &root_iterator);
+    if (!root_iterator) {
+        return ILE_E_FAILED_TO_ITERATE_OVER_PLIST;
+    }
+    const uint32_t ROOT_NODE_SIZE = plist_dict_get_size(root_node);
+    for (uint32_t i = 0; i < ROOT_NODE_SIZE; i++) {
+        char* name = NULL;
+        plist_t value = NULL;
+        plist_dict_next_item(root_node, root_iterator, &name, &value);
+        if (!name) {
+            continue;
+        }
         
-        /* We can re-format the component names and just get them from the response structure */
+        const size_t name_length = strlen(name);
+        key_record_t record;
+        record.source = source;
+        if (name_length > 2 && !strcmp(&name[name_length - 2], "IV")) {
+            /* Known images already have their key field's name, anything else gets it built */
+            record.image.assign(name, name_length - 2);
+            const component_info_t* info = component_registry_find(name, name_length - 2);
+            string built_key_field;
+            if (!info) {
+                built_key_field = record.image + "Key";
+            }
+            if (get_string_item(root_node, name, &record.iv) && get_string_item(root_node, info ? info->key_field : built_key_field.c_str(), &record.key)) {
+                key_table_add(table, record);
+            }
+        }
+        free(name);
+    }
+    free(root_iterator);
+    
+    return ILE_SUCCESS;
+}
+
+ile_error_t parse_key_response(const char* contents, size_t size, const char* source, key_table_t* table) {
+    /* Convert the JSON into a plist */
+    plist_t root_node = NULL;
+    if (plist_from_json(contents, (uint32_t)size, &root_node) != PLIST_ERR_SUCCESS) {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+    
+    ile_error_t ret = parse_key_node(root_node, source, table);
+    plist_free(root_node);
+    return ret;
+}
+
+static void set_key_bytes(const vector<uint8_t>& iv_bytes, const vector<uint8_t>& key_bytes, key_candidate_t* candidate) {
+    /* Only sizes AES can use are kept, anything else is left for the hex strings to fail on */
+    candidate->key_size = 0;
+    if (iv_bytes.size() == sizeof(candidate->iv_bytes) && (key_bytes.size() == 16 || key_bytes.size() == 24 || key_bytes.size() == 32)) {
+        memcpy(candidate->iv_bytes,  iv_bytes.data(),  iv_bytes.size());
+        memcpy(candidate->key_bytes, key_bytes.data(), key_bytes.size());
+        candidate->key_size = (uint8_t)key_bytes.size();
+    }
+}
+
+static bool needs_keys(const build_manifest_t& build_manifest, uint32_t index) {
+    return index >= build_manifest.encrypted.size() || build_manifest.encrypted[index];
+}
+
+static void add_key_candidate(build_manifest_t* build_manifest, const key_record_t& record, firmware_key_t* firmware_key) {
+    key_candidate_t candidate;
+    candidate.iv     = build_manifest_intern(build_manifest, record.iv);
+    candidate.key    = build_manifest_intern(build_manifest, record.key);
+    candidate.source = build_manifest_intern(build_manifest, record.source);
+    set_key_bytes(record.iv_bytes, record.key_bytes, &candidate);
+    firmware_key->candidates.push_back(candidate);
+    firmware_key->available = true;
+}
+
+static void apply_key_table(const key_table_t& table, build_manifest_t* build_manifest) {
+    /* One hash lookup per encrypted component */
+    for (uint32_t i = 0; i < build_manifest->file_count; i++) {
+        /* Create a working struct */
+        firmware_key_t working_firmware_key_struct = { false };
+        
+        /* Every source's key is kept, validate_component_keys picks the one that works */
+        const vector<const key_record_t*> records = needs_keys(*build_manifest, i) ? key_table_find(table, build_manifest->manifest_component_names[i].data()) : vector<const key_record_t*>();
+        for (size_t j = 0; j < records.size(); j++) {
+            add_key_candidate(build_manifest, *records[j], &working_firmware_key_struct);
+        }
+        
+        /* Push back */
+        build_manifest->keys.push_back(working_firmware_key_struct);
+    }
+}
+
+/* Encrypted components that no key source had a key for */
+static uint32_t count_missing_keys(const build_manifest_t& build_manifest) {
+    uint32_t missing = 0;
+    for (uint32_t i = 0; i < build_manifest.file_count; i++) {
+        if (needs_keys(build_manifest, i) && (i >= build_manifest.keys.size() || !build_manifest.keys[i].available)) {
+            missing++;
+        }
+    }
+    
+    return missing;
+}
+
+/* Only asks for the encrypted components the key sources didn't have keys for, build_manifest->keys must already have an entry for every file */
+static ile_error_t prompt_for_keys(build_manifest_t* build_manifest) {
+    char user_input[128];
+    printf("If you want to try entering keys manually, type 'yes' or anything else to exit: ");
+    fgets(user_input, sizeof(user_input), stdin); clean_user_input(user_input);
+    if (!strcmp(user_input, "yes")) {
+        log_message(INFO, "Every key is checked against its component before anything is extracted");
+        
+        /* Setup a for loop to ask the user for every key and iv */
         for (uint32_t i = 0; i < build_manifest->file_count; i++) {
-            /* Create a working struct */
-            firmware_key_t working_firmware_key_struct = { false, NULL, NULL };
-            
-            /* Create the key to get the IV and Key */
-            char* iv_plist_key = NULL;
-            asprintf(&iv_plist_key,  "%sIV",  build_manifest->manifest_component_names[i]);
-            
-            char* key_plist_key = NULL;
-            asprintf(&key_plist_key, "%sKey", build_manifest->manifest_component_names[i]);
-            
-            /* Try to find this component element in the response */
-            plist_t iv  = plist_dict_get_item(root_node, iv_plist_key);
-            plist_t key = plist_dict_get_item(root_node, key_plist_key);
+            /* Nothing to ask for if the component isn't encrypted or a key source had keys for it */
+            firmware_key_t& working_firmware_key_struct = build_manifest->keys[i];
+            if (!needs_keys(*build_manifest, i) || working_firmware_key_struct.available) {
+                continue;
+            }
             
-            if (iv && key) {
-                /* Get the string values for the iv and key */
-                char* iv_string_value  = NULL; plist_get_string_val(iv, &iv_string_value);
-                char* key_string_value = NULL; plist_get_string_val(key, &key_string_value);
+            printf("\n[%s]\n[%s]\n", build_manifest->manifest_component_names[i].data(), get_file_name_from_path(build_manifest->paths[i].data()));
+            printf("Type 'yes' if you have keys for this component or 'no' if otherwise: ");
+            fgets(user_input, sizeof(user_input), stdin); clean_user_input(user_input);
+            if (!strcmp(user_input, "yes")) {
+                /* Keys are available */
+                key_candidate_t candidate;
+                candidate.source = build_manifest_intern(build_manifest, KEY_SOURCE_USER);
                 
-                if (iv_string_value && key_string_value) {
-                    /* Update the working struct */
-                    working_firmware_key_struct.available = true;
-                    working_firmware_key_struct.iv        = iv_string_value;
-                    working_firmware_key_struct.key       = key_string_value;
-                } else {
-                    plist_free(root_node);
-                    return ILE_E_FAILED_TO_GET_PLIST_STR_VAL;
-                }
-            } else {
-                /* The response doesn't contain this component name */
+                /* Ask for the IV */
+                printf("Enter the iv for [%s]: ", build_manifest->manifest_component_names[i].data());
+                fgets(user_input, sizeof(user_input), stdin); clean_user_input(user_input);
+                candidate.iv = build_manifest_intern(build_manifest, user_input);
+                
+                /* Ask for the key */
+                printf("Enter the key for [%s]: ", build_manifest->manifest_component_names[i].data());
+                fgets(user_input, sizeof(user_input), stdin); clean_user_input(user_input);
+                candidate.key = build_manifest_intern(build_manifest, user_input);
+                
+                /* Decode them once like keys from wikiproxy */
+                vector<uint8_t> iv_bytes, key_bytes;
+                hex_decode(candidate.iv.data(), &iv_bytes);
+                hex_decode(candidate.key.data(), &key_bytes);
+                set_key_bytes(iv_bytes, key_bytes, &candidate);
+                working_firmware_key_struct.available = true;
+                working_firmware_key_struct.candidates.push_back(candidate);
+                
+            } else if (!strcmp(user_input, "no")) {
                 working_firmware_key_struct.available = false;
+            } else {
+                return ILE_E_MISSING_KEYS;
             }
             
-            /* Push back */
-            build_manifest->keys.push_back(working_firmware_key_struct);
-            
-            /* Free resources */
-            free(iv_plist_key);
-            free(key_plist_key);
+            log_message(LOG, "Keys updated successfully");
         }
+        
+        /* Return early with an assumed success since the user provided keys instead of the API */
+        return ILE_SUCCESS;
+    }
+    
+    /* Exit because no keys are available */
+    return ILE_E_MISSING_KEYS;
+}
+
+/* Wikiproxy and then the mirror, ILE_E_MISSING_KEYS if neither could answer. A build neither knows is an empty table */
+static ile_error_t lookup_remote_keys(const build_manifest_t& build_manifest, key_table_t* table) {
+    api_response_t response;
+    ile_error_t ret = call_api(build_manifest, &response);
+    if (ret == ILE_E_CURL_PERFORM_FAILED || ret == ILE_E_CURL_BAD_RESPONSE || ret == ILE_E_KEYS_NOT_FOUND) {
+        log_message((ret == ILE_E_KEYS_NOT_FOUND) ? INFO : ERROR, ile_strerror(ret));
+        const ile_error_t mirror_ret = call_mirror(build_manifest, table);
+        if (mirror_ret == ILE_SUCCESS) {
+            log_message(INFO, "Using firmware keys from the key mirror");
+        } else if (ret == ILE_E_KEYS_NOT_FOUND && (mirror_ret == ILE_E_KEYS_NOT_FOUND || mirror_ret == ILE_E_CACHE_UNAVAILABLE)) {
+            /* Nobody knows this build, which the caller remembers as a negative entry */
+            *table = key_table_t();
+        } else {
+            return ILE_E_MISSING_KEYS;
+        }
+        return ILE_SUCCESS;
+    } else if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    ret = parse_key_response(response.contents, response.size, KEY_SOURCE_WIKIPROXY, table);
+    free(response.contents);
+    return ret;
+}
+
+/* Whether every encrypted component has at least one key in the table */
+static bool keys_cover_build(const build_manifest_t& build_manifest, const key_table_t& table) {
+    for (uint32_t i = 0; i < build_manifest.file_count; i++) {
+        if (needs_keys(build_manifest, i) && key_table_find(table, build_manifest.manifest_component_names[i].data()).empty()) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/* Asks the key servers and caches their answer, which goes behind any local keys already in the table */
+static ile_error_t lookup_and_cache_remote_keys(const build_manifest_t& build_manifest, const string& memo_key, bool local, key_table_t* table) {
+    key_table_t remote_table;
+    ile_error_t ret = lookup_remote_keys(build_manifest, &remote_table);
+    if (ret != ILE_SUCCESS) {
+        /* The local keys still cover what they cover, but aren't remembered so the next lookup tries the key servers again */
+        return local ? ILE_SUCCESS : ret;
+    }
+    key_table_merge(table, remote_table);
+    
+    /* Only the key servers' answer is cached, an empty one as a negative entry */
+    memoize_keys(memo_key, *table);
+    if (key_cache_store(build_manifest.product_type.data(), build_manifest.device_class.data(), build_manifest.product_build_version.data(), remote_table) != ILE_SUCCESS) {
+        log_message(WARNING, "Failed to save the firmware keys to the key cache");
+    }
+    
+    return ILE_SUCCESS;
+}
+
+/* The key file and folder, the key cache, wikiproxy and then the mirror, ILE_E_MISSING_KEYS if none of them could answer */
+static ile_error_t lookup_keys(const build_manifest_t& build_manifest, const string& memo_key, key_table_t* table) {
+    /* Nothing online is asked if the local sources have a key for every encrypted component, or the key cache already has the key servers' answer */
+    string source;
+    bool cached = false;
+    const bool local = lookup_local_keys(build_manifest.product_type.data(), build_manifest.device_class.data(), build_manifest.product_build_version.data(), table, &source, &cached);
+    if (local && (cached || keys_cover_build(build_manifest, *table))) {
+        log_message(INFO, (table->records.empty() ? "No keys for this build in " + source : "Using firmware keys from " + source).c_str());
+        memoize_keys(memo_key, *table);
+        return ILE_SUCCESS;
+    } else if (local) {
+        log_message(INFO, ("Some encrypted components have no keys in " + source + ", asking the key servers for them").c_str());
+    }
+    
+    /* Another process looking up the build holds its lock until the answer is in the key cache, so whoever waited on it reads the answer from there */
+    int lock_fd = -1;
+    ile_error_t ret = key_cache_lock(build_manifest.product_type.data(), build_manifest.device_class.data(), build_manifest.product_build_version.data(), false, &lock_fd);
+    if (ret == ILE_E_CACHE_LOCKED) {
+        log_message(INFO, "Waiting for another process that is looking up this build");
+        ret = key_cache_lock(build_manifest.product_type.data(), build_manifest.device_class.data(), build_manifest.product_build_version.data(), true, &lock_fd);
+    }
+    if (ret != ILE_SUCCESS) {
+        log_message(WARNING, "Failed to lock the key cache, other processes looking up this build may make the same requests");
+    }
+    key_table_t cached_table;
+    if (key_cache_lookup(build_manifest.product_type.data(), build_manifest.device_class.data(), build_manifest.product_build_version.data(), &cached_table) == ILE_SUCCESS) {
+        log_message(INFO, "Using firmware keys another process just saved to the key cache");
+        key_table_merge(table, cached_table);
+        memoize_keys(memo_key, *table);
+        ret = ILE_SUCCESS;
+    } else {
+        ret = lookup_and_cache_remote_keys(build_manifest, memo_key, local, table);
+    }
+    key_cache_unlock(lock_fd);
+    
+    return ret;
+}
+
+/* Concurrent lookups of one build (one IPSW per device, or a prefetch) share whichever started first */
+static ile_error_t lookup_keys_once(const build_manifest_t& build_manifest, const string& memo_key, key_table_t* table) {
+    shared_ptr<key_flight_t> flight;
+    while ((flight = join_key_flight(memo_key)) != NULL) {
+        log_message(INFO, "Waiting for the lookup of this build that is already running");
+        const ile_error_t ret = wait_for_key_flight(flight, table);
+        
+        /* A prefetch that couldn't get the build leaves it to be looked up again */
+        if (ret != ILE_E_CACHE_MISS) {
+            return ret;
+        }
+    }
+    
+    /* The last lookup may have finished between the memo check and starting this one */
+    const ile_error_t ret = find_memoized_keys(memo_key, table) ? ILE_SUCCESS : lookup_keys(build_manifest, memo_key, table);
+    finish_key_flight(memo_key, ret, *table);
+    return ret;
+}
+
+ile_error_t append_keys_to_build_manifest(build_manifest_t* build_manifest) {
+    /* A build with nothing encrypted never needs the network, or the user */
+    bool any_encrypted = false;
+    for (uint32_t i = 0; i < build_manifest->file_count && !any_encrypted; i++) {
+        any_encrypted = needs_keys(*build_manifest, i);
+    }
+    if (!any_encrypted) {
+        log_message(INFO, "No components are encrypted, skipping the key lookup");
+        build_manifest->keys.assign(build_manifest->file_count, firmware_key_t{ false });
+        return ILE_SUCCESS;
+    }
+    
+    /* Builds that were already looked up in this process, or recently enough to be in the key cache, don't need the network at all */
+    const string memo_key = build_key(build_manifest->product_type.data(), build_manifest->device_class.data(), build_manifest->product_build_version.data());
+    key_table_t table;
+    ile_error_t ret = ILE_SUCCESS;
+    if (find_memoized_keys(memo_key, &table)) {
+        log_message(INFO, table.records.empty() ? "No key source has keys for this build" : "Using the firmware keys already fetched for this build");
+    } else {
+        ret = lookup_keys_once(*build_manifest, memo_key, &table);
+    }
+    if (ret != ILE_SUCCESS && ret != ILE_E_MISSING_KEYS) {
+        return ret;
+    }
+    apply_key_table(table, build_manifest);
+    
+    /* A build the key sources don't know (a negative entry) or only partly know leaves encrypted components without keys, which the user is asked for instead of failing later on */
+    const uint32_t missing = count_missing_keys(*build_manifest);
+    if (missing > 0) {
+        char* message = NULL;
+        asprintf(&message, "No key source has keys for %u encrypted components", missing);
+        log_message(ERROR, message ? message : "No key source has keys for some encrypted components");
+        free(message);
+        return prompt_allowed() ? prompt_for_keys(build_manifest) : ILE_E_MISSING_KEYS;
+    }
+    
+    return ILE_SUCCESS;
+}
+
+ile_error_t append_remote_keys_to_build_manifest(build_manifest_t* build_manifest) {
+    /* The key servers were already asked for any rejected component that has a key from them */
+    bool asked = true;
+    for (size_t i = 0; i < build_manifest->keys.size() && asked; i++) {
+        const firmware_key_t& firmware_key = build_manifest->keys[i];
+        bool remote = false;
+        for (size_t j = 0; j < firmware_key.candidates.size() && !remote; j++) {
+            remote = (firmware_key.candidates[j].source == KEY_SOURCE_WIKIPROXY || firmware_key.candidates[j].source == KEY_SOURCE_MIRROR);
+        }
+        asked = !firmware_key.rejected || remote;
+    }
+    if (asked) {
+        return ILE_E_WRONG_KEYS;
+    }
+    log_message(LOG, "Asking the key servers for the components the local keys don't decrypt...");
+    
+    key_table_t remote_table;
+    if (lookup_remote_keys(*build_manifest, &remote_table) != ILE_SUCCESS) {
+        return ILE_E_WRONG_KEYS;
+    }
+    
+    /* Later IPSWs of the build start with these too, instead of asking again */
+    {
+        lock_guard<mutex> guard(key_memo_lock);
+        auto it = key_memo.find(build_key(build_manifest->product_type.data(), build_manifest->device_class.data(), build_manifest->product_build_version.data()));
+        if (it != key_memo.end()) {
+            key_table_merge(&it->second, remote_table);
+        }
+    }
+    if (key_cache_store(build_manifest->product_type.data(), build_manifest->device_class.data(), build_manifest->product_build_version.data(), remote_table) != ILE_SUCCESS) {
+        log_message(WARNING, "Failed to save the firmware keys to the key cache");
+    }
+    
+    /* Only keys that weren't already tried are worth another check */
+    uint32_t added = 0;
+    for (uint32_t i = 0; i < build_manifest->keys.size(); i++) {
+        firmware_key_t& firmware_key = build_manifest->keys[i];
+        if (!firmware_key.rejected) {
+            continue;
+        }
+        const vector<const key_record_t*> records = key_table_find(remote_table, build_manifest->manifest_component_names[i].data());
+        for (size_t j = 0; j < records.size(); j++) {
+            bool tried = false;
+            for (size_t k = 0; k < firmware_key.candidates.size() && !tried; k++) {
+                tried = (firmware_key.candidates[k].iv == records[j]->iv && firmware_key.candidates[k].key == records[j]->key);
+            }
+            if (!tried) {
+                add_key_candidate(build_manifest, *records[j], &firmware_key);
+                added++;
+            }
+        }
+    }
+    if (added == 0) {
+        log_message(ERROR, "The key servers have no other keys for the components the local keys don't decrypt");
+        return ILE_E_WRONG_KEYS;
     }
     
     return ILE_SUCCESS;
@@ -9,41 +9,117 @@
 #define api_hpp
 
 #include <stdlib.h>
+#include <string>
 #include <vector>
+#include <plist/plist.h>
 #include "ipsw.hpp"
+#include "key_cache.hpp"
+#include "http_client.hpp"
 
 using namespace std;
 
 #define WIKIPROXY_SERVER_ERROR "Internal Server Error"
 
+/* Where keys are requested from unless set_key_endpoint or ILE_KEY_ENDPOINT says otherwise */
+#define KEY_ENDPOINT_DEFAULT "https://api.m1sta.xyz/wikiproxy"
+#define KEY_ENDPOINT_ENV     "ILE_KEY_ENDPOINT"
+
+/* Another endpoint (a URL or folder, like set_key_endpoint takes) that is asked when wikiproxy fails or doesn't know the build */
+#define KEY_MIRROR_ENV "ILE_KEY_MIRROR"
+
+/* The sources recorded for keys that didn't come from a key file or the key cache */
+#define KEY_SOURCE_WIKIPROXY "wikiproxy"
+#define KEY_SOURCE_MIRROR    "key mirror"
+#define KEY_SOURCE_USER      "entered by hand"
+
 typedef struct {
     char* contents;
     size_t size;
 } api_response_t;
 
+typedef struct {
+    string product_type;
+    string device_class;
+    string product_build_version;
+} build_id_t;
+
 /**
- Callback function for curl to write data
- @param contents Contents
- @param size Size
- @param nmemb Nmemb
- @param response Poitner to the response struct to update
- @return The total size of the new data
+ Sets where keys are requested from. An http:// or https:// URL is asked for <URL>/<ProductType>/<DeviceClass>/<Build>, and a file:// URL or a plain folder is read in the same layout, one response per file
+ @param endpoint The URL or folder
  */
-size_t curl_write_cb(void* contents, size_t size, size_t nmemb, api_response_t* response);
+void set_key_endpoint(const char* endpoint);
 
 /**
- Function to call the wikiproxy api to get firmware keys
+ Function to call the wikiproxy api to get firmware keys, on the process-wide connection
  @param build_manifest The build manifest (must be parsed first)
  @param response Pointer to the resposne structure
- @return ile_error_t error code
+ @return ile_error_t error code, ILE_E_KEYS_NOT_FOUND if wikiproxy doesn't know the build
  */
 ile_error_t call_api(build_manifest_t build_manifest, api_response_t* response);
 
 /**
- Makes the wikiproxy api request and appends the keys found to the build manifest structure
- @param build_manifest Pointer to the build manifest structure
+ Normalizes a key response that has already been converted to a plist into a key table. Responses have an array of objects with image, iv and key, flat <Name>IV and <Name>Key pairs, or both, in which case both are kept as candidates
+ @param root_node The response's root dictionary, which is left for the caller to free
+ @param source Where the response came from, recorded in every record
+ @param table Pointer to the table to populate
  @return ile_error_t error code
  */
+ile_error_t parse_key_node(plist_t root_node, const char* source, key_table_t* table);
+
+/**
+ Normalizes a wikiproxy response into a key table. Responses have an array of objects with image, iv and key, flat <Name>IV and <Name>Key pairs, or both
+ @param contents The JSON response
+ @param size The size of the response
+ @param source Where the response came from, recorded in every record
+ @param table Pointer to the table to populate
+ @return ile_error_t error code
+ */
+ile_error_t parse_key_response(const char* contents, size_t size, const char* source, key_table_t* table);
+
+/**
+ Looks up the keys for many builds at once, fetching every build that isn't in the key file, key folder or key cache concurrently. The results are kept for append_keys_to_build_manifest, and lookups of these builds that start meanwhile wait for them
+ @param builds The builds
+ @return ile_error_t error code
+ */
+ile_error_t prefetch_keys(const vector<build_id_t>& builds);
+
+/**
+ Sets whether the user is asked to type keys in when no key source has them. On by default, batch runs and --no-prompt turn it off. The user is never asked when standard input isn't a terminal
+ @param enabled Whether to prompt
+ */
+void set_manual_key_entry(bool enabled);
+
+/**
+ Gets whether the user is asked to type keys in when no key source has them
+ @return Whether to prompt
+ */
+bool get_manual_key_entry(void);
+
+/**
+ Gets the stats of the requests made for a build's keys in this process, to wikiproxy, the mirror or in a prefetch, leaving out requests made for other builds
+ @param build_manifest The build manifest the keys were looked up for
+ @param stats Pointer to the stats, all zero if nothing was requested for the build
+ */
+void get_key_request_stats(const build_manifest_t& build_manifest, http_stats_t* stats);
+
+/**
+ Forgets the keys looked up for a build after they turned out not to decrypt it, so the next lookup asks the key sources again. The key cache entry is only removed if a rejected component had a key from it or from the key servers. Key files and folders are left alone
+ @param build_manifest The build manifest the keys were looked up for, after validate_component_keys
+ */
+void reject_keys(const build_manifest_t& build_manifest);
+
+/**
+ Appends the keys for the build to the build manifest structure, from this process's earlier lookups, the key file or folder, or the key cache if possible, and from wikiproxy or the key mirror for any encrypted component those leave without a key. Lookups of the same build from other threads, or other processes sharing the key cache, share one set of requests
+ @param build_manifest Pointer to the build manifest structure
+ @return ile_error_t error code, ILE_E_MISSING_KEYS if an encrypted component has no key and the user wasn't asked or didn't give one
+ */
 ile_error_t append_keys_to_build_manifest(build_manifest_t* build_manifest);
 
+/**
+ Adds what wikiproxy or the key mirror have as more candidates for every component validate_component_keys rejected, for when the only keys for it came from the key file, key folder or key cache. Their answer replaces the key cache entry
+ @param build_manifest Pointer to the build manifest structure, after validate_component_keys
+ @return ile_error_t error code, ILE_E_WRONG_KEYS if the key servers were already asked or have no other key for a rejected component
+ */
+ile_error_t append_remote_keys_to_build_manifest(build_manifest_t* build_manifest);
+
 #endif /* api_hpp */
@@ -0,0 +1,328 @@
+//
+//  batch.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <plist/plist.h>
+#include "utilities.hpp"
+#include "ipsw.hpp"
+#include "api.hpp"
+#include "extraction.hpp"
+#include "batch.hpp"
+
+using namespace std;
+
+ile_error_t process_ipsw(const char* ipsw_path, const char* output_dir_path, process_options_t options) {
+    ile_error_t ret     = ILE_SUCCESS;
+    ipsw_archive_t ipsw = { NULL, ipsw_path };
+    char* work_dir_path = NULL;
+    
+    /* Pre Checks */
+    ret = check_io_setup(ipsw.path, output_dir_path);
+    if (ret != ILE_SUCCESS) {
+        log_message(ERROR, ile_strerror(ret));
+        return ret;
+    }
+    
+    /* Only setup a work environment if the payloads should be kept, everything else is handled in memory */
+    if (options.keep_work) {
+        ret = open_work(output_dir_path, &work_dir_path);
+        if (ret != ILE_SUCCESS) {
+            log_message(ERROR, ile_strerror(ret));
+            return ret;
+        }
+    }
+    log_message(LOG, "Opening IPSW...");
+    ret = ipsw_open(&ipsw);
+    if (ret != ILE_SUCCESS) {
+        log_message(ERROR, ile_strerror(ret));
+        free(work_dir_path);
+        return ret;
+    }
+    
+    /* Parse the build manifest */
+    log_message(LOG, "Parsing the build manifest...");
+    build_manifest_t build_manifest = { NULL };
+    ret = parse_build_manifest(ipsw, &build_manifest);
+    if (ret != ILE_SUCCESS) {
+        log_message(ERROR, ile_strerror(ret));
+        build_manifest_free(&build_manifest);
+        ipsw_close(&ipsw);
+        free(work_dir_path);
+        return ret;
+    }
+    
+    /* Extract any appropriate images */
+    ret = extract_to_output_dir(build_manifest, ipsw, work_dir_path, output_dir_path, options.jobs);
+    if (ret != ILE_SUCCESS) {
+        log_message(ERROR, ile_strerror(ret));
+        build_manifest_free(&build_manifest);
+        ipsw_close(&ipsw);
+        free(work_dir_path);
+        return ret;
+    }
+    
+    ret = write_report(ipsw, build_manifest, output_dir_path);
+    if (ret != ILE_SUCCESS) {
+        log_message(WARNING, ile_strerror(ret));
+    }
+    
+    /* Tear down */
+    log_message(LOG, "Tearing down...");
+    ipsw_close(&ipsw);
+    build_manifest_free(&build_manifest);
+    free(work_dir_path);
+    
+    return ILE_SUCCESS;
+}
+
+static bool has_ipsw_extension(const char* name) {
+    const size_t len = strlen(name);
+    return len > 5 && !strcasecmp(&name[len - 5], ".ipsw");
+}
+
+ile_error_t collect_batch_inputs(const char* input, vector<string>* ipsw_paths) {
+    const size_t initial_count = ipsw_paths->size();
+    
+    struct stat st;
+    if (stat(input, &st) == 0 && S_ISDIR(st.st_mode)) {
+        /* Every IPSW directly in the directory */
+        DIR* dp = opendir(input);
+        if (!dp) {
+            return ILE_E_FAILED_TO_OPEN_FILE_FOR_READING;
+        }
+        vector<string> found;
+        struct dirent* entry = NULL;
+        while ((entry = readdir(dp)) != NULL) {
+            if (has_ipsw_extension(entry->d_name)) {
+                found.push_back(string(input) + "/" + entry->d_name);
+            }
+        }
+        closedir(dp);
+        sort(found.begin(), found.end());
+        ipsw_paths->insert(ipsw_paths->end(), found.begin(), found.end());
+    } else if (stat(input, &st) == 0 && S_ISREG(st.st_mode) && !valid_magic(input, IPSW_MAGIC)) {
+        /* A list of paths or URLs, one per line */
+        FILE* fp = fopen(input, "r");
+        if (!fp) {
+            return ILE_E_FAILED_TO_OPEN_FILE_FOR_READING;
+        }
+        char line[4096];
+        while (fgets(line, sizeof(line), fp)) {
+            /* Trim the line */
+            char* start = line;
+            while (*start == ' ' || *start == '\t') {
+                start++;
+            }
+            size_t len = strlen(start);
+            while (len > 0 && (start[len - 1] == '\n' || start[len - 1] == '\r' || start[len - 1] == ' ' || start[len - 1] == '\t')) {
+                start[--len] = '\0';
+            }
+            if (len == 0 || start[0] == '#') {
+                continue;
+            }
+            ipsw_paths->push_back(start);
+        }
+        fclose(fp);
+    } else if (stat(input, &st) == 0 && S_ISREG(st.st_mode)) {
+        /* Just one IPSW */
+        ipsw_paths->push_back(input);
+    } else {
+        /* Treat it as a glob pattern, glob sorts the matches */
+        glob_t matches;
+        if (glob(input, 0, NULL, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; i++) {
+                ipsw_paths->push_back(matches.gl_pathv[i]);
+            }
+        }
+        globfree(&matches);
+    }
+    
+    if (ipsw_paths->size() == initial_count) {
+        return ILE_E_NO_BATCH_INPUTS;
+    }
+    
+    return ILE_SUCCESS;
+}
+
+static string batch_output_name(const string& ipsw_path, unordered_set<string>* used_names) {
+    /* Name the subdirectory after the IPSW, minus any query string and extension */
+    string name = get_file_name_from_path(ipsw_path.c_str());
+    const size_t query = name.find('?');
+    if (query != string::npos) {
+        name.erase(query);
+    }
+    if (has_ipsw_extension(name.c_str())) {
+        name.erase(name.size() - 5);
+    }
+    if (name.empty()) {
+        name = "ipsw";
+    }
+    
+    /* Two inputs with the same name (from different directories or mirrors) get a numbered suffix */
+    string unique_name = name;
+    for (uint32_t i = 2; used_names->count(unique_name); i++) {
+        unique_name = name + "_" + to_string(i);
+    }
+    used_names->insert(unique_name);
+    
+    return unique_name;
+}
+
+static ile_error_t write_batch_summary(const vector<batch_result_t>& results, const char* output_dir_path) {
+    plist_t root_node     = plist_new_dict();
+    plist_t results_array = plist_new_array();
+    if (!root_node) {
+        return ILE_E_FAILED_TO_CREATE_PLIST_OBJECT;
+    } else if (root_node && !results_array) {
+        plist_free(root_node);
+        return ILE_E_FAILED_TO_CREATE_PLIST_OBJECT;
+    }
+    
+    uint32_t succeeded = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        plist_t entry = plist_new_dict();
+        if (!entry) {
+            plist_free(results_array);
+            plist_free(root_node);
+            return ILE_E_FAILED_TO_CREATE_PLIST_OBJECT;
+        }
+        
+        /* Populate the entry with this IPSW's status */
+        plist_dict_set_item(entry, "ipsw",       plist_new_string(results[i].ipsw_path.c_str()));
+        plist_dict_set_item(entry, "output",     plist_new_string(results[i].output_dir_path.c_str()));
+        plist_dict_set_item(entry, "status",     plist_new_string((results[i].status == ILE_SUCCESS) ? "ok" : "failed"));
+        plist_dict_set_item(entry, "error_code", plist_new_int(results[i].status));
+        if (results[i].status != ILE_SUCCESS) {
+            plist_dict_set_item(entry, "error",  plist_new_string(ile_strerror(results[i].status)));
+        } else {
+            succeeded++;
+        }
+        
+        plist_array_append_item(results_array, entry);
+    }
+    plist_dict_set_item(root_node, "ipsw_count", plist_new_uint(results.size()));
+    plist_dict_set_item(root_node, "succeeded",  plist_new_uint(succeeded));
+    plist_dict_set_item(root_node, "failed",     plist_new_uint(results.size() - succeeded));
+    plist_dict_set_item(root_node, "results",    results_array);
+    
+    /* Create the path and write out to a file */
+    char* summary_output_path = NULL;
+    asprintf(&summary_output_path, "%s/summary.plist", output_dir_path);
+    if (!summary_output_path) {
+        plist_free(root_node);
+        return ILE_E_OUT_OF_MEMORY;
+    }
+    const plist_err_t err = plist_write_to_file(root_node, summary_output_path, PLIST_FORMAT_XML, PLIST_OPT_NONE);
+    
+    /* Cleanup and return */
+    plist_free(root_node);
+    free(summary_output_path);
+    
+    return (err == PLIST_ERR_SUCCESS) ? ILE_SUCCESS : ILE_E_FAILED_TO_WRITE_OUT_REPORT;
+}
+
+static bool needs_any_keys(ipsw_archive_t ipsw, build_manifest_t* build_manifest) {
+    vector<uint32_t> indices;
+    for (uint32_t i = 0; i < build_manifest->file_count; i++) {
+        indices.push_back(i);
+    }
+    
+    /* If it can't be checked, fetching the keys is the safe bet */
+    if (detect_encrypted_components(ipsw, indices, build_manifest) != ILE_SUCCESS) {
+        return true;
+    }
+    for (uint32_t i = 0; i < build_manifest->file_count; i++) {
+        if (build_manifest->encrypted[i]) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+static void prefetch_batch_keys(const vector<string>& ipsw_paths) {
+    /* Only the device info is needed, which the index sidecar usually already has. Builds with nothing encrypted are skipped */
+    vector<build_id_t> builds;
+    for (size_t i = 0; i < ipsw_paths.size(); i++) {
+        ipsw_archive_t ipsw = { NULL, ipsw_paths[i].c_str() };
+        if (ipsw_open(&ipsw) != ILE_SUCCESS) {
+            continue;
+        }
+        build_manifest_t build_manifest = { NULL };
+        if (parse_build_manifest_info(ipsw, &build_manifest) == ILE_SUCCESS && needs_any_keys(ipsw, &build_manifest)) {
+            builds.push_back({ string(build_manifest.product_type), string(build_manifest.device_class), string(build_manifest.product_build_version) });
+        }
+        build_manifest_free(&build_manifest);
+        ipsw_close(&ipsw);
+    }
+    
+    /* Failures are dealt with per IPSW later */
+    if (prefetch_keys(builds) != ILE_SUCCESS) {
+        log_message(WARNING, "Failed to prefetch firmware keys, they will be fetched one IPSW at a time");
+    }
+}
+
+ile_error_t run_batch(const vector<string>& ipsw_paths, const char* output_dir_path, process_options_t options) {
+    /* The output directory follows the same rules as a single run, every IPSW then gets its own directory inside it */
+    DIR* dp = opendir(output_dir_path);
+    if (dp) {
+        closedir(dp);
+        return ILE_E_OUTPUT_DIR_ALREADY_EXISTS;
+    } else if (mkdir(output_dir_path, 0777) != 0) {
+        return ILE_E_COULD_NOT_MAKE_OUTPUT_DIR;
+    }
+    
+    /* Nobody is around to type keys in during a batch, a missing key just fails that IPSW */
+    const bool manual_key_entry = get_manual_key_entry();
+    set_manual_key_entry(false);
+    
+    /* Look up every build's keys up front so they come in concurrently instead of one IPSW at a time */
+    prefetch_batch_keys(ipsw_paths);
+    
+    vector<batch_result_t> results;
+    unordered_set<string> used_names;
+    uint32_t failed = 0;
+    for (size_t i = 0; i < ipsw_paths.size(); i++) {
+        batch_result_t result;
+        result.ipsw_path       = ipsw_paths[i];
+        result.output_dir_path = string(output_dir_path) + "/" + batch_output_name(ipsw_paths[i], &used_names);
+        
+        char* message = NULL;
+        asprintf(&message, "[%zu/%zu] %s", i + 1, ipsw_paths.size(), result.ipsw_path.c_str());
+        log_message(LOG, message ? message : result.ipsw_path.c_str());
+        free(message);
+        
+        /* One bad IPSW shouldn't stop the rest */
+        result.status = process_ipsw(result.ipsw_path.c_str(), result.output_dir_path.c_str(), options);
+        if (result.status != ILE_SUCCESS) {
+            failed++;
+        }
+        results.push_back(result);
+    }
+    
+    set_manual_key_entry(manual_key_entry);
+    
+    ile_error_t ret = write_batch_summary(results, output_dir_path);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    char* message = NULL;
+    asprintf(&message, "Batch finished: %zu succeeded, %u failed", results.size() - failed, failed);
+    log_message(LOG, message ? message : "Batch finished");
+    free(message);
+    
+    return (failed == 0) ? ILE_SUCCESS : ILE_E_BATCH_HAD_FAILURES;
+}
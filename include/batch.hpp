@@ -0,0 +1,55 @@
+//
+//  batch.hpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#ifndef batch_hpp
+#define batch_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "utilities.hpp"
+
+using namespace std;
+
+typedef struct {
+    bool keep_work;
+    uint32_t jobs;
+} process_options_t;
+
+typedef struct {
+    string ipsw_path;
+    string output_dir_path;
+    ile_error_t status;
+} batch_result_t;
+
+/**
+ Runs the whole pipeline for one IPSW: checks, opening, manifest parsing, extraction and the report
+ @param ipsw_path Path or URL of the IPSW
+ @param output_dir_path Path to the output directory, which must not exist yet
+ @param options The options
+ @return ile_error_t error code
+ */
+ile_error_t process_ipsw(const char* ipsw_path, const char* output_dir_path, process_options_t options);
+
+/**
+ Expands a batch input into a list of IPSWs. The input can be a directory (every .ipsw in it), a glob pattern, or a text file with one path or URL per line (blank lines and lines starting with # are ignored)
+ @param input The batch input
+ @param ipsw_paths Pointer to the vector that the paths are appended to, sorted for directories and globs
+ @return ile_error_t error code
+ */
+ile_error_t collect_batch_inputs(const char* input, vector<string>* ipsw_paths);
+
+/**
+ Processes every IPSW into its own subdirectory of the output directory in one process, so connections and looked up keys are shared between them. Keys for every build are fetched concurrently before the first IPSW is processed, then writes summary.plist with each IPSW's status
+ @param ipsw_paths The IPSWs
+ @param output_dir_path Path to the output directory, which must not exist yet
+ @param options The options used for every IPSW
+ @return ile_error_t error code, ILE_E_BATCH_HAD_FAILURES if any IPSW failed
+ */
+ile_error_t run_batch(const vector<string>& ipsw_paths, const char* output_dir_path, process_options_t options);
+
+#endif /* batch_hpp */
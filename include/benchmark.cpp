@@ -0,0 +1,224 @@
+//
+//  benchmark.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#include <img3tool/img3tool.hpp>
+#include <img4tool/img4tool.hpp>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "utilities.hpp"
+#include "ipsw.hpp"
+#include "extraction.hpp"
+#include "benchmark.hpp"
+
+using namespace std;
+using namespace tihmstar::img3tool;
+using namespace tihmstar::img4tool;
+
+static bool build_manifests_match(const build_manifest_t& a, const build_manifest_t& b) {
+    if (a.product_type != b.product_type || a.device_class != b.device_class || a.product_build_version != b.product_build_version ||
+        a.paths != b.paths || a.manifest_component_names != b.manifest_component_names || a.digests != b.digests || a.identities.size() != b.identities.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.identities.size(); i++) {
+        if (a.identities[i].device_class != b.identities[i].device_class || a.identities[i].files != b.identities[i].files || a.identities[i].component_names != b.identities[i].component_names) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/* Runs one parser over the manifest, leaving the last result in build_manifest */
+static ile_error_t time_manifest_parser(const char* buffer, size_t size, manifest_parser_t parser, uint32_t iterations, build_manifest_t* build_manifest, double* seconds) {
+    const auto start = chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        build_manifest_free(build_manifest);
+        ile_error_t ret = parse_build_manifest_buffer(buffer, size, parser, build_manifest);
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+    }
+    *seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    return ILE_SUCCESS;
+}
+
+static void print_timing(const char* name, double seconds, size_t size, uint32_t iterations) {
+    printf("%-10s %10.3f ms/parse %10.1f MB/s\n", name, seconds * 1000.0 / iterations, ((double)size * iterations) / seconds / (1024.0 * 1024.0));
+}
+
+ile_error_t benchmark_manifest_parsers(const char* ipsw_path, uint32_t iterations) {
+    ipsw_archive_t ipsw = { NULL, ipsw_path };
+    ile_error_t ret     = ipsw_open(&ipsw);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    /* The manifest is only inflated once so just the parsing is timed */
+    char* buffer = NULL;
+    size_t size  = 0;
+    ret = load_build_manifest_file(ipsw, &buffer, &size);
+    ipsw_close(&ipsw);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    if (iterations == 0) {
+        iterations = BENCHMARK_DEFAULT_ITERATIONS;
+    }
+    
+    build_manifest_t streaming = { NULL };
+    build_manifest_t dom       = { NULL };
+    double streaming_seconds   = 0;
+    double dom_seconds         = 0;
+    ret = time_manifest_parser(buffer, size, MANIFEST_PARSER_STREAMING, iterations, &streaming, &streaming_seconds);
+    if (ret == ILE_SUCCESS) {
+        ret = time_manifest_parser(buffer, size, MANIFEST_PARSER_DOM, iterations, &dom, &dom_seconds);
+    }
+    if (ret == ILE_SUCCESS) {
+        printf("BuildManifest: %zu bytes (%s), %zu identities, %u files, %u iterations\n", size, (size >= 8 && !memcmp(buffer, "bplist00", 8)) ? "binary" : "XML", streaming.identities.size(), streaming.file_count, iterations);
+        print_timing("streaming", streaming_seconds, size, iterations);
+        print_timing("libplist", dom_seconds, size, iterations);
+        printf("Speedup: %.1fx\n", dom_seconds / streaming_seconds);
+        if (!build_manifests_match(streaming, dom)) {
+            log_message(WARNING, "The streaming and libplist parsers disagree on this manifest");
+        }
+    }
+    
+    build_manifest_free(&streaming);
+    build_manifest_free(&dom);
+    free(buffer);
+    
+    return ret;
+}
+
+/* Decrypts a payload the way extraction did before it was decrypted natively, leaving the last result in payload */
+static ile_error_t time_library_decryption(const component_t& component, const key_candidate_t& key, uint32_t iterations, vector<uint8_t>* payload, double* seconds) {
+    const auto start = chrono::steady_clock::now();
+    try {
+        for (uint32_t i = 0; i < iterations; i++) {
+            if (component.image_type == IMG3) {
+                *payload = getPayloadFromIMG3(component.view.data, component.view.size, key.iv.data(), key.key.data());
+            } else {
+                ASN1DERElement im4p(component.view.data, component.view.size);
+                ASN1DERElement im4p_payload = getPayloadFromIM4P(im4p, key.iv.data(), key.key.data());
+                payload->assign((const uint8_t*)im4p_payload.payload(), (const uint8_t*)im4p_payload.payload() + im4p_payload.payloadSize());
+            }
+        }
+    } catch (...) {
+        return ILE_E_FAILED_TO_OPEN_FILE_FOR_READING;
+    }
+    *seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    return ILE_SUCCESS;
+}
+
+/* Decrypts a payload with decrypt_component_payload into a buffer that's reused between iterations, leaving the last result in payload */
+static ile_error_t time_native_decryption(const component_t& component, const key_candidate_t& key, uint32_t iterations, vector<uint8_t>* payload, double* seconds) {
+    /* A view that doesn't own its buffer is never overwritten, so every iteration decrypts the same ciphertext */
+    component_t view = component;
+    view.view.owned  = NULL;
+    
+    const void* payload_data = NULL;
+    size_t payload_size      = 0;
+    const auto start = chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        ile_error_t ret = decrypt_component_payload(&view, &key, payload, &payload_data, &payload_size);
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+    }
+    *seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    
+    return ILE_SUCCESS;
+}
+
+static void print_throughput(const char* name, double seconds, size_t size, uint32_t iterations) {
+    printf("  %-10s %10.3f ms/decrypt %10.1f MB/s\n", name, seconds * 1000.0 / iterations, ((double)size * iterations) / seconds / (1024.0 * 1024.0));
+}
+
+ile_error_t benchmark_decryption(const char* ipsw_path, uint32_t iterations) {
+    ipsw_archive_t ipsw = { NULL, ipsw_path };
+    ile_error_t ret     = ipsw_open(&ipsw);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    /* Keys are looked up and checked the same way extraction does */
+    build_manifest_t build_manifest = { NULL };
+    ret = parse_build_manifest(ipsw, &build_manifest);
+    if (ret != ILE_SUCCESS) {
+        build_manifest_free(&build_manifest);
+        ipsw_close(&ipsw);
+        return ret;
+    }
+    if (iterations == 0) {
+        iterations = BENCHMARK_DEFAULT_ITERATIONS;
+    }
+    
+    size_t total_size    = 0;
+    double native_total  = 0;
+    double library_total = 0;
+    uint32_t benchmarked = 0;
+    for (uint32_t i = 0; i < build_manifest.file_count && ret == ILE_SUCCESS; i++) {
+        if (i >= build_manifest.keys.size() || !build_manifest.keys[i].available) {
+            continue;
+        }
+        
+        /* Every component is only read once so just the decryption is timed */
+        component_t component;
+        ret = load_component(ipsw, build_manifest.paths[i].data(), &component);
+        if (ret == ILE_E_FAILED_TO_GET_ZIP_INDEX) {
+            ret = ILE_SUCCESS;
+            continue;
+        } else if (ret != ILE_SUCCESS) {
+            break;
+        }
+        
+        const key_candidate_t& key = build_manifest.keys[i].candidates.front();
+        vector<uint8_t> native_payload;
+        vector<uint8_t> library_payload;
+        double native_seconds  = 0;
+        double library_seconds = 0;
+        ret = time_native_decryption(component, key, iterations, &native_payload, &native_seconds);
+        if (ret == ILE_SUCCESS) {
+            ret = time_library_decryption(component, key, iterations, &library_payload, &library_seconds);
+        }
+        free_component(&component);
+        if (ret != ILE_SUCCESS) {
+            break;
+        }
+        
+        printf("%s: %zu bytes (%s)\n", build_manifest.manifest_component_names[i].data(), native_payload.size(), component.image_type == IMG3 ? "IMG3" : "IM4P");
+        print_throughput("native", native_seconds, native_payload.size(), iterations);
+        print_throughput(component.image_type == IMG3 ? "img3tool" : "img4tool", library_seconds, native_payload.size(), iterations);
+        
+        /* img4tool also decompresses compressed payloads, which extraction leaves to it, so only those should differ */
+        if (native_payload != library_payload) {
+            log_message(WARNING, "The native and library payloads differ for this component, which is expected only if it's compressed");
+        }
+        total_size    += native_payload.size();
+        native_total  += native_seconds;
+        library_total += library_seconds;
+        benchmarked++;
+    }
+    
+    if (ret == ILE_SUCCESS && benchmarked == 0) {
+        log_message(LOG, "Nothing in this IPSW is encrypted, so there is nothing to benchmark");
+    } else if (ret == ILE_SUCCESS) {
+        printf("Total: %u components, %zu bytes, %u iterations\n", benchmarked, total_size, iterations);
+        print_throughput("native", native_total, total_size, iterations);
+        print_throughput("library", library_total, total_size, iterations);
+        printf("Speedup: %.1fx\n", library_total / native_total);
+    }
+    
+    build_manifest_free(&build_manifest);
+    ipsw_close(&ipsw);
+    
+    return ret;
+}
@@ -0,0 +1,34 @@
+//
+//  benchmark.hpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#ifndef benchmark_hpp
+#define benchmark_hpp
+
+#include <stdio.h>
+#include "utilities.hpp"
+
+using namespace std;
+
+#define BENCHMARK_DEFAULT_ITERATIONS 20
+
+/**
+ Times the streaming build manifest reader against the libplist DOM parser on an IPSW's manifest, checks that both produce the same result and prints the timings
+ @param ipsw_path Path or URL of the IPSW
+ @param iterations How many times each parser is run
+ @return ile_error_t error code
+ */
+ile_error_t benchmark_manifest_parsers(const char* ipsw_path, uint32_t iterations);
+
+/**
+ Times the native OpenSSL decryption against img3tool and img4tool on every encrypted component of an IPSW, with keys looked up the same way extraction does, checks that both produce the same payload and prints the throughput
+ @param ipsw_path Path or URL of the IPSW
+ @param iterations How many times each component is decrypted with each
+ @return ile_error_t error code
+ */
+ile_error_t benchmark_decryption(const char* ipsw_path, uint32_t iterations);
+
+#endif /* benchmark_hpp */
@@ -0,0 +1,130 @@
+//
+//  component_registry.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#include <string.h>
+#include "component_registry.hpp"
+
+/* Wikiproxy lists a few images under the name newer builds gave them */
+#define IMAGE(name)                 { name, COMPONENT_CLASS_IMAGE, name, name "IV", name "Key", name }
+#define RENAMED_IMAGE(name, wiki)   { name, COMPONENT_CLASS_IMAGE, wiki, wiki "IV", wiki "Key", wiki }
+#define NON_IMAGE(name)             { name, COMPONENT_CLASS_NON_IMAGE, name, name "IV", name "Key", name }
+
+static constexpr component_info_t COMPONENTS[] = {
+    IMAGE("AppleLogo"),
+    IMAGE("BatteryCharging0"),
+    IMAGE("BatteryCharging1"),
+    IMAGE("BatteryFull"),
+    IMAGE("BatteryLow0"),
+    IMAGE("BatteryLow1"),
+    IMAGE("GlyphCharging"),
+    IMAGE("GlyphPlugin"),
+    IMAGE("NeedService"),
+    IMAGE("RecoveryMode"),
+    IMAGE("RestoreLogo"),
+    IMAGE("LowPowerMode"),
+    RENAMED_IMAGE("BatteryCharging", "GlyphCharging"),
+    RENAMED_IMAGE("BatteryPlugin",   "GlyphPlugin"),
+    NON_IMAGE("LLB"),
+    NON_IMAGE("iBoot"),
+    NON_IMAGE("iBootData"),
+    NON_IMAGE("iBEC"),
+    NON_IMAGE("iBSS"),
+    NON_IMAGE("DeviceTree"),
+    NON_IMAGE("RestoreDeviceTree"),
+    NON_IMAGE("KernelCache"),
+    NON_IMAGE("RestoreKernelCache"),
+    NON_IMAGE("RestoreRamDisk"),
+    NON_IMAGE("SEP"),
+    NON_IMAGE("RestoreSEP")
+};
+
+#define COMPONENT_COUNT      (sizeof(COMPONENTS) / sizeof(COMPONENTS[0]))
+#define COMPONENT_SLOT_COUNT 64
+#define COMPONENT_SLOT_EMPTY 0xFF
+
+static_assert(COMPONENT_COUNT < COMPONENT_SLOT_EMPTY && COMPONENT_COUNT <= COMPONENT_SLOT_COUNT, "Too many components for the slot table");
+
+static constexpr size_t constexpr_strlen(const char* string) {
+    size_t length = 0;
+    while (string[length]) {
+        length++;
+    }
+    return length;
+}
+
+/* FNV-1a seeded so a seed without collisions can be searched for, then mixed since FNV's low bits only depend on the low bits of its input */
+static constexpr uint32_t component_hash(const char* name, size_t length, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+static constexpr bool is_perfect_seed(uint32_t seed) {
+    bool used[COMPONENT_SLOT_COUNT] = { false };
+    for (size_t i = 0; i < COMPONENT_COUNT; i++) {
+        const uint32_t slot = component_hash(COMPONENTS[i].name, constexpr_strlen(COMPONENTS[i].name), seed) % COMPONENT_SLOT_COUNT;
+        if (used[slot]) {
+            return false;
+        }
+        used[slot] = true;
+    }
+    return true;
+}
+
+static constexpr uint32_t find_perfect_seed() {
+    for (uint32_t seed = 0; seed < 0x1000; seed++) {
+        if (is_perfect_seed(seed)) {
+            return seed;
+        }
+    }
+    return UINT32_MAX;
+}
+
+static constexpr uint32_t COMPONENT_SEED = find_perfect_seed();
+static_assert(COMPONENT_SEED != UINT32_MAX, "No perfect hash seed for the component table, increase COMPONENT_SLOT_COUNT");
+
+typedef struct {
+    uint8_t slots[COMPONENT_SLOT_COUNT];
+} component_slots_t;
+
+static constexpr component_slots_t build_slots() {
+    component_slots_t table = { { 0 } };
+    for (size_t i = 0; i < COMPONENT_SLOT_COUNT; i++) {
+        table.slots[i] = COMPONENT_SLOT_EMPTY;
+    }
+    for (size_t i = 0; i < COMPONENT_COUNT; i++) {
+        table.slots[component_hash(COMPONENTS[i].name, constexpr_strlen(COMPONENTS[i].name), COMPONENT_SEED) % COMPONENT_SLOT_COUNT] = (uint8_t)i;
+    }
+    return table;
+}
+
+static constexpr component_slots_t COMPONENT_SLOTS = build_slots();
+
+const component_info_t* component_registry_find(const char* name, size_t length) {
+    const uint8_t index = COMPONENT_SLOTS.slots[component_hash(name, length, COMPONENT_SEED) % COMPONENT_SLOT_COUNT];
+    if (index == COMPONENT_SLOT_EMPTY) {
+        return NULL;
+    }
+    
+    /* Anything else that hashes to the slot is an unknown component */
+    const component_info_t* component = &COMPONENTS[index];
+    if (strncmp(component->name, name, length) != 0 || component->name[length] != '\0') {
+        return NULL;
+    }
+    
+    return component;
+}
+
+const component_info_t* component_registry_find(const char* name) {
+    return component_registry_find(name, strlen(name));
+}
@@ -0,0 +1,50 @@
+//
+//  component_registry.hpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#ifndef component_registry_hpp
+#define component_registry_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+
+typedef enum {
+    COMPONENT_CLASS_IMAGE     = 0,
+    COMPONENT_CLASS_NON_IMAGE = 1
+} component_class_t;
+
+typedef struct {
+    /* The name BuildManifest.plist uses */
+    const char* name;
+    
+    /* Whether the payload is an ibootim that can be converted, anything else is skipped while parsing */
+    component_class_t component_class;
+    
+    /* The name wikiproxy lists the keys under, and its <Name>IV and <Name>Key fields in a flat response */
+    const char* wiki_name;
+    const char* iv_field;
+    const char* key_field;
+    
+    /* The name the images are saved under */
+    const char* output_name;
+} component_info_t;
+
+/**
+ Looks up a component in the table of known components, which is a perfect hash generated at compile time so this is one hash and one compare
+ @param name The component's name
+ @param length The length of the name
+ @return The component's info, or NULL if it isn't a known component
+ */
+const component_info_t* component_registry_find(const char* name, size_t length);
+
+/**
+ Looks up a component in the table of known components
+ @param name The component's name, null terminated
+ @return The component's info, or NULL if it isn't a known component
+ */
+const component_info_t* component_registry_find(const char* name);
+
+#endif /* component_registry_hpp */
@@ -0,0 +1,264 @@
+//
+//  diff.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <plist/plist.h>
+#include "utilities.hpp"
+#include "ipsw.hpp"
+#include "api.hpp"
+#include "extraction.hpp"
+#include "batch.hpp"
+#include "diff.hpp"
+
+using namespace std;
+
+void diff_build_manifests(ipsw_archive_t old_ipsw, const build_manifest_t& old_build_manifest, ipsw_archive_t new_ipsw, const build_manifest_t& new_build_manifest, vector<file_diff_t>* diffs) {
+    /* Index the old files by digest and by CRC-32 and size, the zip directory already has both */
+    unordered_map<string_view, uint32_t> old_digests;
+    map<pair<uint32_t, uint64_t>, uint32_t> old_crcs;
+    for (uint32_t i = 0; i < old_build_manifest.file_count; i++) {
+        if (!old_build_manifest.digests[i].empty()) {
+            old_digests.emplace(old_build_manifest.digests[i], i);
+        }
+        uint32_t crc32 = 0;
+        uint64_t size  = 0;
+        if (ipsw_stat_file(old_ipsw, old_build_manifest.paths[i].data(), &crc32, &size) == ILE_SUCCESS) {
+            old_crcs.emplace(make_pair(crc32, size), i);
+        }
+    }
+    
+    diffs->assign(new_build_manifest.file_count, file_diff_t{ FILE_CHANGED, 0 });
+    for (uint32_t i = 0; i < new_build_manifest.file_count; i++) {
+        file_diff_t& diff = (*diffs)[i];
+        auto digest = new_build_manifest.digests[i].empty() ? old_digests.end() : old_digests.find(new_build_manifest.digests[i]);
+        if (digest != old_digests.end()) {
+            diff.change    = FILE_SAME_DIGEST;
+            diff.old_index = digest->second;
+            continue;
+        }
+        
+        /* Digests are missing on some old manifests, and the hash used for them changed between releases */
+        uint32_t crc32 = 0;
+        uint64_t size  = 0;
+        if (ipsw_stat_file(new_ipsw, new_build_manifest.paths[i].data(), &crc32, &size) != ILE_SUCCESS) {
+            continue;
+        }
+        auto crc = old_crcs.find(make_pair(crc32, size));
+        if (crc != old_crcs.end()) {
+            diff.change    = FILE_SAME_CRC;
+            diff.old_index = crc->second;
+        }
+    }
+}
+
+/* Links every png the earlier run saved for a file to this run's names for it, false if the earlier run didn't save any */
+static ile_error_t link_previous_outputs(const vector<string>& old_output_names, const char* old_output_dir_path, const vector<string>& output_names, const char* output_dir_path, bool* linked) {
+    *linked = false;
+    
+    /* One image is saved as <name>.png, several as <name>_<i>.png */
+    vector<string> suffixes;
+    const string old_prefix = string(old_output_dir_path) + "/" + old_output_names[0];
+    if (access((old_prefix + ".png").c_str(), F_OK) == 0) {
+        suffixes.push_back(".png");
+    } else {
+        for (uint32_t i = 0; access((old_prefix + "_" + to_string(i) + ".png").c_str(), F_OK) == 0; i++) {
+            suffixes.push_back("_" + to_string(i) + ".png");
+        }
+    }
+    if (suffixes.empty()) {
+        return ILE_SUCCESS;
+    }
+    
+    for (size_t i = 0; i < output_names.size(); i++) {
+        for (size_t j = 0; j < suffixes.size(); j++) {
+            const string output_path = string(output_dir_path) + "/" + output_names[i] + suffixes[j];
+            ile_error_t ret = link_or_copy_file((old_prefix + suffixes[j]).c_str(), output_path.c_str());
+            if (ret != ILE_SUCCESS) {
+                return ret;
+            }
+        }
+    }
+    
+    *linked = true;
+    return ILE_SUCCESS;
+}
+
+static ile_error_t write_diff_report(const char* old_ipsw_path, const build_manifest_t& old_build_manifest, const build_manifest_t& build_manifest, const vector<file_diff_t>& diffs, const char* output_dir_path) {
+    plist_t root_node   = plist_new_dict();
+    plist_t files_array = plist_new_array();
+    if (!root_node || !files_array) {
+        plist_free(root_node);
+        plist_free(files_array);
+        return ILE_E_FAILED_TO_CREATE_PLIST_OBJECT;
+    }
+    
+    uint32_t changed = 0;
+    for (uint32_t i = 0; i < build_manifest.file_count; i++) {
+        plist_t entry = plist_new_dict();
+        if (!entry) {
+            plist_free(files_array);
+            plist_free(root_node);
+            return ILE_E_FAILED_TO_CREATE_PLIST_OBJECT;
+        }
+        
+        /* Populate the entry with how this file compared to the old build */
+        plist_dict_set_item(entry, "path",                    plist_new_string(build_manifest.paths[i].data()));
+        plist_dict_set_item(entry, "manifest_component_name", plist_new_string(build_manifest.manifest_component_names[i].data()));
+        if (diffs[i].change == FILE_CHANGED) {
+            plist_dict_set_item(entry, "status",              plist_new_string("changed"));
+            changed++;
+        } else {
+            plist_dict_set_item(entry, "status",              plist_new_string("unchanged"));
+            plist_dict_set_item(entry, "matched_by",          plist_new_string((diffs[i].change == FILE_SAME_DIGEST) ? "digest" : "crc32"));
+            plist_dict_set_item(entry, "old_path",            plist_new_string(old_build_manifest.paths[diffs[i].old_index].data()));
+        }
+        
+        plist_array_append_item(files_array, entry);
+    }
+    plist_dict_set_item(root_node, "old_ipsw",                  plist_new_string(old_ipsw_path));
+    plist_dict_set_item(root_node, "old_product_build_version", plist_new_string(old_build_manifest.product_build_version.data()));
+    plist_dict_set_item(root_node, "product_build_version",     plist_new_string(build_manifest.product_build_version.data()));
+    plist_dict_set_item(root_node, "changed",                   plist_new_uint(changed));
+    plist_dict_set_item(root_node, "unchanged",                 plist_new_uint(build_manifest.file_count - changed));
+    plist_dict_set_item(root_node, "files",                     files_array);
+    
+    /* Create the path and write out to a file */
+    char* diff_output_path = NULL;
+    asprintf(&diff_output_path, "%s/diff.plist", output_dir_path);
+    if (!diff_output_path) {
+        plist_free(root_node);
+        return ILE_E_OUT_OF_MEMORY;
+    }
+    const plist_err_t err = plist_write_to_file(root_node, diff_output_path, PLIST_FORMAT_XML, PLIST_OPT_NONE);
+    
+    /* Cleanup and return */
+    plist_free(root_node);
+    free(diff_output_path);
+    
+    return (err == PLIST_ERR_SUCCESS) ? ILE_SUCCESS : ILE_E_FAILED_TO_WRITE_OUT_REPORT;
+}
+
+/* Everything after both IPSWs are open, the caller cleans up */
+static ile_error_t run_diff(ipsw_archive_t old_ipsw, const char* old_output_dir_path, ipsw_archive_t ipsw, const char* output_dir_path, process_options_t options, build_manifest_t* old_build_manifest, build_manifest_t* build_manifest, char** work_dir_path) {
+    /* Only the manifests are needed to compare, neither IPSW's keys are looked up yet */
+    ile_error_t ret = parse_build_manifest_info(old_ipsw, old_build_manifest);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    ret = parse_build_manifest_info(ipsw, build_manifest);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    vector<file_diff_t> diffs;
+    diff_build_manifests(old_ipsw, *old_build_manifest, ipsw, *build_manifest, &diffs);
+    
+    /* Unchanged files are linked from the earlier run, anything it didn't save is processed like a changed file */
+    ret = make_identity_dirs(*build_manifest, output_dir_path);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    vector<uint32_t> changed;
+    for (uint32_t i = 0; i < build_manifest->file_count; i++) {
+        bool linked = false;
+        if (diffs[i].change != FILE_CHANGED) {
+            ret = link_previous_outputs(component_output_names(*old_build_manifest, diffs[i].old_index), old_output_dir_path, component_output_names(*build_manifest, i), output_dir_path, &linked);
+            if (ret != ILE_SUCCESS) {
+                return ret;
+            }
+        }
+        if (!linked) {
+            diffs[i].change = FILE_CHANGED;
+            changed.push_back(i);
+        }
+    }
+    
+    char* message = NULL;
+    asprintf(&message, "%zu of %u files changed since %s", changed.size(), build_manifest->file_count, old_build_manifest->product_build_version.data());
+    log_message(INFO, message ? message : "Compared against the old build");
+    free(message);
+    
+    /* Only what changed is decrypted and decoded, and only what of that is encrypted needs keys */
+    if (!changed.empty()) {
+        ret = detect_encrypted_components(ipsw, changed, build_manifest);
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+        ret = append_keys_to_build_manifest(build_manifest);
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+        ret = validate_component_keys(ipsw, changed, build_manifest);
+        if (ret == ILE_E_WRONG_KEYS && append_remote_keys_to_build_manifest(build_manifest) == ILE_SUCCESS) {
+            ret = validate_component_keys(ipsw, changed, build_manifest);
+        }
+        if (ret == ILE_E_WRONG_KEYS) {
+            reject_keys(*build_manifest);
+        }
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+        if (options.keep_work) {
+            ret = open_work(output_dir_path, work_dir_path);
+            if (ret != ILE_SUCCESS) {
+                return ret;
+            }
+        }
+        ret = extract_files_to_output_dir(*build_manifest, changed, ipsw, *work_dir_path, output_dir_path, options.jobs);
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+    }
+    
+    if (write_report(ipsw, *build_manifest, output_dir_path) != ILE_SUCCESS || write_diff_report(old_ipsw.path, *old_build_manifest, *build_manifest, diffs, output_dir_path) != ILE_SUCCESS) {
+        log_message(WARNING, ile_strerror(ILE_E_FAILED_TO_WRITE_OUT_REPORT));
+    }
+    
+    return ILE_SUCCESS;
+}
+
+ile_error_t process_ipsw_diff(const char* old_ipsw_path, const char* old_output_dir_path, const char* ipsw_path, const char* output_dir_path, process_options_t options) {
+    /* Pre Checks */
+    ile_error_t ret = check_io_setup(ipsw_path, output_dir_path);
+    if (ret != ILE_SUCCESS) {
+        log_message(ERROR, ile_strerror(ret));
+        return ret;
+    }
+    
+    log_message(LOG, "Opening both IPSWs...");
+    ipsw_archive_t old_ipsw             = { NULL, old_ipsw_path };
+    ipsw_archive_t ipsw                 = { NULL, ipsw_path };
+    build_manifest_t old_build_manifest = { NULL };
+    build_manifest_t build_manifest     = { NULL };
+    char* work_dir_path                 = NULL;
+    ret = ipsw_open(&old_ipsw);
+    if (ret == ILE_SUCCESS) {
+        ret = ipsw_open(&ipsw);
+    }
+    if (ret == ILE_SUCCESS) {
+        ret = run_diff(old_ipsw, old_output_dir_path, ipsw, output_dir_path, options, &old_build_manifest, &build_manifest, &work_dir_path);
+    }
+    if (ret != ILE_SUCCESS) {
+        log_message(ERROR, ile_strerror(ret));
+    }
+    
+    /* Tear down */
+    build_manifest_free(&build_manifest);
+    build_manifest_free(&old_build_manifest);
+    ipsw_close(&ipsw);
+    ipsw_close(&old_ipsw);
+    free(work_dir_path);
+    
+    return ret;
+}
@@ -0,0 +1,53 @@
+//
+//  diff.hpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#ifndef diff_hpp
+#define diff_hpp
+
+#include <stdio.h>
+#include <vector>
+#include "utilities.hpp"
+#include "ipsw.hpp"
+#include "batch.hpp"
+
+using namespace std;
+
+typedef enum {
+    FILE_CHANGED     = 0,
+    FILE_SAME_DIGEST = 1,
+    FILE_SAME_CRC    = 2
+} file_change_t;
+
+typedef struct {
+    file_change_t change;
+    
+    /* The matching file in the old build manifest, only set when the file didn't change */
+    uint32_t old_index;
+} file_diff_t;
+
+/**
+ Compares every file of a new build against an old one by their BuildManifest digests, falling back to the zip CRC-32 and size when the digests don't match (or either file doesn't have one). Nothing is read or decrypted from either IPSW
+ @param old_ipsw The old IPSW archive
+ @param old_build_manifest The old build manifest, which only needs to be parsed
+ @param new_ipsw The new IPSW archive
+ @param new_build_manifest The new build manifest, which only needs to be parsed
+ @param diffs Pointer to the vector that gets one entry per file of the new build manifest
+ */
+void diff_build_manifests(ipsw_archive_t old_ipsw, const build_manifest_t& old_build_manifest, ipsw_archive_t new_ipsw, const build_manifest_t& new_build_manifest, vector<file_diff_t>* diffs);
+
+/**
+ Runs the pipeline for an IPSW against an earlier run on an older IPSW. Files that didn't change are linked from the earlier run's output, only the rest are decrypted and decoded, and keys are only looked up if something changed. Writes diff.plist with what changed next to the report
+ @param old_ipsw_path Path or URL of the older IPSW
+ @param old_output_dir_path The output directory of the earlier run on the older IPSW
+ @param ipsw_path Path or URL of the IPSW
+ @param output_dir_path Path to the output directory, which must not exist yet
+ @param options The options
+ @return ile_error_t error code
+ */
+ile_error_t process_ipsw_diff(const char* old_ipsw_path, const char* old_output_dir_path, const char* ipsw_path, const char* output_dir_path, process_options_t options);
+
+#endif /* diff_hpp */
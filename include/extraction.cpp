@@ -8,7 +8,14 @@
 #include <img3tool/img3tool.hpp>
 #include <img4tool/img4tool.hpp>
 #include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <string>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <openssl/evp.h>
 #include "extraction.hpp"
 #include "utilities.hpp"
 #include "ipsw.hpp"
@@ -21,166 +28,668 @@ using namespace std;
 using namespace tihmstar::img3tool;
 using namespace tihmstar::img4tool;
 
-ile_error_t get_image_type(ipsw_archive_t archive, const char* path, image_type_t* image_type) {
-    char* file_buffer = NULL;
-    size_t file_size  = 0;
-    ile_error_t ret = extract_ipsw_file_to_memory(archive, path, &file_buffer, &file_size);
+#define IMG3_TAG_DATA 0x44415441 // DATA
+
+#define IM4P_ELEMENT_PAYLOAD 3
+
+/* Two AES blocks, enough of an ibootim header to tell a right key from a wrong one */
+#define KEY_CHECK_SIZE 32
+
+/* How much of a file the encryption and key checks read, the container's header before the payload is much smaller */
+#define COMPONENT_HEAD_SIZE 0x1000
+
+#define AES_CBC_BLOCK_SIZE 16
+#define AES_CBC_CHUNK_SIZE 0x40000000
+
+image_type_t detect_image_type(const char* buffer, size_t size) {
+    /* Compare */
+    if (size >= (strlen(IMG3_MAGIC) - 1) && !strncmp(IMG3_MAGIC, buffer, (strlen(IMG3_MAGIC) - 1))) {
+        return IMG3;
+    }
+    try {
+        ASN1DERElement working_buffer(buffer, size);
+        if (isIM4P(working_buffer)) {
+            return IM4P;
+        }
+    } catch (...) {
+        /* Not DER at all */
+    }
+    
+    return UNKNOWN;
+}
+
+/* Reads a DER tag and length, leaving offset at the start of the contents, which may go on past size */
+static bool read_der_prefix(const uint8_t* data, size_t size, size_t* offset, uint8_t* tag, size_t* length) {
+    if (*offset + 2 > size) {
+        return false;
+    }
+    *tag = data[(*offset)++];
+    
+    /* Short form is the length itself, long form is how many bytes of length follow */
+    uint8_t first = data[(*offset)++];
+    if (!(first & 0x80)) {
+        *length = first;
+    } else {
+        const uint8_t length_bytes = first & 0x7F;
+        if (length_bytes == 0 || length_bytes > sizeof(uint32_t) || *offset + length_bytes > size) {
+            return false;
+        }
+        *length = 0;
+        for (uint8_t i = 0; i < length_bytes; i++) {
+            *length = (*length << 8) | data[(*offset)++];
+        }
+    }
+    
+    return true;
+}
+
+/* Reads a DER tag and length, leaving offset at the start of the contents */
+static bool read_der_header(const uint8_t* data, size_t size, size_t* offset, uint8_t* tag, size_t* length) {
+    return read_der_prefix(data, size, offset, tag, length) && *length <= size - *offset;
+}
+
+/* Finds an img3 tag, which come after a 20 byte header as a little endian magic, total size and data size followed by the data */
+static bool find_img3_tag(const uint8_t* data, size_t size, uint32_t tag_magic, const uint8_t** contents, size_t* length) {
+    size_t offset = 20;
+    while (offset + 12 <= size) {
+        const uint32_t magic      = (uint32_t)data[offset]     | ((uint32_t)data[offset + 1] << 8)  | ((uint32_t)data[offset + 2] << 16)  | ((uint32_t)data[offset + 3] << 24);
+        const uint32_t total_size = (uint32_t)data[offset + 4] | ((uint32_t)data[offset + 5] << 8)  | ((uint32_t)data[offset + 6] << 16)  | ((uint32_t)data[offset + 7] << 24);
+        const uint32_t data_size  = (uint32_t)data[offset + 8] | ((uint32_t)data[offset + 9] << 8)  | ((uint32_t)data[offset + 10] << 16) | ((uint32_t)data[offset + 11] << 24);
+        if (magic == tag_magic) {
+            if (data_size > size - offset - 12) {
+                return false;
+            }
+            *contents = &data[offset + 12];
+            *length   = data_size;
+            return true;
+        }
+        if (total_size < 12) {
+            break;
+        }
+        offset += total_size;
+    }
+    
+    return false;
+}
+
+/* Finds an element of an im4p, SEQUENCE { "IM4P", type, description, payload, [KBAG octet string], [compression sequence] } */
+static bool find_im4p_element(const uint8_t* data, size_t size, uint32_t index, uint8_t* tag, const uint8_t** contents, size_t* length) {
+    size_t offset = 0;
+    if (!read_der_header(data, size, &offset, tag, length) || *tag != 0x30) {
+        return false;
+    }
+    const size_t end = offset + *length;
+    for (uint32_t element = 0; offset < end; element++) {
+        if (!read_der_header(data, end, &offset, tag, length)) {
+            return false;
+        }
+        if (element == index) {
+            *contents = &data[offset];
+            return true;
+        }
+        offset += *length;
+    }
+    
+    return false;
+}
+
+/* The part of a container that gets encrypted, the DATA tag of an img3 or the payload octet string of an im4p */
+static bool find_payload(const char* buffer, size_t size, image_type_t image_type, const uint8_t** payload, size_t* payload_size) {
+    const uint8_t* data = (const uint8_t*)buffer;
+    uint8_t tag         = 0;
+    if (image_type == IMG3) {
+        return find_img3_tag(data, size, IMG3_TAG_DATA, payload, payload_size);
+    } else if (image_type == IM4P) {
+        return find_im4p_element(data, size, IM4P_ELEMENT_PAYLOAD, &tag, payload, payload_size) && tag == 0x04;
+    }
+    
+    return false;
+}
+
+static const EVP_CIPHER* aes_cbc_cipher(uint8_t key_size) {
+    switch (key_size) {
+        case 16:
+            return EVP_aes_128_cbc();
+        case 24:
+            return EVP_aes_192_cbc();
+        case 32:
+            return EVP_aes_256_cbc();
+        default:
+            return NULL;
+    }
+}
+
+/* AES-CBC over the whole blocks with OpenSSL, which uses AES-NI where the CPU has it. in and out can be the same buffer */
+static bool aes_cbc_decrypt(const key_candidate_t& key, const uint8_t* in, uint8_t* out, size_t size) {
+    const EVP_CIPHER* cipher = aes_cbc_cipher(key.key_size);
+    EVP_CIPHER_CTX* context  = cipher ? EVP_CIPHER_CTX_new() : NULL;
+    bool decrypted = context && EVP_DecryptInit_ex(context, cipher, NULL, key.key_bytes, key.iv_bytes) == 1 && EVP_CIPHER_CTX_set_padding(context, 0) == 1;
+    
+    /* EVP takes int lengths, so anything bigger goes through in chunks */
+    const size_t whole_size = size & ~(size_t)(AES_CBC_BLOCK_SIZE - 1);
+    for (size_t offset = 0; decrypted && offset < whole_size;) {
+        const int chunk_size = (int)min<size_t>(whole_size - offset, AES_CBC_CHUNK_SIZE);
+        int written = 0;
+        decrypted = EVP_DecryptUpdate(context, out + offset, &written, in + offset, chunk_size) == 1 && written == chunk_size;
+        offset += (size_t)chunk_size;
+    }
+    EVP_CIPHER_CTX_free(context);
+    return decrypted;
+}
+
+static uint32_t read_le32(const uint8_t* data) {
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/* Where the payload starts in a file that may only be its first bytes, available is how much of the payload they hold. The tags or elements before the payload have to be there whole */
+static bool find_payload_head(const char* buffer, size_t size, image_type_t image_type, const uint8_t** payload, size_t* available) {
+    const uint8_t* data = (const uint8_t*)buffer;
+    if (image_type == IMG3) {
+        if (size < (strlen(IMG3_MAGIC) - 1) || strncmp(IMG3_MAGIC, buffer, (strlen(IMG3_MAGIC) - 1)) != 0) {
+            return false;
+        }
+        size_t offset = 20;
+        while (offset + 12 <= size) {
+            const uint32_t total_size = read_le32(&data[offset + 4]);
+            if (read_le32(&data[offset]) == IMG3_TAG_DATA) {
+                *payload   = &data[offset + 12];
+                *available = min<size_t>(read_le32(&data[offset + 8]), size - offset - 12);
+                return true;
+            }
+            if (total_size < 12) {
+                break;
+            }
+            offset += total_size;
+        }
+        return false;
+    } else if (image_type == IM4P) {
+        size_t offset = 0;
+        size_t length = 0;
+        uint8_t tag   = 0;
+        if (!read_der_prefix(data, size, &offset, &tag, &length) || tag != 0x30) {
+            return false;
+        }
+        for (uint32_t element = 0; element < IM4P_ELEMENT_PAYLOAD; element++) {
+            if (!read_der_header(data, size, &offset, &tag, &length)) {
+                return false;
+            }
+            if (element == 0 && (tag != 0x16 || length != 4 || memcmp(&data[offset], "IM4P", 4) != 0)) {
+                return false;
+            }
+            offset += length;
+        }
+        if (!read_der_prefix(data, size, &offset, &tag, &length) || tag != 0x04) {
+            return false;
+        }
+        *payload   = &data[offset];
+        *available = min<size_t>(length, size - offset);
+        return true;
+    }
+    
+    return false;
+}
+
+/* The first two blocks of a payload, decrypted if there is a key. Only needs the start of the file */
+static bool read_payload_header(const char* buffer, size_t size, image_type_t image_type, const key_candidate_t* key, uint8_t* header) {
+    const uint8_t* payload = NULL;
+    size_t payload_size    = 0;
+    if (!find_payload_head(buffer, size, image_type, &payload, &payload_size) || payload_size < KEY_CHECK_SIZE) {
+        return false;
+    }
+    if (!key) {
+        memcpy(header, payload, KEY_CHECK_SIZE);
+        return true;
+    }
+    
+    return aes_cbc_decrypt(*key, payload, header, KEY_CHECK_SIZE);
+}
+
+/* The same checks ibootim makes on every image header, which two blocks cover */
+static bool is_ibootim_header(const uint8_t* header) {
+    const uint32_t compression_type = read_le32(&header[12]);
+    const uint32_t color_space      = read_le32(&header[16]);
+    return !memcmp(header, ibootim_signature, 8) && compression_type == ibootim_compression_type_lzss && (color_space == ibootim_color_space_argb || color_space == ibootim_color_space_grayscale);
+}
+
+/* A payload img4tool still has to decompress only has its compression header to go by */
+static bool is_compressed_header(const uint8_t* header) {
+    return !memcmp(header, "complzss", 8) || !memcmp(header, "bvx2", 4) || !memcmp(header, "bvx1", 4) || !memcmp(header, "bvx-", 4) || !memcmp(header, "bvxn", 4);
+}
+
+bool component_is_encrypted(const char* buffer, size_t size, image_type_t image_type) {
+    /* The KBAG comes after the payload in both containers, the start of the payload is enough to tell */
+    uint8_t header[KEY_CHECK_SIZE];
+    return read_payload_header(buffer, size, image_type, NULL, header) && !is_ibootim_header(header) && !is_compressed_header(header);
+}
+
+bool key_decrypts_component(const char* buffer, size_t size, image_type_t image_type, const key_candidate_t& key) {
+    uint8_t header[KEY_CHECK_SIZE];
+    if (!read_payload_header(buffer, size, image_type, &key, header)) {
+        return false;
+    }
+    
+    return is_ibootim_header(header) || is_compressed_header(header);
+}
+
+ile_error_t decrypt_component_payload(component_t* component, const key_candidate_t* key, vector<uint8_t>* decrypted, const void** payload_data, size_t* payload_size) {
+    const uint8_t* payload = NULL;
+    size_t size            = 0;
+    if (!find_payload(component->view.data, component->view.size, component->image_type, &payload, &size)) {
+        return ILE_E_FAILED_TO_GET_FILE_TYPE;
+    }
+    if (!key) {
+        *payload_data = payload;
+        *payload_size = size;
+        return ILE_SUCCESS;
+    }
+    
+    /* An inflated component is ours to overwrite, a mapped one is read only so it is decrypted into its own buffer in the same pass */
+    uint8_t* out = NULL;
+    if (component->view.owned) {
+        out = (uint8_t*)component->view.owned + (payload - (const uint8_t*)component->view.data);
+    } else {
+        decrypted->resize(size);
+        out = decrypted->data();
+    }
+    if (!aes_cbc_decrypt(*key, payload, out, size)) {
+        return ILE_E_WRONG_KEYS;
+    }
+    
+    /* A partial last block isn't encrypted */
+    const size_t whole_size = size & ~(size_t)(AES_CBC_BLOCK_SIZE - 1);
+    if (out != payload) {
+        memcpy(out + whole_size, payload + whole_size, size - whole_size);
+    }
+    
+    *payload_data = out;
+    *payload_size = size;
+    return ILE_SUCCESS;
+}
+
+ile_error_t load_component(ipsw_archive_t archive, const char* path, component_t* component) {
+    /* Read the entry once, everything after this works on the same view */
+    component->image_type = UNKNOWN;
+    ile_error_t ret = ipsw_view_file(archive, path, &component->view);
     if (ret != ILE_SUCCESS) {
         return ret;
     }
+    
+    component->image_type = detect_image_type(component->view.data, component->view.size);
+    return ILE_SUCCESS;
+}
 
-    /* Compare */
-    if (!strncmp(IMG3_MAGIC, file_buffer, (strlen(IMG3_MAGIC) - 1))) {
-        *image_type = IMG3;
-    } else {
-        ASN1DERElement working_buffer(file_buffer, file_size);
-        if (isIM4P(working_buffer)) {
-            *image_type = IM4P;
-        } else {
-            *image_type = UNKNOWN;
+void free_component(component_t* component) {
+    ipsw_release_file_view(&component->view);
+}
+
+/* Just the start of a component for the encryption and key checks, so they don't inflate the whole file ahead of extraction */
+static ile_error_t load_component_head(ipsw_archive_t archive, const char* path, component_t* component) {
+    component->image_type = UNKNOWN;
+    ile_error_t ret = ipsw_view_file_head(archive, path, COMPONENT_HEAD_SIZE, &component->view);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    /* img4tool only takes a whole im4p, so the type comes from where the payload is */
+    uint8_t header[KEY_CHECK_SIZE];
+    if (read_payload_header(component->view.data, component->view.size, IMG3, NULL, header)) {
+        component->image_type = IMG3;
+        return ILE_SUCCESS;
+    } else if (read_payload_header(component->view.data, component->view.size, IM4P, NULL, header)) {
+        component->image_type = IM4P;
+        return ILE_SUCCESS;
+    }
+    
+    /* Anything else, or a payload that starts past the head, is read whole */
+    free_component(component);
+    return load_component(archive, path, component);
+}
+
+static ile_error_t ibootim_rc_to_ile_error(int rc) {
+    switch (rc) {
+        case ENOMEM:
+            return ILE_E_OUT_OF_MEMORY;
+        case EFTYPE:
+            return ILE_E_IBOOTIM_CORRUPT;
+        default:
+            return ILE_E_THIRD_PARTY_ERROR;
+    }
+}
+
+ile_error_t detect_encrypted_components(ipsw_archive_t archive, const vector<uint32_t>& indices, build_manifest_t* build_manifest) {
+    build_manifest->encrypted.assign(build_manifest->file_count, false);
+    
+    /* Only the heads are read here, the whole files are advised right before they are extracted */
+    vector<string_view> paths;
+    for (size_t i = 0; i < indices.size(); i++) {
+        paths.push_back(build_manifest->paths[indices[i]]);
+    }
+    ipsw_advise_file_heads(archive, paths, COMPONENT_HEAD_SIZE);
+    
+    uint32_t encrypted_count = 0;
+    for (size_t i = 0; i < indices.size(); i++) {
+        component_t component;
+        ile_error_t ret = load_component_head(archive, build_manifest->paths[indices[i]].data(), &component);
+        if (ret == ILE_E_FAILED_TO_GET_ZIP_INDEX) {
+            continue;
+        } else if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+        
+        if (component_is_encrypted(component.view.data, component.view.size, component.image_type)) {
+            build_manifest->encrypted[indices[i]] = true;
+            encrypted_count++;
         }
+        free_component(&component);
     }
     
-    /* Cleanup and return */
-    free(file_buffer);
+    char* message = NULL;
+    asprintf(&message, "%u of %zu components are encrypted", encrypted_count, indices.size());
+    log_message(INFO, message ? message : "Checked which components are encrypted");
+    free(message);
+    
     return ILE_SUCCESS;
 }
 
-ile_error_t save_png_from_ibootim(const char* input_ibootim, const char* manifest_component_name, const char* output_dir_path) {
-    ibootim* image = NULL;
-    unsigned int images_count = ibootim_count_images_in_file(input_ibootim, NULL);
-    int rc = 0;
+ile_error_t validate_component_keys(ipsw_archive_t archive, const vector<uint32_t>& indices, build_manifest_t* build_manifest) {
+    uint32_t checked_count = 0;
+    uint32_t wrong_count   = 0;
+    for (size_t i = 0; i < indices.size(); i++) {
+        const uint32_t index = indices[i];
+        if (index >= build_manifest->keys.size() || !build_manifest->keys[index].available) {
+            continue;
+        }
+        
+        /* Missing files and unknown containers are left for extraction to report */
+        component_t component;
+        ile_error_t ret = load_component_head(archive, build_manifest->paths[index].data(), &component);
+        if (ret == ILE_E_FAILED_TO_GET_ZIP_INDEX) {
+            continue;
+        } else if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+        if (component.image_type == UNKNOWN) {
+            free_component(&component);
+            continue;
+        }
+        
+        /* A check is two AES blocks, so every candidate is tried in source order on this thread rather than raced on others, and the first that decrypts wins */
+        vector<key_candidate_t>& candidates = build_manifest->keys[index].candidates;
+        size_t winner = 0;
+        while (winner < candidates.size() && !key_decrypts_component(component.view.data, component.view.size, component.image_type, candidates[winner])) {
+            winner++;
+        }
+        free_component(&component);
+        checked_count++;
+        build_manifest->keys[index].rejected = (winner == candidates.size());
+        
+        char* message = NULL;
+        if (winner == candidates.size()) {
+            wrong_count++;
+            asprintf(&message, "None of the %zu keys for [%s] decrypt it", candidates.size(), build_manifest->manifest_component_names[index].data());
+            log_message(ERROR, message ? message : "A key doesn't decrypt its component");
+        } else if (winner > 0) {
+            /* The rest keep their order behind it */
+            rotate(candidates.begin(), candidates.begin() + winner, candidates.begin() + winner + 1);
+            asprintf(&message, "Using the key for [%s] from %s, the one from %s doesn't decrypt it", build_manifest->manifest_component_names[index].data(), candidates[0].source.data(), candidates[1].source.data());
+            log_message(WARNING, message ? message : "Using a key from another source for a component");
+        }
+        free(message);
+    }
     
+    char* message = NULL;
+    asprintf(&message, "%u of %u keys decrypt their components", checked_count - wrong_count, checked_count);
+    log_message(INFO, message ? message : "Checked the keys against their components");
+    free(message);
+    
+    return (wrong_count == 0) ? ILE_SUCCESS : ILE_E_WRONG_KEYS;
+}
+
+ile_error_t save_png_from_ibootim(const void* ibootim_buffer, size_t ibootim_size, const vector<string>& output_names, const char* output_dir_path) {
+    /* Index every image in the payload with a single pass over the headers */
+    ibootim_iterator* iterator = NULL;
+    int rc = ibootim_iterator_open_buffer(ibootim_buffer, ibootim_size, &iterator);
+    if (rc != 0) {
+        return ibootim_rc_to_ile_error(rc);
+    }
+    const unsigned int images_count = ibootim_iterator_count(iterator);
+    
+    ibootim* image = NULL;
     for (unsigned int i = 0; i < images_count; i++) {
         /* Load this image */
-        if ((rc = ibootim_load_at_index(input_ibootim, &image, i)) != 0) {
-            switch (rc) {
-                case ENOMEM:
-                    return ILE_E_OUT_OF_MEMORY;
-                case EFTYPE:
-                    return ILE_E_IBOOTIM_CORRUPT;
-                case ENOENT:
-                    return ILE_E_FAILED_TO_OPEN_FILE_FOR_READING;
-                default:
-                    return ILE_E_THIRD_PARTY_ERROR;
-            }
-        }
-        
-        /* Make the path index name */
-        char* full_output_path = NULL;
-        if (images_count == 1) {
-            asprintf(&full_output_path, "%s/%s.png", output_dir_path, manifest_component_name);
-        } else {
-            asprintf(&full_output_path, "%s/%s_%u.png", output_dir_path, manifest_component_name, i);
+        if ((rc = ibootim_iterator_next(iterator, &image)) != 0) {
+            ibootim_iterator_close(iterator);
+            return ibootim_rc_to_ile_error(rc);
         }
         
-        /* Save the image */
-        if (ibootim_write_png(image, full_output_path) != 0) {
-            ibootim_close(image);
+        /* Make the path index name for every output */
+        vector<string> full_output_paths;
+        for (size_t j = 0; j < output_names.size(); j++) {
+            char* full_output_path = NULL;
+            if (images_count == 1) {
+                asprintf(&full_output_path, "%s/%s.png", output_dir_path, output_names[j].c_str());
+            } else {
+                asprintf(&full_output_path, "%s/%s_%u.png", output_dir_path, output_names[j].c_str(), i);
+            }
+            full_output_paths.push_back(full_output_path ? full_output_path : "");
             free(full_output_path);
-            return ILE_E_THIRD_PARTY_ERROR;
         }
         
-        /* Cleanup */
+        /* Save the image once, every other output is linked to it */
+        rc = ibootim_write_png(image, full_output_paths[0].c_str());
         ibootim_close(image);
-        free(full_output_path);
+        if (rc != 0) {
+            ibootim_iterator_close(iterator);
+            return ILE_E_THIRD_PARTY_ERROR;
+        }
+        for (size_t j = 1; j < full_output_paths.size(); j++) {
+            ile_error_t ret = link_or_copy_file(full_output_paths[0].c_str(), full_output_paths[j].c_str());
+            if (ret != ILE_SUCCESS) {
+                ibootim_iterator_close(iterator);
+                return ret;
+            }
+        }
     }
     
+    ibootim_iterator_close(iterator);
     return ILE_SUCCESS;
 }
 
-ile_error_t extract_to_output_dir(build_manifest_t build_manifest, ipsw_archive_t archive, const char* work_dir_path, const char* output_dir_path) {
+vector<string> component_output_names(const build_manifest_t& build_manifest, uint32_t index) {
+    vector<string> output_names;
+    const bool per_identity = (build_manifest.identities.size() > 1);
+    for (size_t i = 0; i < build_manifest.identities.size(); i++) {
+        const build_identity_t& identity = build_manifest.identities[i];
+        for (size_t j = 0; j < identity.files.size(); j++) {
+            if (identity.files[j] == index) {
+                output_names.push_back(per_identity ? string(identity.device_class) + "/" + string(identity.component_names[j]) : string(identity.component_names[j]));
+            }
+        }
+    }
+    if (output_names.empty()) {
+        output_names.push_back(string(build_manifest.manifest_component_names[index]));
+    }
+    
+    return output_names;
+}
+
+ile_error_t extract_component(const build_manifest_t& build_manifest, uint32_t index, ipsw_archive_t archive, const char* work_dir_path, const char* output_dir_path) {
+    /* Load the component and get the image type in one read */
+    component_t component;
+    ile_error_t ret = load_component(archive, build_manifest.paths[index].data(), &component);
+    if (ret == ILE_E_FAILED_TO_GET_ZIP_INDEX) {
+        log_message(WARNING, "A file that was found in BuildManifest.plist was not found in this IPSW");
+        return ILE_SUCCESS;
+    } else if (ret != ILE_SUCCESS) {
+        return ret;
+    } else if (component.image_type == UNKNOWN) {
+        free_component(&component);
+        return ILE_E_FAILED_TO_GET_FILE_TYPE;
+    }
+    
+    /* The key validate_component_keys settled on */
+    const key_candidate_t* key = (index < build_manifest.keys.size() && build_manifest.keys[index].available) ? &build_manifest.keys[index].candidates.front() : NULL;
+    
+    /* Both containers end up as a payload pointer and size for the shared steps below */
+    const void* payload_data = NULL;
+    size_t payload_size      = 0;
+    vector<uint8_t> native_payload;
+    vector<uint8_t> img3_payload;
+    ASN1DERElement im4p_payload;
+    
+    /* A payload that is an ibootim once decrypted is decrypted here with OpenSSL, in place when the component was inflated. Compressed payloads still go through img4tool, so the header is checked before anything is overwritten */
+    uint8_t header[KEY_CHECK_SIZE];
+    const bool native = read_payload_header(component.view.data, component.view.size, component.image_type, key, header) && is_ibootim_header(header);
+    
+    if (native) {
+        printf("Attempting to extract %s Component [%s]...\n", component.image_type == IMG3 ? "IMG3" : "IM4P", build_manifest.manifest_component_names[index].data());
+        ret = decrypt_component_payload(&component, key, &native_payload, &payload_data, &payload_size);
+    } else if (component.image_type == IMG3) {
+        /* Use img3tool */
+        printf("Attempting to extract IMG3 Component [%s]...\n", build_manifest.manifest_component_names[index].data());
+        try {
+            img3_payload = getPayloadFromIMG3(component.view.data, component.view.size, key ? key->iv.data() : NULL, key ? key->key.data() : NULL);
+            payload_data = img3_payload.data();
+            payload_size = img3_payload.size();
+        } catch (...) {
+            ret = ILE_E_FAILED_TO_OPEN_FILE_FOR_READING;
+        }
+    } else {
+        /* Use img4tool */
+        printf("Attempting to extract IM4P Component [%s]...\n", build_manifest.manifest_component_names[index].data());
+        try {
+            /* Get the root node */
+            ASN1DERElement im4p(component.view.data, component.view.size);
+            
+            /* Extract the payload */
+            im4p_payload = getPayloadFromIM4P(im4p, key ? key->iv.data() : NULL, key ? key->key.data() : NULL);
+            payload_data = im4p_payload.payload();
+            payload_size = im4p_payload.payloadSize();
+        } catch (...) {
+            ret = ILE_E_FAILED_TO_OPEN_FILE_FOR_READING;
+        }
+    }
+    
+    /* Only keep a copy of the payload on disk if the caller asked for a work directory */
+    const vector<string> output_names = component_output_names(build_manifest, index);
+    if (ret == ILE_SUCCESS && work_dir_path) {
+        char* extracted_payload_out_path = NULL;
+        asprintf(&extracted_payload_out_path, "%s/%s.ibootim", work_dir_path, output_names[0].c_str());
+        ret = fwrite_im4p_buffer(payload_data, payload_size, extracted_payload_out_path);
+        free(extracted_payload_out_path);
+    }
+    
+    /* Save, the native payload can point into the component so it's released last and only here */
+    if (ret == ILE_SUCCESS) {
+        ret = save_png_from_ibootim(payload_data, payload_size, output_names, output_dir_path);
+    }
+    free_component(&component);
+    return ret;
+}
+
+ile_error_t make_identity_dirs(const build_manifest_t& build_manifest, const char* dir_path) {
+    if (build_manifest.identities.size() <= 1) {
+        return ILE_SUCCESS;
+    }
+    
+    for (size_t i = 0; i < build_manifest.identities.size(); i++) {
+        const string identity_dir_path = string(dir_path) + "/" + string(build_manifest.identities[i].device_class);
+        if (mkdir(identity_dir_path.c_str(), 0777) != 0 && errno != EEXIST) {
+            return ILE_E_COULD_NOT_MAKE_OUTPUT_DIR;
+        }
+    }
+    
+    return ILE_SUCCESS;
+}
+
+ile_error_t extract_files_to_output_dir(const build_manifest_t& build_manifest, const vector<uint32_t>& indices, ipsw_archive_t archive, const char* work_dir_path, const char* output_dir_path, uint32_t jobs) {
     /* For every image, we'll do some checks, extract the payload, convert, and save the image */
     printf("\n");
     log_message(INFO, "iBootim is being used for conversion - Copyright 2015 Pupyshev Nikita | All rights reserved");
     log_message(LOG, "Extracting ibootim images...");
-    for (uint32_t i = 0; i < build_manifest.file_count; i++) {
-        /* Get the image type */
-        image_type_t image_type = UNKNOWN;
-        ile_error_t ret = get_image_type(archive, build_manifest.paths[i], &image_type);
-        if (ret != ILE_SUCCESS || image_type == UNKNOWN) {
-            return ILE_E_FAILED_TO_GET_FILE_TYPE;
+    
+    /* Never start more workers than there are components */
+    if (jobs == 0) {
+        jobs = thread::hardware_concurrency() ? thread::hardware_concurrency() : 1;
+    }
+    const uint32_t file_count = (uint32_t)indices.size();
+    if (jobs > file_count) {
+        jobs = file_count ? file_count : 1;
+    }
+    
+    ile_error_t ret = make_identity_dirs(build_manifest, output_dir_path);
+    if (ret == ILE_SUCCESS && work_dir_path) {
+        ret = make_identity_dirs(build_manifest, work_dir_path);
+    }
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    /* Results are stored by manifest index so errors are reported in the same order no matter which worker finished first */
+    vector<ile_error_t> results(file_count, ILE_SUCCESS);
+    atomic<uint32_t> next_index(0);
+    atomic<bool> failed(false);
+    
+    auto worker = [&](bool owns_archive) {
+        /* libzip handles are not thread-safe, so every extra worker opens its own unless the archive can be shared */
+        ipsw_archive_t worker_archive = archive;
+        bool opened = true;
+        if (owns_archive) {
+            worker_archive = { NULL, archive.path };
+            opened         = false;
         }
         
-        if (image_type == IMG3) {
-            /* Use img3tool */
-            printf("Attempting to extract IMG3 Component [%s]...\n", build_manifest.manifest_component_names[i]);
+        while (!failed.load()) {
+            /* Indices are claimed in order, so everything before a failing index is always processed */
+            const uint32_t index = next_index.fetch_add(1);
+            if (index >= file_count) {
+                break;
+            }
             
-            /* Load into memory */
-            char* component_buffer = NULL;
-            size_t component_size  = 0;
-            ret = extract_ipsw_file_to_memory(archive, build_manifest.paths[i], &component_buffer, &component_size);
-            if (ret != ILE_SUCCESS) {
-                log_message(WARNING, "A file that was found in BuildManifest.plist was not found in this IPSW");
-            } else {
-                /* When working with img3, we must use a vector of uint8_t, so we'll need to convert it here */
-                vector<uint8_t> img3(component_buffer, component_buffer + component_size);
-                free(component_buffer);
-                
-                /* Extract the payload */
-                vector<uint8_t> payload;
-                try {
-                    payload = getPayloadFromIMG3(img3.data(), img3.size(), build_manifest.keys[i].iv, build_manifest.keys[i].key);
-                } catch (...) {
-                    return ILE_E_FAILED_TO_OPEN_FILE_FOR_READING;
-                }
-                
-                /* iBootim (libpng really) requires that files be loaded from a file, so we must save this payload in the work folder */
-                char* extracted_payload_out_path = NULL;
-                asprintf(&extracted_payload_out_path, "%s/%s.ibootim", work_dir_path, build_manifest.manifest_component_names[i]);
-                ret = fwrite_img3_vector(payload, extracted_payload_out_path);
-                if (ret != ILE_SUCCESS) {
-                    free(extracted_payload_out_path);
-                    return ret;
-                }
-                
-                /* Save */
-                ret = save_png_from_ibootim(extracted_payload_out_path, build_manifest.manifest_component_names[i], output_dir_path);
-                if (ret != ILE_SUCCESS) {
-                    free(extracted_payload_out_path);
-                    return ret;
+            /* Only a worker's own archive is opened, and only once it has a component. A shared one, which is the only handle on a remote IPSW and its prefetched blocks, is used as is */
+            if (!opened) {
+                if (ipsw_open(&worker_archive) != ILE_SUCCESS) {
+                    results[index] = ILE_E_FAILED_TO_OPEN_IPSW;
+                    failed.store(true);
+                    break;
                 }
+                opened = true;
             }
-        } else {
-            /* Use img4tool */
-            printf("Attempting to extract IM4P Component [%s]...\n", build_manifest.manifest_component_names[i]);
             
-            char* component_buffer = NULL;
-            size_t component_size = 0;
-            ret = extract_ipsw_file_to_memory(archive, build_manifest.paths[i], &component_buffer, &component_size);
-            if (ret != ILE_SUCCESS) {
-                log_message(WARNING, "A file that was found in BuildManifest.plist was not found in this IPSW");
-            } else {
-                ASN1DERElement payload;
-                try {
-                    /* Get the root node */
-                    ASN1DERElement im4p(component_buffer, component_size);
-                    
-                    /* Extract the payload */
-                    payload = getPayloadFromIM4P(im4p, build_manifest.keys[i].iv, build_manifest.keys[i].key);
-                } catch (...) {
-                    free(component_buffer);
-                    return ILE_E_FAILED_TO_OPEN_FILE_FOR_READING;
-                }
-                    
-                
-                /* iBootim (libpng really) requires that files be loaded from a file, so we must save this payload in the work folder */
-                char* extracted_payload_out_path = NULL;
-                asprintf(&extracted_payload_out_path, "%s/%s.ibootim", work_dir_path, build_manifest.manifest_component_names[i]);
-                ret = fwrite_im4p_buffer(payload.payload(), payload.payloadSize(), extracted_payload_out_path);
-                if (ret != ILE_SUCCESS) {
-                    free(extracted_payload_out_path);
-                    return ret;
-                }
-                
-                /* Save */
-                ret = save_png_from_ibootim(extracted_payload_out_path, build_manifest.manifest_component_names[i], output_dir_path);
-                if (ret != ILE_SUCCESS) {
-                    free(extracted_payload_out_path);
-                    return ret;
-                }
+            results[index] = extract_component(build_manifest, indices[index], worker_archive, work_dir_path, output_dir_path);
+            if (results[index] != ILE_SUCCESS) {
+                failed.store(true);
             }
         }
+        
+        if (owns_archive) {
+            ipsw_close(&worker_archive);
+        }
+    };
+    
+    /* Let the kernel start paging in every component we're about to touch */
+    vector<string_view> paths;
+    for (uint32_t i = 0; i < file_count; i++) {
+        paths.push_back(build_manifest.paths[indices[i]]);
+    }
+    ipsw_advise_files(archive, paths);
+    
+    /* The calling thread works too, using the archive it was given */
+    const bool share_archive = ipsw_is_thread_safe(archive);
+    vector<thread> workers;
+    for (uint32_t i = 1; i < jobs; i++) {
+        workers.emplace_back(worker, !share_archive);
+    }
+    worker(false);
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    
+    /* Report the first error in manifest order */
+    for (uint32_t i = 0; i < file_count; i++) {
+        if (results[i] != ILE_SUCCESS) {
+            return results[i];
+        }
     }
     
     /* Any debug messages printed by img3tool or img4tool can be separated from the rest of the program */
@@ -188,3 +697,12 @@ ile_error_t extract_to_output_dir(build_manifest_t build_manifest, ipsw_archive_
     
     return ILE_SUCCESS;
 }
+
+ile_error_t extract_to_output_dir(build_manifest_t build_manifest, ipsw_archive_t archive, const char* work_dir_path, const char* output_dir_path, uint32_t jobs) {
+    vector<uint32_t> indices(build_manifest.file_count);
+    for (uint32_t i = 0; i < build_manifest.file_count; i++) {
+        indices[i] = i;
+    }
+    
+    return extract_files_to_output_dir(build_manifest, indices, archive, work_dir_path, output_dir_path, jobs);
+}
@@ -8,6 +8,8 @@
 #ifndef extraction_hpp
 #define extraction_hpp
 
+#include <string>
+#include <vector>
 #include "utilities.hpp"
 #include "ipsw.hpp"
 
@@ -17,32 +19,140 @@ typedef enum {
     IM4P    = 1
 } image_type_t;
 
+typedef struct {
+    ipsw_file_view_t view;
+    image_type_t image_type;
+} component_t;
+
+/**
+ Determines weather a buffer holds an img3, im4p, or should be skipped if it's neither
+ @param buffer The file contents
+ @param size The size of the file contents
+ @return The type of image
+ */
+image_type_t detect_image_type(const char* buffer, size_t size);
+
+/**
+ Checks whether an image's payload is encrypted from its first two AES blocks, a payload that starts as an ibootim or compressed data isn't and anything else needs a key. The KBAG comes after the payload in both containers, so this only needs the start of the file
+ @param buffer The file contents, or at least its start up to the payload's first two blocks
+ @param size The size of the buffer
+ @param image_type The type of image from detect_image_type
+ @return True if keys are needed to decrypt the payload
+ */
+bool component_is_encrypted(const char* buffer, size_t size, image_type_t image_type);
+
 /**
- Determines weather a file from the IPSW is an img3, im4p, or should be skipped if it's neither
+ Checks a key against an encrypted image by decrypting only the first two AES blocks of its payload and looking for a valid ibootim header, so a wrong key is caught before the payload is decrypted
+ @param buffer The file contents, or at least its start up to the payload's first two blocks
+ @param size The size of the buffer
+ @param image_type The type of image from detect_image_type
+ @param key The key, which must have been decoded into key_bytes and iv_bytes
+ @return True if the key decrypts the image
+ */
+bool key_decrypts_component(const char* buffer, size_t size, image_type_t image_type, const key_candidate_t& key);
+
+/**
+ Decrypts a component's payload with OpenSSL, over the whole blocks in one pass. An inflated component is decrypted in place, a component that points into a mapped IPSW is decrypted into decrypted instead, and one without a key is returned as is without a copy
+ @param component Pointer to the component, whose payload is overwritten if it owns its buffer
+ @param key The key, which must have been decoded into key_bytes and iv_bytes, or NULL if the payload isn't encrypted
+ @param decrypted Pointer to the buffer to decrypt into when the component can't be overwritten
+ @param payload_data Pointer to the return payload, which is valid until the component is released or decrypted is changed
+ @param payload_size Pointer to the return payload size
+ @return ile_error_t error code
+ */
+ile_error_t decrypt_component_payload(component_t* component, const key_candidate_t* key, vector<uint8_t>* decrypted, const void** payload_data, size_t* payload_size);
+
+/**
+ Reads a component from the IPSW once and detects its container type
  @param archive The IPSW archive to get the file contents from
- @param path The path to the file to be examined
- @param image_type Return pointer for the type of image
- @return ile_error_t error code in the event that a helper function fails
+ @param path The path to the component in the IPSW
+ @param component Return pointer for the component, which must be released with free_component
+ @return ile_error_t error code
+ */
+ile_error_t load_component(ipsw_archive_t archive, const char* path, component_t* component);
+
+/**
+ Releases a component loaded with load_component
+ @param component Pointer to the component
+ */
+void free_component(component_t* component);
+
+/**
+ Checks which of the build manifest's files are encrypted so keys are only looked up for those. Only the first few KB of each file are read and inflated. Files that are missing or aren't images are treated as unencrypted, extraction reports them later
+ @param archive The IPSW archive
+ @param indices The indices of the files to check, the rest are left as unencrypted
+ @param build_manifest Pointer to the build manifest, whose encrypted flags are set
+ @return ile_error_t error code
  */
-ile_error_t get_image_type(ipsw_archive_t archive, const char* path, image_type_t* image_type);
+ile_error_t detect_encrypted_components(ipsw_archive_t archive, const vector<uint32_t>& indices, build_manifest_t* build_manifest);
 
 /**
- Saves a png from an ibootim
- @param input_ibootim The path to the input ibootim
- @param manifest_component_name The name of the component being saved
+ Checks the candidate keys of every file against the first few KB of it with key_decrypts_component, and moves the first one that decrypts it to the front of its candidates, which is the one extraction uses
+ @param archive The IPSW archive
+ @param indices The indices of the files to check
+ @param build_manifest Pointer to the build manifest, with its keys appended
+ @return ile_error_t error code, ILE_E_WRONG_KEYS if no candidate decrypts some file
+ */
+ile_error_t validate_component_keys(ipsw_archive_t archive, const vector<uint32_t>& indices, build_manifest_t* build_manifest);
+
+/**
+ Saves a png for every image in an in-memory ibootim
+ @param ibootim_buffer The decrypted ibootim payload
+ @param ibootim_size The size of the payload
+ @param output_names The names to save the images under, relative to the output directory. Each image is written for the first name and linked for the rest
  @param output_dir_path The path to the output directory
  @return ile_error_t error code
  */
-ile_error_t save_png_from_ibootim(const char* input_ibootim, const char* manifest_component_name, const char* output_dir_path);
+ile_error_t save_png_from_ibootim(const void* ibootim_buffer, size_t ibootim_size, const vector<string>& output_names, const char* output_dir_path);
+
+/**
+ Gets the names a file's images are saved under, one for every identity component that uses it. When the IPSW has more than one identity each name is inside a folder named after the identity's DeviceClass
+ @param build_manifest The build manifest
+ @param index The index of the file in the build manifest
+ @return The names relative to the output directory, without an extension
+ */
+vector<string> component_output_names(const build_manifest_t& build_manifest, uint32_t index);
+
+/**
+ Extracts the images of a single build manifest file to the output dir as pngs, for every identity that uses it
+ @param build_manifest The build manifest
+ @param index The index of the component in the build manifest
+ @param archive The IPSW archive, which must not be used by another thread at the same time
+ @param work_dir_path The path to the work directory to keep raw payloads in, or NULL to not write them out
+ @param output_dir_path The output dir path
+ @return ile_error_t error code
+ */
+ile_error_t extract_component(const build_manifest_t& build_manifest, uint32_t index, ipsw_archive_t archive, const char* work_dir_path, const char* output_dir_path);
+
+/**
+ Creates a folder for every identity's DeviceClass when the IPSW has more than one identity, which is where component_output_names puts their images
+ @param build_manifest The build manifest
+ @param dir_path The directory to create them in
+ @return ile_error_t error code
+ */
+ile_error_t make_identity_dirs(const build_manifest_t& build_manifest, const char* dir_path);
+
+/**
+ Extracts the images of some of the build manifest's files to the output dir as pngs
+ @param build_manifest The build manifest
+ @param indices The indices of the files in the build manifest
+ @param archive The IPSW archive
+ @param work_dir_path The path to the work directory to keep raw payloads in, or NULL to not write them out
+ @param output_dir_path The output dir path
+ @param jobs The number of files to process concurrently, 0 to use every core
+ @return ile_error_t error code, the first error in the order of indices if several files failed
+ */
+ile_error_t extract_files_to_output_dir(const build_manifest_t& build_manifest, const vector<uint32_t>& indices, ipsw_archive_t archive, const char* work_dir_path, const char* output_dir_path, uint32_t jobs);
 
 /**
  Extracts the images from the IPSW to the output dir as pngs
  @param build_manifest The build manifest
  @param archive The IPSW archive
- @param work_dir_path The path to the work directory
+ @param work_dir_path The path to the work directory to keep raw payloads in, or NULL to not write them out
  @param output_dir_path The output dir path
- @return ile_error_t error code
+ @param jobs The number of components to process concurrently, 0 to use every core
+ @return ile_error_t error code, the first error in manifest order if several components failed
  */
-ile_error_t extract_to_output_dir(build_manifest_t build_manifest, ipsw_archive_t archive, const char* work_dir_path, const char* output_dir_path);
+ile_error_t extract_to_output_dir(build_manifest_t build_manifest, ipsw_archive_t archive, const char* work_dir_path, const char* output_dir_path, uint32_t jobs);
 
 #endif /* extraction_hpp */
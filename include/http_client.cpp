@@ -0,0 +1,587 @@
+//
+//  http_client.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include <curl/curl.h>
+#include "utilities.hpp"
+#include "http_client.hpp"
+
+using namespace std;
+
+/* One lock per kind of data curl shares, curl tells us which one it wants */
+static mutex share_locks[CURL_LOCK_DATA_LAST];
+
+/* Guards the client's state, it's never held while curl waits on the network */
+static mutex client_lock;
+static CURLSH* share_handle = NULL;
+static CURLM* multi_handle  = NULL;
+
+/* Also guarded by the client lock */
+static http_policy_t policy;
+static bool policy_loaded = false;
+static http_stats_t stats;
+static vector<uint32_t> latencies;
+static mt19937 jitter(random_device{}());
+
+/* The token bucket every attempt takes from, starting full */
+static double rate_tokens = 0;
+static chrono::steady_clock::time_point rate_refilled;
+
+static void share_lock_cb(CURL*, curl_lock_data data, curl_lock_access, void*) {
+    share_locks[data].lock();
+}
+
+static void share_unlock_cb(CURL*, curl_lock_data data, void*) {
+    share_locks[data].unlock();
+}
+
+static size_t body_write_cb(void* contents, size_t size, size_t nmemb, string* body) {
+    const size_t total_size = size * nmemb;
+    body->append((const char*)contents, total_size);
+    return total_size;
+}
+
+/* Must be called with the client lock held */
+static bool http_client_init(void) {
+    if (share_handle && multi_handle) {
+        return true;
+    }
+    
+    /* Held until http_client_cleanup, so other users' init and cleanup calls are cheap */
+    if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
+        return false;
+    }
+    share_handle = curl_share_init();
+    multi_handle = curl_multi_init();
+    if (!share_handle || !multi_handle) {
+        if (share_handle) {
+            curl_share_cleanup(share_handle);
+        }
+        if (multi_handle) {
+            curl_multi_cleanup(multi_handle);
+        }
+        share_handle = NULL;
+        multi_handle = NULL;
+        curl_global_cleanup();
+        return false;
+    }
+    
+    curl_share_setopt(share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    curl_share_setopt(share_handle, CURLSHOPT_LOCKFUNC, share_lock_cb);
+    curl_share_setopt(share_handle, CURLSHOPT_UNLOCKFUNC, share_unlock_cb);
+    
+    /* Put concurrent requests to one host on a single connection */
+    curl_multi_setopt(multi_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    
+    return true;
+}
+
+CURLSH* http_client_share(void) {
+    lock_guard<mutex> guard(client_lock);
+    return http_client_init() ? share_handle : NULL;
+}
+
+/* One try at a request, a hedge runs next to the attempt it duplicates */
+typedef struct http_call http_call_t;
+typedef struct {
+    http_call_t* call;
+    size_t request;
+    bool hedge;
+    CURL* handle;
+    chrono::steady_clock::time_point started;
+    string body;
+} http_attempt_t;
+
+typedef struct {
+    bool done;
+    uint32_t active;
+    uint32_t rounds;
+    bool hedged;
+    chrono::steady_clock::time_point first_started;
+    chrono::steady_clock::time_point round_started;
+    chrono::steady_clock::time_point next_start;
+    chrono::steady_clock::time_point deadline;
+} http_request_state_t;
+
+/* One http_fetch_all call, its requests run on the multi handle next to every other call's */
+struct http_call {
+    vector<http_request_t>* requests;
+    vector<http_request_state_t> states;
+    size_t remaining;
+    chrono::milliseconds hedge_delay;
+    bool done;
+};
+
+/* Also guarded by the client lock. Whichever call is driving runs the multi handle for all of them, the others wait for it to finish their requests or to hand over */
+static list<http_call_t*> calls;
+static list<http_attempt_t> attempts;
+static bool driving = false;
+static condition_variable call_finished;
+
+static uint32_t value_from_env(const char* name, uint32_t fallback) {
+    const char* value = getenv(name);
+    if (!value || !*value) {
+        return fallback;
+    }
+    
+    char* end = NULL;
+    const unsigned long parsed = strtoul(value, &end, 10);
+    return (end && *end == '\0') ? (uint32_t)parsed : fallback;
+}
+
+/* Must be called with the client lock held */
+static void load_policy(void) {
+    if (policy_loaded) {
+        return;
+    }
+    policy.connect_timeout_ms = value_from_env("ILE_HTTP_CONNECT_TIMEOUT_MS", HTTP_DEFAULT_CONNECT_TIMEOUT_MS);
+    policy.timeout_ms         = value_from_env("ILE_HTTP_TIMEOUT_MS",         HTTP_DEFAULT_TIMEOUT_MS);
+    policy.retries            = value_from_env("ILE_HTTP_RETRIES",            HTTP_DEFAULT_RETRIES);
+    policy.hedge_percentile   = value_from_env("ILE_HTTP_HEDGE_PERCENTILE",   HTTP_DEFAULT_HEDGE_PERCENTILE);
+    policy.rate               = value_from_env("ILE_HTTP_RATE",               HTTP_DEFAULT_RATE);
+    policy.burst              = value_from_env("ILE_HTTP_BURST",              HTTP_DEFAULT_BURST);
+    policy.max_in_flight      = value_from_env("ILE_HTTP_MAX_IN_FLIGHT",      HTTP_DEFAULT_MAX_IN_FLIGHT);
+    if (policy.hedge_percentile > 99) {
+        policy.hedge_percentile = 99;
+    }
+    rate_tokens   = max<uint32_t>(policy.burst, 1);
+    rate_refilled = chrono::steady_clock::now();
+    policy_loaded = true;
+}
+
+/* Must be called with the client lock held. Takes a token and a slot for one more attempt if both are free, otherwise lowers wake to when a token will be. A full set of slots needs no wake, the next attempt to finish does that */
+static bool take_attempt_slot(size_t in_flight, chrono::steady_clock::time_point now, chrono::steady_clock::time_point* wake) {
+    if (policy.max_in_flight > 0 && in_flight >= policy.max_in_flight) {
+        return false;
+    }
+    if (policy.rate == 0) {
+        return true;
+    }
+    
+    const double seconds = chrono::duration<double>(now - rate_refilled).count();
+    rate_tokens   = min<double>(max<uint32_t>(policy.burst, 1), rate_tokens + seconds * policy.rate);
+    rate_refilled = now;
+    if (rate_tokens >= 1.0) {
+        rate_tokens -= 1.0;
+        return true;
+    }
+    
+    *wake = min(*wake, now + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>((1.0 - rate_tokens) / policy.rate)));
+    return false;
+}
+
+static uint32_t latency_percentile(const vector<uint32_t>& samples, uint32_t percentile) {
+    if (samples.empty()) {
+        return 0;
+    }
+    vector<uint32_t> sorted(samples);
+    sort(sorted.begin(), sorted.end());
+    return sorted[min(sorted.size() - 1, (sorted.size() * percentile) / 100)];
+}
+
+/* Retrying can't fix a missing file or a URL curl can't handle */
+static bool is_transient_result(CURLcode result) {
+    switch (result) {
+        case CURLE_OK:
+        case CURLE_FILE_COULDNT_READ_FILE:
+        case CURLE_UNSUPPORTED_PROTOCOL:
+        case CURLE_URL_MALFORMAT:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static uint32_t elapsed_ms(chrono::steady_clock::time_point from, chrono::steady_clock::time_point to) {
+    return (uint32_t)chrono::duration_cast<chrono::milliseconds>(to - from).count();
+}
+
+/* Full jitter, so requests that failed together don't all come back at the same time */
+static chrono::milliseconds backoff_delay(uint32_t retry) {
+    const uint32_t ceiling = min<uint32_t>(HTTP_BACKOFF_MAX_MS, HTTP_BACKOFF_BASE_MS << min<uint32_t>(retry, 16));
+    uniform_int_distribution<uint32_t> distribution(0, ceiling);
+    return chrono::milliseconds(distribution(jitter));
+}
+
+/* Must be called with the client lock held, and only by the call that's driving */
+static bool start_attempt(http_call_t* call, size_t index, bool hedge, chrono::steady_clock::time_point now) {
+    http_request_t& request     = (*call->requests)[index];
+    http_request_state_t& state = call->states[index];
+    
+    /* Time spent waiting to be let through doesn't count against the deadline */
+    if (state.rounds == 0) {
+        state.first_started = now;
+        state.deadline      = now + chrono::milliseconds(policy.timeout_ms);
+    }
+    const uint32_t remaining_ms = (state.deadline > now) ? elapsed_ms(now, state.deadline) : 0;
+    if (remaining_ms == 0) {
+        return false;
+    }
+    CURL* handle = curl_easy_init();
+    if (!handle) {
+        return false;
+    }
+    
+    attempts.push_back(http_attempt_t());
+    http_attempt_t& attempt = attempts.back();
+    attempt.call    = call;
+    attempt.request = index;
+    attempt.hedge   = hedge;
+    attempt.handle  = handle;
+    attempt.started = now;
+    curl_easy_setopt(handle, CURLOPT_URL, request.url.c_str());
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, body_write_cb);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &attempt.body);
+    curl_easy_setopt(handle, CURLOPT_PRIVATE, (void*)&attempt);
+    curl_easy_setopt(handle, CURLOPT_SHARE, share_handle);
+    curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, (long)policy.connect_timeout_ms);
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, (long)remaining_ms);
+    
+    /* Wait for the first connection to a host instead of opening one per request, so the rest can be multiplexed on it. A hedge gets its own in case that connection is the slow part, and plain HTTP never gets HTTP/2 so waiting would only queue requests behind each other */
+    const bool multiplexable = !strncmp(request.url.c_str(), "https://", 8);
+    curl_easy_setopt(handle, CURLOPT_PIPEWAIT, (multiplexable && !hedge) ? 1L : 0L);
+    if (curl_multi_add_handle(multi_handle, handle) != CURLM_OK) {
+        curl_easy_cleanup(handle);
+        attempts.pop_back();
+        return false;
+    }
+    
+    state.active++;
+    request.attempts++;
+    stats.attempts++;
+    if (!hedge) {
+        state.rounds++;
+        state.round_started = now;
+        state.hedged        = false;
+    }
+    return true;
+}
+
+/* Must be called with the client lock held */
+static void finish_attempt(list<http_attempt_t>::iterator attempt) {
+    curl_multi_remove_handle(multi_handle, attempt->handle);
+    curl_easy_cleanup(attempt->handle);
+    attempt->call->states[attempt->request].active--;
+    attempts.erase(attempt);
+}
+
+/* Must be called with the client lock held. Drops whatever the call still has running and wakes up the thread waiting on it */
+static void finish_call(http_call_t* call) {
+    for (auto attempt = attempts.begin(); attempt != attempts.end();) {
+        auto next = attempt;
+        next++;
+        if (attempt->call == call) {
+            finish_attempt(attempt);
+        }
+        attempt = next;
+    }
+    call->done = true;
+    calls.remove(call);
+    call_finished.notify_all();
+}
+
+/* Must be called with the client lock held */
+static void finish_completed_calls(void) {
+    for (auto call = calls.begin(); call != calls.end();) {
+        auto next = call;
+        next++;
+        if ((*call)->remaining == 0) {
+            finish_call(*call);
+        }
+        call = next;
+    }
+}
+
+/* Must be called with the client lock held, and only by the call that's driving. Runs every call's requests for one round of network activity, dropping the lock while curl works or waits */
+static void drive_calls(unique_lock<mutex>& guard) {
+    /* Start first attempts and retries that are due, and hedges for anything slow */
+    const bool hedging = (policy.hedge_percentile > 0);
+    chrono::steady_clock::time_point now  = chrono::steady_clock::now();
+    chrono::steady_clock::time_point wake = now + chrono::milliseconds(1000);
+    for (http_call_t* call : calls) {
+        vector<http_request_t>& requests = *call->requests;
+        for (size_t i = 0; i < requests.size(); i++) {
+            http_request_state_t& state = call->states[i];
+            if (state.done) {
+                continue;
+            }
+            if (state.active == 0 && now >= state.next_start) {
+                if (!take_attempt_slot(attempts.size(), now, &wake)) {
+                    if (!requests[i].throttled) {
+                        requests[i].throttled = true;
+                        stats.throttled++;
+                    }
+                    continue;
+                }
+                if (!start_attempt(call, i, false, now)) {
+                    state.done         = true;
+                    requests[i].failed = true;
+                    stats.failures++;
+                    call->remaining--;
+                    continue;
+                }
+            } else if (state.active == 0) {
+                wake = min(wake, state.next_start);
+            }
+            if (hedging && state.active == 1 && !state.hedged) {
+                if (now - state.round_started >= call->hedge_delay) {
+                    if (!take_attempt_slot(attempts.size(), now, &wake)) {
+                        continue;
+                    }
+                    if (start_attempt(call, i, true, now)) {
+                        requests[i].hedged = true;
+                        stats.hedges++;
+                    }
+                    state.hedged = true;
+                } else {
+                    wake = min(wake, state.round_started + call->hedge_delay);
+                }
+            }
+        }
+    }
+    finish_completed_calls();
+    if (calls.empty()) {
+        return;
+    }
+    
+    int running = 0;
+    guard.unlock();
+    const CURLMcode performed = curl_multi_perform(multi_handle, &running);
+    guard.lock();
+    if (performed != CURLM_OK) {
+        /* Curl itself failed, so every call gets the results it has so far */
+        while (!calls.empty()) {
+            finish_call(calls.front());
+        }
+        return;
+    }
+    
+    /* Collect whatever finished */
+    CURLMsg* message = NULL;
+    int queued = 0;
+    while ((message = curl_multi_info_read(multi_handle, &queued)) != NULL) {
+        if (message->msg != CURLMSG_DONE) {
+            continue;
+        }
+        http_attempt_t* finished = NULL;
+        curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, (char**)&finished);
+        auto attempt = attempts.begin();
+        while (&*attempt != finished) {
+            attempt++;
+        }
+        http_call_t* call           = attempt->call;
+        const size_t index          = attempt->request;
+        http_request_t& request     = (*call->requests)[index];
+        http_request_state_t& state = call->states[index];
+        now = chrono::steady_clock::now();
+        
+        /* Transient failures are worth another try, anything else is the answer */
+        long response_code = 0;
+        curl_easy_getinfo(attempt->handle, CURLINFO_RESPONSE_CODE, &response_code);
+        const CURLcode result = message->data.result;
+        const bool transient  = is_transient_result(result) || response_code >= 500 || response_code == 429 || (!request.transient_body.empty() && attempt->body.find(request.transient_body) != string::npos);
+        if (state.done) {
+            finish_attempt(attempt);
+            continue;
+        }
+        if (!transient || (state.active == 1 && state.rounds > policy.retries)) {
+            request.result        = result;
+            request.response_code = response_code;
+            request.body          = move(attempt->body);
+            request.latency_ms    = elapsed_ms(state.first_started, now);
+            if (!transient) {
+                if (attempt->hedge) {
+                    request.hedge_won = true;
+                    stats.hedge_wins++;
+                }
+                if (latencies.size() >= HTTP_LATENCY_SAMPLES) {
+                    latencies.erase(latencies.begin());
+                }
+                latencies.push_back(request.latency_ms);
+            } else {
+                request.failed = true;
+                stats.failures++;
+            }
+            state.done = true;
+            call->remaining--;
+            finish_attempt(attempt);
+            
+            /* The other copy of a hedged request isn't needed anymore */
+            for (auto other = attempts.begin(); other != attempts.end();) {
+                auto next = other;
+                next++;
+                if (other->call == call && other->request == index) {
+                    finish_attempt(other);
+                }
+                other = next;
+            }
+            continue;
+        }
+        
+        /* Keep the failure around in case the deadline passes before another try answers */
+        request.result        = result;
+        request.response_code = response_code;
+        request.body          = move(attempt->body);
+        finish_attempt(attempt);
+        if (state.active == 0) {
+            state.next_start = now + backoff_delay(state.rounds - 1);
+            if (state.next_start >= state.deadline) {
+                state.done     = true;
+                request.failed = true;
+                stats.failures++;
+                call->remaining--;
+            } else {
+                request.retries++;
+                stats.retries++;
+            }
+        }
+    }
+    finish_completed_calls();
+    
+    /* Sleep until there's network activity, another call comes in, or the next retry or hedge is due */
+    if (!calls.empty()) {
+        const long timeout_ms = (long)chrono::duration_cast<chrono::milliseconds>(wake - chrono::steady_clock::now()).count();
+        guard.unlock();
+        curl_multi_poll(multi_handle, NULL, 0, (int)max(0L, timeout_ms), NULL);
+        guard.lock();
+    }
+}
+
+ile_error_t http_fetch_all(vector<http_request_t>& requests) {
+    unique_lock<mutex> guard(client_lock);
+    if (!http_client_init()) {
+        return ILE_E_FAILED_TO_INITIALIZE_CURL;
+    }
+    load_policy();
+    
+    /* Every request starts as soon as the rate limit lets it, and has until its deadline for all of its attempts */
+    const chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    http_call_t call;
+    call.requests  = &requests;
+    call.states.resize(requests.size());
+    call.remaining = requests.size();
+    call.done      = false;
+    for (size_t i = 0; i < requests.size(); i++) {
+        http_request_state_t& state = call.states[i];
+        requests[i].result        = CURLE_FAILED_INIT;
+        requests[i].response_code = 0;
+        requests[i].body.clear();
+        requests[i].attempts      = 0;
+        requests[i].retries       = 0;
+        requests[i].hedged        = false;
+        requests[i].hedge_won     = false;
+        requests[i].throttled     = false;
+        requests[i].latency_ms    = 0;
+        requests[i].failed        = false;
+        state.done                = false;
+        state.active              = 0;
+        state.rounds              = 0;
+        state.hedged              = false;
+        state.first_started       = begin;
+        state.round_started       = begin;
+        state.next_start          = begin;
+        state.deadline            = begin + chrono::milliseconds(policy.timeout_ms);
+    }
+    stats.requests += requests.size();
+    if (requests.empty()) {
+        return ILE_SUCCESS;
+    }
+    
+    /* The hedge delay is fixed for the whole call so it doesn't move while requests are waiting on it */
+    call.hedge_delay = chrono::milliseconds((latencies.size() >= HTTP_HEDGE_MIN_SAMPLES) ? latency_percentile(latencies, policy.hedge_percentile) : HTTP_HEDGE_DEFAULT_DELAY_MS);
+    calls.push_back(&call);
+    
+    /* Interrupt the driving call's poll so these requests start now, not when it times out */
+    if (driving) {
+        curl_multi_wakeup(multi_handle);
+    }
+    while (!call.done) {
+        if (driving) {
+            call_finished.wait(guard);
+            continue;
+        }
+        driving = true;
+        while (!call.done) {
+            drive_calls(guard);
+        }
+        driving = false;
+        
+        /* Hand over to whichever call is still waiting */
+        call_finished.notify_all();
+    }
+    
+    return ILE_SUCCESS;
+}
+
+void http_client_set_policy(const http_policy_t& new_policy) {
+    lock_guard<mutex> guard(client_lock);
+    policy        = new_policy;
+    rate_tokens   = max<uint32_t>(policy.burst, 1);
+    rate_refilled = chrono::steady_clock::now();
+    policy_loaded = true;
+}
+
+void http_client_get_policy(http_policy_t* policy_out) {
+    lock_guard<mutex> guard(client_lock);
+    load_policy();
+    *policy_out = policy;
+}
+
+void http_client_get_stats(http_stats_t* stats_out) {
+    lock_guard<mutex> guard(client_lock);
+    *stats_out                = stats;
+    stats_out->latency_p50_ms = latency_percentile(latencies, 50);
+    stats_out->latency_p95_ms = latency_percentile(latencies, 95);
+    stats_out->latency_max_ms = latencies.empty() ? 0 : *max_element(latencies.begin(), latencies.end());
+}
+
+void http_stats_from_requests(const vector<http_request_t>& requests, http_stats_t* stats_out) {
+    *stats_out = http_stats_t();
+    vector<uint32_t> answered;
+    for (size_t i = 0; i < requests.size(); i++) {
+        const http_request_t& request = requests[i];
+        stats_out->requests++;
+        stats_out->attempts   += request.attempts;
+        stats_out->retries    += request.retries;
+        stats_out->hedges     += request.hedged ? 1 : 0;
+        stats_out->hedge_wins += request.hedge_won ? 1 : 0;
+        stats_out->failures   += request.failed ? 1 : 0;
+        stats_out->throttled  += request.throttled ? 1 : 0;
+        if (!request.failed && request.attempts > 0) {
+            answered.push_back(request.latency_ms);
+        }
+    }
+    stats_out->latency_p50_ms = latency_percentile(answered, 50);
+    stats_out->latency_p95_ms = latency_percentile(answered, 95);
+    stats_out->latency_max_ms = answered.empty() ? 0 : *max_element(answered.begin(), answered.end());
+}
+
+void http_client_cleanup(void) {
+    lock_guard<mutex> guard(client_lock);
+    if (!share_handle && !multi_handle) {
+        return;
+    }
+    
+    curl_multi_cleanup(multi_handle);
+    curl_share_cleanup(share_handle);
+    multi_handle = NULL;
+    share_handle = NULL;
+    curl_global_cleanup();
+}
@@ -0,0 +1,141 @@
+//
+//  http_client.hpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#ifndef http_client_hpp
+#define http_client_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <curl/curl.h>
+#include "utilities.hpp"
+
+using namespace std;
+
+/* Defaults for the request policy, each overridable in the environment (ILE_HTTP_CONNECT_TIMEOUT_MS, ILE_HTTP_TIMEOUT_MS, ILE_HTTP_RETRIES, ILE_HTTP_HEDGE_PERCENTILE, ILE_HTTP_RATE, ILE_HTTP_BURST, ILE_HTTP_MAX_IN_FLIGHT) */
+#define HTTP_DEFAULT_CONNECT_TIMEOUT_MS 10000
+#define HTTP_DEFAULT_TIMEOUT_MS         30000
+#define HTTP_DEFAULT_RETRIES            3
+#define HTTP_DEFAULT_HEDGE_PERCENTILE   0
+#define HTTP_DEFAULT_RATE               10
+#define HTTP_DEFAULT_BURST              10
+#define HTTP_DEFAULT_MAX_IN_FLIGHT      8
+
+/* Retries wait a random time up to base * 2^retry, capped */
+#define HTTP_BACKOFF_BASE_MS 250
+#define HTTP_BACKOFF_MAX_MS  4000
+
+/* Hedging waits this long until enough responses have been seen to take a percentile of */
+#define HTTP_HEDGE_DEFAULT_DELAY_MS 1000
+#define HTTP_HEDGE_MIN_SAMPLES      8
+#define HTTP_LATENCY_SAMPLES        256
+
+typedef struct {
+    /* Per attempt */
+    uint32_t connect_timeout_ms;
+    
+    /* For the whole request, every retry included */
+    uint32_t timeout_ms;
+    
+    /* Extra attempts after a failure, a 5xx or 429, or a body with the request's transient_body in it */
+    uint32_t retries;
+    
+    /* Send a duplicate of a request that's slower than this percentile of earlier responses and take whichever answers first, 0 to never */
+    uint32_t hedge_percentile;
+    
+    /* Attempts (retries and hedges included) start at most this many per second, after a burst of up to burst at once, 0 for no limit */
+    uint32_t rate;
+    uint32_t burst;
+    
+    /* Attempts running at once, 0 for no limit */
+    uint32_t max_in_flight;
+} http_policy_t;
+
+typedef struct {
+    uint64_t requests;
+    uint64_t attempts;
+    uint64_t retries;
+    uint64_t hedges;
+    uint64_t hedge_wins;
+    uint64_t failures;
+    
+    /* Requests that had to wait for the rate limit or a free slot */
+    uint64_t throttled;
+    
+    /* Over the most recent successful requests, from first attempt to answer */
+    uint32_t latency_p50_ms;
+    uint32_t latency_p95_ms;
+    uint32_t latency_max_ms;
+} http_stats_t;
+
+typedef struct {
+    /* Filled in by the caller */
+    string url;
+    
+    /* A successful response containing this is treated like a 5xx, empty for none */
+    string transient_body;
+    
+    /* Filled in by http_fetch_all */
+    CURLcode result;
+    long response_code;
+    string body;
+    uint32_t attempts;
+    uint32_t retries;
+    bool hedged;
+    bool hedge_won;
+    bool throttled;
+    uint32_t latency_ms;
+    
+    /* Gave up after transient failures, or couldn't be started */
+    bool failed;
+} http_request_t;
+
+/**
+ Gets the process-wide curl share handle, creating it on first use. Every handle that uses it shares DNS lookups, TLS sessions and connections, and it is safe to use from several threads
+ @return The share handle, or NULL if curl couldn't be initialized
+ */
+CURLSH* http_client_share(void);
+
+/**
+ Performs a set of GET requests concurrently on the process-wide multi handle. Requests to the same host are multiplexed over one HTTP/2 connection when the server supports it, and connections are kept open for later calls. Calls from several threads run on the multi handle together, so the rate limit and in-flight limit count all of their requests. Every request follows the policy's deadlines, retries, hedging and rate limit, and its deadline only starts once it is let through
+ @param requests The requests, whose results are filled in
+ @return ile_error_t error code, which is only an error if curl couldn't be used at all. Check each request's result
+ */
+ile_error_t http_fetch_all(vector<http_request_t>& requests);
+
+/**
+ Replaces the request policy, which otherwise comes from the defaults and the environment
+ @param policy The policy
+ */
+void http_client_set_policy(const http_policy_t& policy);
+
+/**
+ Gets the request policy, so requests made outside of http_fetch_all can follow the same timeouts
+ @param policy Pointer to the policy
+ */
+void http_client_get_policy(http_policy_t* policy);
+
+/**
+ Gets the retry, hedging and latency stats of every request http_fetch_all has made in this process
+ @param stats Pointer to the stats
+ */
+void http_client_get_stats(http_stats_t* stats);
+
+/**
+ Sums up some finished requests the way http_client_get_stats does for every request, for reporting on just those
+ @param requests The requests, after http_fetch_all
+ @param stats Pointer to the stats
+ */
+void http_stats_from_requests(const vector<http_request_t>& requests, http_stats_t* stats);
+
+/**
+ Closes the process-wide handles and their connections
+ */
+void http_client_cleanup(void);
+
+#endif /* http_client_hpp */
@@ -0,0 +1,254 @@
+//
+//  http_source.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include <curl/curl.h>
+#include "utilities.hpp"
+#include "http_client.hpp"
+#include "http_source.hpp"
+
+using namespace std;
+
+typedef struct {
+    vector<uint8_t>* data;
+    uint64_t limit;
+} range_response_t;
+
+static size_t range_write_cb(void* contents, size_t size, size_t nmemb, range_response_t* response) {
+    const size_t total_size = size * nmemb;
+    
+    /* A server that ignores the Range header would send the whole IPSW, stop as soon as it's more than was asked for */
+    if (response->data->size() + total_size > response->limit) {
+        return 0;
+    }
+    response->data->insert(response->data->end(), (uint8_t*)contents, (uint8_t*)contents + total_size);
+    
+    return total_size;
+}
+
+ile_error_t http_source_open(const char* url, http_source_t** source) {
+    /* The client initializes curl once for the whole process */
+    CURLSH* share = http_client_share();
+    CURL* handle  = share ? curl_easy_init() : NULL;
+    if (!handle) {
+        return ILE_E_FAILED_TO_INITIALIZE_CURL;
+    }
+    
+    /* Only ask for the headers to learn the size, within the same timeouts as every other request */
+    http_policy_t policy;
+    http_client_get_policy(&policy);
+    curl_easy_setopt(handle, CURLOPT_URL, url);
+    curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(handle, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT_MS, (long)policy.connect_timeout_ms);
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, (long)policy.timeout_ms);
+    curl_easy_setopt(handle, CURLOPT_SHARE, share);
+    CURLcode res = curl_easy_perform(handle);
+    if (res != CURLE_OK) {
+        curl_easy_cleanup(handle);
+        return (res == CURLE_OPERATION_TIMEDOUT) ? ILE_E_REMOTE_TIMED_OUT : ILE_E_FAILED_TO_OPEN_IPSW;
+    }
+    long response_code = 0;
+    curl_off_t content_length = -1;
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &response_code);
+    curl_easy_getinfo(handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+    if (response_code != 200 || content_length <= 0) {
+        curl_easy_cleanup(handle);
+        return ILE_E_FAILED_TO_OPEN_IPSW;
+    }
+    
+    /* Every read from here on is a ranged GET, a stalled one is given up on instead of holding the source's lock forever */
+    curl_easy_setopt(handle, CURLOPT_NOBODY, 0L);
+    curl_easy_setopt(handle, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, range_write_cb);
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, 0L);
+    curl_easy_setopt(handle, CURLOPT_LOW_SPEED_LIMIT, (long)HTTP_SOURCE_LOW_SPEED_LIMIT);
+    curl_easy_setopt(handle, CURLOPT_LOW_SPEED_TIME, max<long>((long)(policy.timeout_ms / 1000), 1));
+    
+    http_source_t* new_source  = new http_source_t();
+    new_source->url            = strdup(url);
+    new_source->handle         = handle;
+    new_source->size           = (uint64_t)content_length;
+    new_source->request_count  = 0;
+    new_source->bytes_fetched  = 0;
+    *source = new_source;
+    
+    return ILE_SUCCESS;
+}
+
+/* Must be called with the lock held */
+static ile_error_t fetch_blocks(http_source_t* source, uint64_t first_block, uint64_t last_block) {
+    const uint64_t start = first_block * HTTP_SOURCE_BLOCK_SIZE;
+    uint64_t end = (last_block + 1) * HTTP_SOURCE_BLOCK_SIZE;
+    if (end > source->size) {
+        end = source->size;
+    }
+    
+    /* One request for the whole run of blocks */
+    vector<uint8_t> data;
+    data.reserve(end - start);
+    range_response_t response = { &data, end - start };
+    char range[64];
+    snprintf(range, sizeof(range), "%llu-%llu", (unsigned long long)start, (unsigned long long)(end - 1));
+    curl_easy_setopt(source->handle, CURLOPT_RANGE, range);
+    curl_easy_setopt(source->handle, CURLOPT_WRITEDATA, &response);
+    CURLcode res = curl_easy_perform(source->handle);
+    source->request_count++;
+    long response_code = 0;
+    curl_easy_getinfo(source->handle, CURLINFO_RESPONSE_CODE, &response_code);
+    if (res == CURLE_OPERATION_TIMEDOUT) {
+        return ILE_E_REMOTE_TIMED_OUT;
+    } else if (res != CURLE_OK || response_code != 206 || data.size() != end - start) {
+        return ILE_E_FAILED_TO_HANDLE_ZIP;
+    }
+    source->bytes_fetched += data.size();
+    
+    /* Split it up into blocks */
+    for (uint64_t block = first_block; block <= last_block; block++) {
+        const uint64_t block_start = (block - first_block) * HTTP_SOURCE_BLOCK_SIZE;
+        const uint64_t block_end   = min<uint64_t>(block_start + HTTP_SOURCE_BLOCK_SIZE, data.size());
+        source->lru.push_front(block);
+        source->blocks[block] = make_pair(vector<uint8_t>(data.begin() + block_start, data.begin() + block_end), source->lru.begin());
+    }
+    
+    return ILE_SUCCESS;
+}
+
+/* Must be called with the lock held. Evicts the least recently used blocks until needed more fit, skipping first_block to last_block since the caller is about to copy out of them */
+static void make_room(http_source_t* source, uint64_t first_block, uint64_t last_block, size_t needed) {
+    auto block = source->lru.end();
+    while (source->blocks.size() + needed > HTTP_SOURCE_MAX_BLOCKS && block != source->lru.begin()) {
+        block--;
+        if (*block >= first_block && *block <= last_block) {
+            continue;
+        }
+        source->blocks.erase(*block);
+        block = source->lru.erase(block);
+    }
+}
+
+/* Must be called with the lock held. At most HTTP_SOURCE_MAX_BLOCKS blocks, which all stay cached until the lock is released */
+static ile_error_t fetch_missing_blocks(http_source_t* source, uint64_t first_block, uint64_t last_block) {
+    size_t missing = 0;
+    for (uint64_t block = first_block; block <= last_block; block++) {
+        missing += source->blocks.count(block) ? 0 : 1;
+    }
+    make_room(source, first_block, last_block, missing);
+    
+    /* Fetch each run of missing blocks with a single request */
+    uint64_t block = first_block;
+    while (block <= last_block) {
+        if (source->blocks.count(block)) {
+            block++;
+            continue;
+        }
+        uint64_t run_end = block;
+        while (run_end + 1 <= last_block && !source->blocks.count(run_end + 1)) {
+            run_end++;
+        }
+        ile_error_t ret = fetch_blocks(source, block, run_end);
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+        block = run_end + 1;
+    }
+    
+    return ILE_SUCCESS;
+}
+
+ile_error_t http_source_read(void* context, uint64_t offset, void* buffer, size_t length) {
+    http_source_t* source = (http_source_t*)context;
+    if (offset > source->size || length > (source->size - offset)) {
+        return ILE_E_FAILED_TO_HANDLE_ZIP;
+    }
+    if (length == 0) {
+        return ILE_SUCCESS;
+    }
+    
+    lock_guard<mutex> guard(source->lock);
+    const uint64_t first_block = offset / HTTP_SOURCE_BLOCK_SIZE;
+    const uint64_t last_block  = (offset + length - 1) / HTTP_SOURCE_BLOCK_SIZE;
+    
+    /* Anything larger than the cache can hold is read in cache sized pieces */
+    uint8_t* out = (uint8_t*)buffer;
+    for (uint64_t piece = first_block; piece <= last_block; piece += HTTP_SOURCE_MAX_BLOCKS) {
+        const uint64_t piece_last = min<uint64_t>(piece + HTTP_SOURCE_MAX_BLOCKS - 1, last_block);
+        ile_error_t ret = fetch_missing_blocks(source, piece, piece_last);
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+        
+        for (uint64_t block = piece; block <= piece_last; block++) {
+            auto cached = source->blocks.find(block);
+            const uint64_t block_start = block * HTTP_SOURCE_BLOCK_SIZE;
+            const uint64_t copy_start  = max<uint64_t>(offset, block_start);
+            if (cached == source->blocks.end() || block_start + cached->second.first.size() <= copy_start) {
+                return ILE_E_FAILED_TO_HANDLE_ZIP;
+            }
+            const uint64_t copy_end = min<uint64_t>(offset + length, block_start + cached->second.first.size());
+            memcpy(out, cached->second.first.data() + (copy_start - block_start), copy_end - copy_start);
+            out += copy_end - copy_start;
+            
+            /* Mark as recently used */
+            source->lru.splice(source->lru.begin(), source->lru, cached->second.second);
+        }
+    }
+    
+    return ILE_SUCCESS;
+}
+
+ile_error_t http_source_prefetch(http_source_t* source, vector<pair<uint64_t, uint64_t>> ranges) {
+    if (ranges.empty()) {
+        return ILE_SUCCESS;
+    }
+    
+    /* Sort and merge ranges that touch or are close enough that one request is cheaper than two */
+    sort(ranges.begin(), ranges.end());
+    vector<pair<uint64_t, uint64_t>> merged;
+    for (size_t i = 0; i < ranges.size(); i++) {
+        uint64_t start = ranges[i].first;
+        uint64_t end   = min<uint64_t>(ranges[i].first + ranges[i].second, source->size);
+        if (start >= end) {
+            continue;
+        }
+        if (!merged.empty() && start <= merged.back().second + HTTP_SOURCE_COALESCE_GAP) {
+            merged.back().second = max(merged.back().second, end);
+        } else {
+            merged.push_back(make_pair(start, end));
+        }
+    }
+    
+    lock_guard<mutex> guard(source->lock);
+    for (size_t i = 0; i < merged.size(); i++) {
+        uint64_t first_block = merged[i].first / HTTP_SOURCE_BLOCK_SIZE;
+        const uint64_t last_block = (merged[i].second - 1) / HTTP_SOURCE_BLOCK_SIZE;
+        
+        /* Don't prefetch more than the cache can hold */
+        if (last_block - first_block >= HTTP_SOURCE_MAX_BLOCKS) {
+            first_block = last_block - HTTP_SOURCE_MAX_BLOCKS + 1;
+        }
+        ile_error_t ret = fetch_missing_blocks(source, first_block, last_block);
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+    }
+    
+    return ILE_SUCCESS;
+}
+
+void http_source_close(http_source_t* source) {
+    if (!source) {
+        return;
+    }
+    
+    curl_easy_cleanup(source->handle);
+    free(source->url);
+    delete source;
+}
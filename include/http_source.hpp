@@ -0,0 +1,82 @@
+//
+//  http_source.hpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#ifndef http_source_hpp
+#define http_source_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <curl/curl.h>
+#include "utilities.hpp"
+
+using namespace std;
+
+/* Remote reads are done in blocks of this size, and at most this many blocks are kept around. The tests build with a smaller cache */
+#define HTTP_SOURCE_BLOCK_SIZE  (256 * 1024)
+#ifndef HTTP_SOURCE_MAX_BLOCKS
+#define HTTP_SOURCE_MAX_BLOCKS  1024
+#endif
+
+/* Missing ranges closer together than this are fetched with one request */
+#define HTTP_SOURCE_COALESCE_GAP HTTP_SOURCE_BLOCK_SIZE
+
+/* A range request can be any size, so instead of a deadline it's abandoned once it stays below this many bytes a second for the policy's timeout */
+#define HTTP_SOURCE_LOW_SPEED_LIMIT 1024
+
+typedef struct {
+    char* url;
+    CURL* handle;
+    uint64_t size;
+    
+    /* Cached blocks with the most recently used at the front */
+    mutex lock;
+    unordered_map<uint64_t, pair<vector<uint8_t>, list<uint64_t>::iterator>> blocks;
+    list<uint64_t> lru;
+    
+    /* Statistics */
+    uint64_t request_count;
+    uint64_t bytes_fetched;
+} http_source_t;
+
+/**
+ Opens a remote file that will be read with HTTP range requests
+ @param url The URL of the file, the server must support range requests
+ @param source Pointer to the source, which must be closed with http_source_close
+ @return ile_error_t error code
+ */
+ile_error_t http_source_open(const char* url, http_source_t** source);
+
+/**
+ Reads bytes from the remote file through the block cache. Matches zip_directory_reader_t so it can be used to read zip structures
+ @param context The http_source_t
+ @param offset The offset to read from
+ @param buffer The buffer to read into
+ @param length The number of bytes to read
+ @return ile_error_t error code
+ */
+ile_error_t http_source_read(void* context, uint64_t offset, void* buffer, size_t length);
+
+/**
+ Fetches a set of ranges into the block cache, coalescing ranges that are next to each other into single requests
+ @param source The source
+ @param ranges Pairs of offset and length
+ @return ile_error_t error code
+ */
+ile_error_t http_source_prefetch(http_source_t* source, vector<pair<uint64_t, uint64_t>> ranges);
+
+/**
+ Closes a remote file
+ @param source The source
+ */
+void http_source_close(http_source_t* source);
+
+#endif /* http_source_hpp */
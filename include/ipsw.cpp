@@ -7,15 +7,166 @@
 
 #include <zip.h>
 #include <vector>
+#include <algorithm>
+#include <unordered_map>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <plist/plist.h>
 #include "utilities.hpp"
 #include "ipsw.hpp"
 #include "api.hpp"
+#include "extraction.hpp"
+#include "manifest_reader.hpp"
+#include "component_registry.hpp"
+#include "http_client.hpp"
 
 using namespace std;
 
+/* Compressed bytes read past a head's size, more than deflate adds to a few KB */
+#define IPSW_HEAD_INFLATE_SLACK 0x400
+
+static ile_error_t mapping_reader(void* context, uint64_t offset, void* buffer, size_t length) {
+    const ipsw_mapping_t* mapping = (const ipsw_mapping_t*)context;
+    if (offset > mapping->size || length > (mapping->size - offset)) {
+        return ILE_E_FAILED_TO_HANDLE_ZIP;
+    }
+    
+    memcpy(buffer, mapping->base + offset, length);
+    return ILE_SUCCESS;
+}
+
+static zip_directory_reader_t archive_reader(ipsw_archive_t archive, void** context) {
+    if (archive.backend == IPSW_BACKEND_HTTP) {
+        *context = archive.remote;
+        return http_source_read;
+    }
+    
+    *context = archive.mapping;
+    return mapping_reader;
+}
+
+static ile_error_t ipsw_load_directory(zip_directory_reader_t reader, void* context, const uint8_t* base, uint64_t file_size, zip_directory_t** directory, ipsw_index_t** index) {
+    zip_central_directory_location_t location;
+    ile_error_t ret = zip_directory_locate(reader, context, file_size, &location);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    /* A mapped central directory is used in place, anything else is read in one go */
+    vector<uint8_t> central_directory_copy;
+    const uint8_t* central_directory = NULL;
+    if (base) {
+        central_directory = base + location.offset;
+    } else {
+        central_directory_copy.resize(location.size);
+        ret = reader(context, location.offset, central_directory_copy.data(), location.size);
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+        central_directory = central_directory_copy.data();
+    }
+    
+    /* A matching index sidecar saves parsing the central directory and the build manifest again */
+    zip_directory_t* new_directory = new zip_directory_t();
+    ipsw_index_t* new_index = new ipsw_index_t();
+    if (ipsw_index_init(central_directory, location, file_size, new_index) != ILE_SUCCESS) {
+        ipsw_index_free(new_index);
+        delete new_index;
+        new_index = NULL;
+    }
+    if (new_index && ipsw_index_load(new_index, new_directory) == ILE_SUCCESS) {
+        log_message(INFO, "Using the cached index for this IPSW");
+    } else {
+        ret = zip_directory_parse(central_directory, location, file_size, new_directory);
+        if (ret != ILE_SUCCESS) {
+            if (new_index) {
+                ipsw_index_free(new_index);
+                delete new_index;
+            }
+            delete new_directory;
+            return ret;
+        }
+    }
+    
+    *directory = new_directory;
+    *index     = new_index;
+    return ILE_SUCCESS;
+}
+
+static ile_error_t ipsw_open_mapping(ipsw_archive_t* archive) {
+    /* Map the whole IPSW read-only, pages are only faulted in for the entries that are actually read */
+    int fd = open(archive->path, O_RDONLY);
+    if (fd < 0) {
+        return ILE_E_FAILED_TO_OPEN_IPSW;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return ILE_E_FAILED_TO_OPEN_IPSW;
+    }
+    void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return ILE_E_FAILED_TO_MAP_IPSW;
+    }
+    
+    /* Access jumps between the central directory and a handful of entries, so readahead around faults is wasted */
+    madvise(base, (size_t)st.st_size, MADV_RANDOM);
+    
+    ipsw_mapping_t* mapping = new ipsw_mapping_t{ fd, (const uint8_t*)base, (uint64_t)st.st_size };
+    ile_error_t ret = ipsw_load_directory(mapping_reader, mapping, mapping->base, mapping->size, &archive->directory, &archive->index);
+    if (ret != ILE_SUCCESS) {
+        munmap(base, (size_t)st.st_size);
+        close(fd);
+        delete mapping;
+        return ret;
+    }
+    
+    archive->backend = IPSW_BACKEND_MMAP;
+    archive->mapping = mapping;
+    return ILE_SUCCESS;
+}
+
+static ile_error_t ipsw_open_remote(ipsw_archive_t* archive) {
+    http_source_t* remote = NULL;
+    ile_error_t ret = http_source_open(archive->path, &remote);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    /* Only the tail, the central directory and the entries that are extracted ever get downloaded */
+    ret = ipsw_load_directory(http_source_read, remote, NULL, remote->size, &archive->directory, &archive->index);
+    if (ret != ILE_SUCCESS) {
+        http_source_close(remote);
+        return ret;
+    }
+    
+    archive->backend = IPSW_BACKEND_HTTP;
+    archive->remote  = remote;
+    return ILE_SUCCESS;
+}
+
 ile_error_t ipsw_open(ipsw_archive_t* archive) {
+    archive->data      = NULL;
+    archive->mapping   = NULL;
+    archive->directory = NULL;
+    archive->index     = NULL;
+    archive->remote    = NULL;
+    
+    /* URLs are read with range requests, there is no libzip fallback for them */
+    if (is_http_url(archive->path)) {
+        return ipsw_open_remote(archive);
+    }
+    
+    if (ipsw_open_mapping(archive) == ILE_SUCCESS) {
+        return ILE_SUCCESS;
+    }
+    
+    /* Anything the mapped reader can't handle goes through libzip instead */
+    archive->backend = IPSW_BACKEND_LIBZIP;
     archive->data = zip_open(archive->path, ZIP_RDONLY, 0);
     if (!archive->data) {
         return ILE_E_FAILED_TO_OPEN_IPSW;
@@ -25,12 +176,37 @@ ile_error_t ipsw_open(ipsw_archive_t* archive) {
 }
 
 void ipsw_close(ipsw_archive_t* archive) {
-    zip_close(archive->data);
+    if (archive->data) {
+        zip_close(archive->data);
+        archive->data = NULL;
+    }
+    if (archive->mapping) {
+        munmap((void*)archive->mapping->base, (size_t)archive->mapping->size);
+        close(archive->mapping->fd);
+        delete archive->mapping;
+        archive->mapping = NULL;
+    }
+    if (archive->remote) {
+        http_source_close(archive->remote);
+        archive->remote = NULL;
+    }
+    delete archive->directory;
+    archive->directory = NULL;
+    if (archive->index) {
+        ipsw_index_free(archive->index);
+        delete archive->index;
+        archive->index = NULL;
+    }
 }
 
-ile_error_t extract_ipsw_file_to_memory(ipsw_archive_t archive, const char* filename, char** buffer, size_t* size) {
+bool ipsw_is_thread_safe(ipsw_archive_t archive) {
+    /* The mapping and directory are never written to after ipsw_open, and remote reads are serialized by the source */
+    return archive.backend == IPSW_BACKEND_MMAP || archive.backend == IPSW_BACKEND_HTTP;
+}
+
+static ile_error_t libzip_extract_file_to_memory(ipsw_archive_t archive, const char* filename, char** buffer, size_t* size) {
     /* Locate the file */
-    size_t zip_index = zip_name_locate(archive.data, filename, 0);
+    zip_int64_t zip_index = zip_name_locate(archive.data, filename, 0);
     if (zip_index < 0) {
         return ILE_E_FAILED_TO_GET_ZIP_INDEX;
     }
@@ -55,7 +231,7 @@ ile_error_t extract_ipsw_file_to_memory(ipsw_archive_t archive, const char* file
         zip_fclose(zfile);
         return ILE_E_OUT_OF_MEMORY;
     }
-    if (zip_fread(zfile, *buffer, *size) != *size) {
+    if (zip_fread(zfile, *buffer, *size) != (zip_int64_t)*size) {
         zip_fclose(zfile);
         free(*buffer);
         return ILE_E_FAILED_TO_HANDLE_ZIP;
@@ -67,26 +243,497 @@ ile_error_t extract_ipsw_file_to_memory(ipsw_archive_t archive, const char* file
     return ILE_SUCCESS;
 }
 
-ile_error_t parse_build_manifest(ipsw_archive_t archive, build_manifest_t* build_manifest) {
-    /* Load the BuildManifest into memory */
-    char* buffer = NULL;
-    size_t size  = 0;
-    ile_error_t ret = extract_ipsw_file_to_memory(archive, "BuildManifest.plist", &buffer, &size);
+/* Finds an entry and where its data starts for the mmap and http backends, as long as it's an entry they can read */
+static ile_error_t locate_entry_data(ipsw_archive_t archive, const char* filename, const zip_directory_entry_t** entry, uint64_t* data_offset) {
+    *entry = zip_directory_find(*archive.directory, filename);
+    if (!*entry) {
+        return ILE_E_FAILED_TO_GET_ZIP_INDEX;
+    }
+    void* context = NULL;
+    zip_directory_reader_t reader = archive_reader(archive, &context);
+    ile_error_t ret = zip_directory_data_offset(reader, context, **entry, data_offset);
     if (ret != ILE_SUCCESS) {
-        /* Older models say BuildManifesto instead of BuildManifest - Try again */
-        ret = extract_ipsw_file_to_memory(archive, "BuildManifesto.plist", &buffer, &size);
+        return ret;
+    }
+    if (*data_offset > archive.directory->file_size || (*entry)->compressed_size > (archive.directory->file_size - *data_offset) || ((*entry)->flags & 0x1)) {
+        return ILE_E_FAILED_TO_HANDLE_ZIP;
+    }
+    if ((*entry)->compression_method != ZIP_METHOD_STORED && (*entry)->compression_method != ZIP_METHOD_DEFLATE) {
+        return ILE_E_FAILED_TO_HANDLE_ZIP;
+    }
+    
+    return ILE_SUCCESS;
+}
+
+ile_error_t ipsw_view_file(ipsw_archive_t archive, const char* filename, ipsw_file_view_t* view) {
+    view->data  = NULL;
+    view->size  = 0;
+    view->owned = NULL;
+    
+    if (archive.backend == IPSW_BACKEND_LIBZIP) {
+        ile_error_t ret = libzip_extract_file_to_memory(archive, filename, &view->owned, &view->size);
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+        view->data = view->owned;
+        return ILE_SUCCESS;
+    }
+    
+    /* Find the entry's data */
+    const zip_directory_entry_t* entry = NULL;
+    uint64_t data_offset = 0;
+    ile_error_t ret = locate_entry_data(archive, filename, &entry, &data_offset);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    void* context = NULL;
+    zip_directory_reader_t reader = archive_reader(archive, &context);
+    
+    /* Remote entries are downloaded first, stored ones straight into the view's buffer */
+    vector<uint8_t> downloaded;
+    const uint8_t* compressed = NULL;
+    if (archive.backend == IPSW_BACKEND_HTTP) {
+        if (entry->compression_method == ZIP_METHOD_STORED) {
+            view->owned = (char*)malloc(entry->compressed_size + 1);
+            if (!view->owned) {
+                return ILE_E_OUT_OF_MEMORY;
+            }
+            compressed = (const uint8_t*)view->owned;
+        } else {
+            downloaded.resize(entry->compressed_size);
+            compressed = downloaded.data();
+        }
+        ret = reader(context, data_offset, (void*)compressed, entry->compressed_size);
+        if (ret != ILE_SUCCESS) {
+            free(view->owned);
+            view->owned = NULL;
+            return ret;
+        }
+    } else {
+        compressed = archive.mapping->base + data_offset;
+    }
+    
+    if (entry->compression_method == ZIP_METHOD_STORED) {
+        /* Zero copy for a mapping, the view points straight into it */
+        if (entry->compressed_size != entry->uncompressed_size || !zip_directory_verify_crc(*entry, compressed)) {
+            free(view->owned);
+            view->owned = NULL;
+            return ILE_E_FAILED_TO_HANDLE_ZIP;
+        }
+        if (view->owned) {
+            view->owned[entry->uncompressed_size] = '\0';
+        }
+        view->data = (const char*)compressed;
+        view->size = entry->uncompressed_size;
+        return ILE_SUCCESS;
+    }
+    
+    /* Inflate, null terminated like extract_ipsw_file_to_memory */
+    view->owned = (char*)malloc(entry->uncompressed_size + 1);
+    if (!view->owned) {
+        return ILE_E_OUT_OF_MEMORY;
+    }
+    ret = zip_directory_inflate(*entry, compressed, view->owned);
+    if (ret != ILE_SUCCESS) {
+        free(view->owned);
+        view->owned = NULL;
+        return ret;
+    }
+    view->owned[entry->uncompressed_size] = '\0';
+    view->data = view->owned;
+    view->size = entry->uncompressed_size;
+    return ILE_SUCCESS;
+}
+
+ile_error_t ipsw_view_file_head(ipsw_archive_t archive, const char* filename, size_t max_size, ipsw_file_view_t* view) {
+    view->data  = NULL;
+    view->size  = 0;
+    view->owned = NULL;
+    
+    if (archive.backend == IPSW_BACKEND_LIBZIP) {
+        /* libzip inflates as it reads, so it stops after the head too */
+        zip_int64_t zip_index = zip_name_locate(archive.data, filename, 0);
+        if (zip_index < 0) {
+            return ILE_E_FAILED_TO_GET_ZIP_INDEX;
+        }
+        struct zip_file* zfile = zip_fopen_index(archive.data, zip_index, 0);
+        if (!zfile) {
+            return ILE_E_FAILED_TO_HANDLE_ZIP;
+        }
+        view->owned = (char*)malloc(max_size + 1);
+        if (!view->owned) {
+            zip_fclose(zfile);
+            return ILE_E_OUT_OF_MEMORY;
+        }
+        const zip_int64_t read = zip_fread(zfile, view->owned, max_size);
+        zip_fclose(zfile);
+        if (read < 0) {
+            free(view->owned);
+            view->owned = NULL;
+            return ILE_E_FAILED_TO_HANDLE_ZIP;
+        }
+        view->owned[read] = '\0';
+        view->data = view->owned;
+        view->size = (size_t)read;
+        return ILE_SUCCESS;
+    }
+    
+    const zip_directory_entry_t* entry = NULL;
+    uint64_t data_offset = 0;
+    ile_error_t ret = locate_entry_data(archive, filename, &entry, &data_offset);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    void* context = NULL;
+    zip_directory_reader_t reader = archive_reader(archive, &context);
+    
+    /* Deflate never grows data by more than a few bytes a block, so the head's size plus some slack always covers it */
+    const uint64_t wanted = (entry->compression_method == ZIP_METHOD_STORED) ? max_size : (uint64_t)max_size + IPSW_HEAD_INFLATE_SLACK;
+    const uint64_t compressed_size = min<uint64_t>(entry->compressed_size, wanted);
+    vector<uint8_t> downloaded;
+    const uint8_t* compressed = NULL;
+    if (archive.backend == IPSW_BACKEND_HTTP) {
+        downloaded.resize(compressed_size);
+        ret = reader(context, data_offset, downloaded.data(), compressed_size);
         if (ret != ILE_SUCCESS) {
             return ret;
         }
+        compressed = downloaded.data();
+    } else {
+        compressed = archive.mapping->base + data_offset;
     }
     
-    /* Convert it into a plist from an XML doc */
+    /* A stored head in a mapping points straight into it, everything else gets a buffer of its own */
+    if (entry->compression_method == ZIP_METHOD_STORED && archive.backend != IPSW_BACKEND_HTTP) {
+        view->data = (const char*)compressed;
+        view->size = (size_t)compressed_size;
+        return ILE_SUCCESS;
+    }
+    view->owned = (char*)malloc(max_size + 1);
+    if (!view->owned) {
+        return ILE_E_OUT_OF_MEMORY;
+    }
+    if (entry->compression_method == ZIP_METHOD_STORED) {
+        memcpy(view->owned, compressed, (size_t)compressed_size);
+        view->size = (size_t)compressed_size;
+    } else {
+        ret = zip_directory_inflate_head(compressed, compressed_size, view->owned, max_size, &view->size);
+        if (ret != ILE_SUCCESS) {
+            free(view->owned);
+            view->owned = NULL;
+            return ret;
+        }
+    }
+    view->owned[view->size] = '\0';
+    view->data = view->owned;
+    return ILE_SUCCESS;
+}
+
+ile_error_t ipsw_stat_file(ipsw_archive_t archive, const char* filename, uint32_t* crc32, uint64_t* size) {
+    if (archive.backend == IPSW_BACKEND_LIBZIP) {
+        struct zip_stat zstat;
+        zip_stat_init(&zstat);
+        if (zip_stat(archive.data, filename, 0, &zstat) != 0) {
+            return ILE_E_FAILED_TO_GET_ZIP_INDEX;
+        }
+        *crc32 = zstat.crc;
+        *size  = zstat.size;
+        return ILE_SUCCESS;
+    }
+    
+    /* Straight from the central directory, nothing is read */
+    const zip_directory_entry_t* entry = zip_directory_find(*archive.directory, filename);
+    if (!entry) {
+        return ILE_E_FAILED_TO_GET_ZIP_INDEX;
+    }
+    *crc32 = entry->crc32;
+    *size  = entry->uncompressed_size;
+    return ILE_SUCCESS;
+}
+
+void ipsw_release_file_view(ipsw_file_view_t* view) {
+    free(view->owned);
+    view->data  = NULL;
+    view->size  = 0;
+    view->owned = NULL;
+}
+
+/* Downloads the first max_size bytes of every entry up front, entries that sit next to each other share a request */
+static void prefetch_remote_files(ipsw_archive_t archive, const vector<string_view>& filenames, uint64_t max_size) {
+    vector<pair<uint64_t, uint64_t>> ranges;
+    for (size_t i = 0; i < filenames.size(); i++) {
+        const zip_directory_entry_t* entry = zip_directory_find(*archive.directory, filenames[i].data());
+        if (entry) {
+            ranges.push_back(make_pair(entry->local_header_offset, min<uint64_t>(entry->compressed_size, max_size) + 0x10000)); // Same room for the local header as ipsw_advise_files
+        }
+    }
+    if (http_source_prefetch(archive.remote, ranges) != ILE_SUCCESS) {
+        log_message(WARNING, "Failed to prefetch files from the IPSW, they will be downloaded as they are read");
+    }
+}
+
+void ipsw_advise_files(ipsw_archive_t archive, const vector<string_view>& filenames) {
+    if (archive.backend == IPSW_BACKEND_HTTP) {
+        prefetch_remote_files(archive, filenames, UINT64_MAX);
+        return;
+    }
+    if (archive.backend != IPSW_BACKEND_MMAP) {
+        return;
+    }
+    
+    const uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < filenames.size(); i++) {
+        const zip_directory_entry_t* entry = zip_directory_find(*archive.directory, filenames[i].data());
+        if (!entry || entry->local_header_offset >= archive.mapping->size) {
+            continue;
+        }
+        
+        /* Cover the local header too, madvise wants a page aligned start */
+        uint64_t end = entry->local_header_offset + entry->compressed_size + 0x10000; // Generous room for the local header's name and extra field
+        if (end > archive.mapping->size) {
+            end = archive.mapping->size;
+        }
+        const uintptr_t start   = (uintptr_t)(archive.mapping->base + entry->local_header_offset);
+        const uintptr_t aligned = start & ~(page_size - 1);
+        madvise((void*)aligned, (size_t)((uintptr_t)(archive.mapping->base + end) - aligned), MADV_WILLNEED);
+    }
+}
+
+void ipsw_advise_file_heads(ipsw_archive_t archive, const vector<string_view>& filenames, size_t max_size) {
+    /* A mapped head is a page or two that faults in quickly enough on its own */
+    if (archive.backend == IPSW_BACKEND_HTTP) {
+        prefetch_remote_files(archive, filenames, (uint64_t)max_size + IPSW_HEAD_INFLATE_SLACK);
+    }
+}
+
+ile_error_t extract_ipsw_file_to_memory(ipsw_archive_t archive, const char* filename, char** buffer, size_t* size) {
+    ipsw_file_view_t view;
+    ile_error_t ret = ipsw_view_file(archive, filename, &view);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    /* Hand over the buffer if there is one, otherwise copy out of the mapping */
+    *size = view.size;
+    if (view.owned) {
+        *buffer = view.owned;
+        return ILE_SUCCESS;
+    }
+    *buffer = (char*)malloc(view.size + 1);
+    if (!*buffer) {
+        return ILE_E_OUT_OF_MEMORY;
+    }
+    memcpy(*buffer, view.data, view.size);
+    (*buffer)[view.size] = '\0';
+    
+    return ILE_SUCCESS;
+}
+
+string_view build_manifest_intern(build_manifest_t* build_manifest, string_view value) {
+    if (!build_manifest->arena) {
+        build_manifest->arena = new string_arena_t();
+    }
+    
+    return string_arena_intern(build_manifest->arena, value);
+}
+
+void build_manifest_free(build_manifest_t* build_manifest) {
+    if (build_manifest->arena) {
+        string_arena_free(build_manifest->arena);
+        delete build_manifest->arena;
+    }
+    *build_manifest = build_manifest_t();
+}
+
+typedef struct {
+    /* Paths and component names the identity already has, the vectors keep the order for the report */
+    string_set_t seen_paths;
+    string_set_t seen_component_names;
+} identity_seen_t;
+
+typedef struct {
+    build_manifest_t* build_manifest;
+    
+    /* Every path and DeviceClass added so far and its index, the views point into the manifest's arena */
+    unordered_map<string_view, uint32_t> file_indices;
+    unordered_map<string_view, uint32_t> identity_indices;
+    vector<identity_seen_t> seen;
+    
+    /* The identity components are being added to */
+    uint32_t identity;
+} manifest_builder_t;
+
+/* Identities with the same DeviceClass (like the erase and update ones) are merged into one */
+static void manifest_builder_begin_identity(manifest_builder_t* builder, const char* device_class) {
+    auto it = builder->identity_indices.find(string_view(device_class));
+    if (it != builder->identity_indices.end()) {
+        builder->identity = it->second;
+        return;
+    }
+    
+    build_manifest_t* build_manifest = builder->build_manifest;
+    build_identity_t identity;
+    identity.device_class = build_manifest_intern(build_manifest, device_class);
+    builder->identity = (uint32_t)build_manifest->identities.size();
+    builder->identity_indices[identity.device_class] = builder->identity;
+    builder->seen.push_back(identity_seen_t());
+    build_manifest->identities.push_back(identity);
+    
+    /* The first identity is the device the build is looked up as */
+    if (builder->identity == 0) {
+        build_manifest->device_class = build_manifest->identities[0].device_class;
+    }
+}
+
+/* Both parsers feed components through here so they keep exactly the same ones */
+static void manifest_builder_add_component(manifest_builder_t* builder, const char* name, const char* path, const char* digest) {
+    /* Known bootloaders and the like are never images, everything else has to be in Firmware/all_flash/ */
+    const component_info_t* info = component_registry_find(name);
+    if (info && info->component_class != COMPONENT_CLASS_IMAGE) {
+        return;
+    }
+    identity_seen_t& seen = builder->seen[builder->identity];
+    if (strncmp(path, ALL_FLASH_PATH, sizeof(ALL_FLASH_PATH) - 1) != 0 || string_set_contains(seen.seen_paths, path) || string_set_contains(seen.seen_component_names, name)) {
+        return;
+    }
+    
+    /* We have a good path, now we can update the build_manifest. Keys are looked up under the wikiproxy name */
+    build_manifest_t* build_manifest = builder->build_manifest;
+    const char* component_name       = info ? info->wiki_name : name;
+    const char* output_name          = info ? info->output_name : name;
+    string_set_insert(&seen.seen_paths, path);
+    string_set_insert(&seen.seen_component_names, component_name);
+    
+    /* A file shared by several identities is only listed, and later decoded, once */
+    uint32_t file = 0;
+    auto it = builder->file_indices.find(string_view(path));
+    if (it != builder->file_indices.end()) {
+        file = it->second;
+    } else {
+        file = build_manifest->file_count++;
+        build_manifest->paths.push_back(build_manifest_intern(build_manifest, path));
+        build_manifest->manifest_component_names.push_back(build_manifest_intern(build_manifest, component_name));
+        build_manifest->digests.push_back(build_manifest_intern(build_manifest, digest));
+        builder->file_indices[build_manifest->paths[file]] = file;
+    }
+    
+    build_identity_t& identity = build_manifest->identities[builder->identity];
+    identity.files.push_back(file);
+    identity.component_names.push_back((build_manifest->manifest_component_names[file] == output_name) ? build_manifest->manifest_component_names[file] : build_manifest_intern(build_manifest, output_name));
+}
+
+static void on_manifest_field(void* context, manifest_field_t field, const char* value) {
+    build_manifest_t* build_manifest = ((manifest_builder_t*)context)->build_manifest;
+    switch (field) {
+        case MANIFEST_FIELD_PRODUCT_BUILD_VERSION:
+            build_manifest->product_build_version = build_manifest_intern(build_manifest, value);
+            break;
+        case MANIFEST_FIELD_PRODUCT_TYPE:
+            build_manifest->product_type = build_manifest_intern(build_manifest, value);
+            break;
+    }
+}
+
+static void on_manifest_identity(void* context, const char* device_class) {
+    manifest_builder_begin_identity((manifest_builder_t*)context, device_class);
+}
+
+static void on_manifest_component(void* context, const char* name, const char* path, const char* digest) {
+    manifest_builder_add_component((manifest_builder_t*)context, name, path, digest);
+}
+
+static ile_error_t parse_build_manifest_streaming(const char* buffer, size_t size, build_manifest_t* build_manifest) {
+    manifest_builder_t builder;
+    builder.build_manifest = build_manifest;
+    builder.identity       = 0;
+    manifest_reader_handler_t handler = { &builder, on_manifest_field, on_manifest_identity, on_manifest_component };
+    return manifest_read(buffer, size, handler);
+}
+
+/* Identities after the first are skipped instead of failing when they don't have a DeviceClass or Manifest */
+static ile_error_t parse_build_identity_dom(plist_t build_identity, bool required, manifest_builder_t* builder) {
+    const ile_error_t missing = required ? ILE_E_PLIST_OBJECT_NOT_FOUND : ILE_SUCCESS;
+    
+    /* Getting Basic Info - Device Class */
+    plist_t info = (plist_get_node_type(build_identity) == PLIST_DICT) ? plist_dict_get_item(build_identity, "Info") : NULL;
+    plist_t device_class = info ? plist_dict_get_item(info, "DeviceClass") : NULL;
+    if (!device_class) {
+        return missing;
+    }
+    char* device_class_string = NULL;
+    plist_get_string_val(device_class, &device_class_string);
+    if (!device_class_string) {
+        return ILE_E_FAILED_TO_GET_PLIST_STR_VAL;
+    }
+    
+    /* Prepare to iterate */
+    plist_t manifest = plist_dict_get_item(build_identity, "Manifest");
+    if (!manifest) {
+        free(device_class_string);
+        return missing;
+    }
+    plist_dict_iter manifest_iter = NULL;
+    plist_dict_new_iter(manifest, &manifest_iter);
+    if (!manifest_iter) {
+        free(device_class_string);
+        return ILE_E_FAILED_TO_ITERATE_OVER_PLIST;
+    }
+    manifest_builder_begin_identity(builder, device_class_string);
+    free(device_class_string);
+    
+    /* We'll use this size for the for loop itself, while inside the for loop is where we'll incriment the file_count in the ret build_manifest */
+    const uint32_t MANIFEST_SIZE = plist_dict_get_size(manifest);
+    
+    /* Iterate */
+    for (uint32_t i = 0; i < MANIFEST_SIZE; i++) {
+        /* Get the next item */
+        char* manifest_component_name = NULL;
+        plist_t manifest_component = NULL;
+        plist_dict_next_item(manifest, manifest_iter, &manifest_component_name, &manifest_component);
+        
+        if (!manifest_component_name || plist_get_node_type(manifest_component) != PLIST_DICT) {
+            free(manifest_component_name);
+            free(manifest_iter);
+            return ILE_E_PLIST_OBJECT_NOT_FOUND;
+        }
+        
+        /* Go into the info dictionary and get the path value, anything without one is skipped */
+        plist_t component_info = plist_dict_get_item(manifest_component, "Info");
+        plist_t path = component_info ? plist_dict_get_item(component_info, "Path") : NULL;
+        char* path_string_value = NULL;
+        if (path) {
+            plist_get_string_val(path, &path_string_value);
+        }
+        if (path_string_value) {
+            /* The digest is kept to tell whether the file changed between builds */
+            plist_t digest = plist_dict_get_item(manifest_component, "Digest");
+            char* digest_data = NULL;
+            uint64_t digest_size = 0;
+            if (digest && plist_get_node_type(digest) == PLIST_DATA) {
+                plist_get_data_val(digest, &digest_data, &digest_size);
+            }
+            const string digest_hex = digest_data ? hex_encode((const uint8_t*)digest_data, (size_t)digest_size) : string();
+            free(digest_data);
+            manifest_builder_add_component(builder, manifest_component_name, path_string_value, digest_hex.c_str());
+        }
+        
+        /* Everything that's kept was copied into the manifest's arena */
+        free(path_string_value);
+        free(manifest_component_name);
+    }
+    
+    /* Cleanup */
+    free(manifest_iter);
+    return ILE_SUCCESS;
+}
+
+static ile_error_t parse_build_manifest_dom(const char* buffer, size_t size, build_manifest_t* build_manifest) {
+    /* Convert it into a plist from an XML doc, or a binary one */
     plist_t root_node = NULL;
-    if (plist_from_xml(buffer, (uint32_t)size, &root_node) != PLIST_ERR_SUCCESS) {
-        free(buffer);
+    const plist_err_t conversion = plist_is_binary(buffer, (uint32_t)size) ? plist_from_bin(buffer, (uint32_t)size, &root_node) : plist_from_xml(buffer, (uint32_t)size, &root_node);
+    if (conversion != PLIST_ERR_SUCCESS || !root_node) {
         return ILE_E_PLIST_CONVERSION_FAILED;
     }
-    free(buffer);
     
     /* Getting Basic Info - product_build_version */
     plist_t product_build_version = plist_dict_get_item(root_node, "ProductBuildVersion");
@@ -95,11 +742,14 @@ ile_error_t parse_build_manifest(ipsw_archive_t archive, build_manifest_t* build
         return ILE_E_PLIST_OBJECT_NOT_FOUND;
     } else {
         /* Get the string value */
-        plist_get_string_val(product_build_version, &build_manifest->product_build_version);
-        if (!build_manifest->product_build_version) {
+        char* product_build_version_string = NULL;
+        plist_get_string_val(product_build_version, &product_build_version_string);
+        if (!product_build_version_string) {
             plist_free(root_node);
             return ILE_E_FAILED_TO_GET_PLIST_STR_VAL;
         }
+        build_manifest->product_build_version = build_manifest_intern(build_manifest, product_build_version_string);
+        free(product_build_version_string);
     }
     
     /* Getting Basic Info - product_type */
@@ -114,111 +764,161 @@ ile_error_t parse_build_manifest(ipsw_archive_t archive, build_manifest_t* build
             plist_free(root_node);
             return ILE_E_PLIST_OBJECT_NOT_FOUND;
         } else {
-            plist_get_string_val(product_type, &build_manifest->product_type);
-            if (!build_manifest->product_type) {
+            char* product_type_string = NULL;
+            plist_get_string_val(product_type, &product_type_string);
+            if (!product_type_string) {
                 plist_free(root_node);
                 return ILE_E_FAILED_TO_GET_PLIST_STR_VAL;
             }
+            build_manifest->product_type = build_manifest_intern(build_manifest, product_type_string);
+            free(product_type_string);
         }
     }
     
-    /* Getting Basic Info - Device Class */
+    /* Every build identity, only the first one has to be complete */
     plist_t build_identities = plist_dict_get_item(root_node, "BuildIdentities");
-    plist_t build_identity = NULL;
-    if (!build_identities) {
+    const uint32_t BUILD_IDENTITIES_SIZE = build_identities ? plist_array_get_size(build_identities) : 0;
+    if (!BUILD_IDENTITIES_SIZE) {
         plist_free(root_node);
         return ILE_E_PLIST_OBJECT_NOT_FOUND;
-    } else {
-        build_identity = plist_array_get_item(build_identities, 0);
-        if (!build_identity) {
+    }
+    manifest_builder_t builder;
+    builder.build_manifest = build_manifest;
+    builder.identity       = 0;
+    for (uint32_t i = 0; i < BUILD_IDENTITIES_SIZE; i++) {
+        ile_error_t ret = parse_build_identity_dom(plist_array_get_item(build_identities, i), i == 0, &builder);
+        if (ret != ILE_SUCCESS) {
             plist_free(root_node);
-            return ILE_E_PLIST_OBJECT_NOT_FOUND;
-        } else {
-            plist_t info = plist_dict_get_item(build_identity, "Info");
-            if (!info) {
-                plist_free(root_node);
-                return ILE_E_PLIST_OBJECT_NOT_FOUND;
-            } else {
-                plist_t device_class = plist_dict_get_item(info, "DeviceClass");
-                if (!device_class) {
-                    plist_free (root_node);
-                    return ILE_E_PLIST_OBJECT_NOT_FOUND;
-                } else {
-                    plist_get_string_val(device_class, &build_manifest->device_class);
-                    if (!build_manifest->device_class) {
-                        plist_free(root_node);
-                        return ILE_E_FAILED_TO_GET_PLIST_STR_VAL;
-                    }
-                }
-            }
+            return ret;
         }
     }
     
-    /* Prepare to iterate */
-    plist_t manifest = plist_dict_get_item(build_identity, "Manifest");
-    if (!manifest) {
-        plist_free(root_node);
-        return ILE_E_PLIST_OBJECT_NOT_FOUND;
-    } else {
-        /* Create an iterator */
-        plist_dict_iter manifest_iter = NULL;
-        plist_dict_new_iter(manifest, &manifest_iter);
-        if (!manifest_iter) {
-            return ILE_E_FAILED_TO_ITERATE_OVER_PLIST;
-        } else {
-            /* We'll use this size for the for loop itself, while inside the for loop is where we'll incriment the file_count in the ret build_manifest */
-            const uint32_t MANIFEST_SIZE = plist_dict_get_size(manifest);
-            
-            /* Iterate */
-            for (uint32_t i = 0; i < MANIFEST_SIZE; i++) {
-                /* Get the next item */
-                char* manifest_component_name = NULL;
-                plist_t manifest_component = NULL;
-                plist_dict_next_item(manifest, manifest_iter, &manifest_component_name, &manifest_component);
-                
-                if (!manifest_component_name || plist_get_node_type(manifest_component) != PLIST_DICT) {
-                    free(manifest_iter);
-                    plist_free(root_node);
-                    return ILE_E_PLIST_OBJECT_NOT_FOUND;
-                } else {
-                    /* Go into the info dictionary */
-                    plist_t info = plist_dict_get_item(manifest_component, "Info");
-                    if (!info) {
-                        /* Skip this item */
-                        continue;
-                    } else {
-                        /* Get the path value */
-                        plist_t path = plist_dict_get_item(info, "Path");
-                        if (!path) {
-                            /* Skip this item */
-                            continue;
-                        } else {
-                            char* path_string_value = NULL;
-                            plist_get_string_val(path, &path_string_value);
-                            if (!path_string_value) {
-                                /* Skip this item */
-                                continue;
-                            } else {
-                                /* Check if it starts with Firmware/all_flash/, only these paths are allowed */
-                                char* p = strstr(path_string_value, ALL_FLASH_PATH);
-                                if (!p) {
-                                    /* Skip */
-                                    continue;
-                                } else if (p && !is_duplicate_vector_key(build_manifest->paths, path_string_value) && !is_duplicate_vector_key(build_manifest->manifest_component_names, manifest_component_name)) {
-                                    /* We have a good path, now we can update the ret build_manifest */
-                                    build_manifest->paths.push_back(path_string_value);
-                                    build_manifest->manifest_component_names.push_back(manifest_component_name_fixup(manifest_component_name));
-                                    build_manifest->file_count++;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+    plist_free(root_node);
+    return ILE_SUCCESS;
+}
+
+ile_error_t load_build_manifest_file(ipsw_archive_t archive, char** buffer, size_t* size) {
+    ile_error_t ret = extract_ipsw_file_to_memory(archive, "BuildManifest.plist", buffer, size);
+    if (ret != ILE_SUCCESS) {
+        /* Older models say BuildManifesto instead of BuildManifest - Try again */
+        ret = extract_ipsw_file_to_memory(archive, "BuildManifesto.plist", buffer, size);
+    }
+    
+    return ret;
+}
+
+ile_error_t parse_build_manifest_buffer(const char* buffer, size_t size, manifest_parser_t parser, build_manifest_t* build_manifest) {
+    return (parser == MANIFEST_PARSER_DOM) ? parse_build_manifest_dom(buffer, size, build_manifest) : parse_build_manifest_streaming(buffer, size, build_manifest);
+}
+
+static ile_error_t parse_build_manifest_plist(ipsw_archive_t archive, build_manifest_t* build_manifest) {
+    /* Load the BuildManifest into memory */
+    char* buffer = NULL;
+    size_t size  = 0;
+    ile_error_t ret = load_build_manifest_file(archive, &buffer, &size);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    /* The streaming reader only pulls out what's needed, libplist is kept around for anything it can't read */
+    ret = parse_build_manifest_buffer(buffer, size, MANIFEST_PARSER_STREAMING, build_manifest);
+    if (ret == ILE_E_PLIST_CONVERSION_FAILED) {
+        log_message(WARNING, "Couldn't stream the build manifest, parsing it with libplist instead");
+        build_manifest_free(build_manifest);
+        ret = parse_build_manifest_buffer(buffer, size, MANIFEST_PARSER_DOM, build_manifest);
+    }
+    free(buffer);
+    
+    return ret;
+}
+
+static void load_build_manifest_from_index(const ipsw_index_t& index, build_manifest_t* build_manifest) {
+    build_manifest->product_type          = build_manifest_intern(build_manifest, index.manifest.product_type);
+    build_manifest->device_class          = build_manifest_intern(build_manifest, index.manifest.device_class);
+    build_manifest->product_build_version = build_manifest_intern(build_manifest, index.manifest.product_build_version);
+    for (size_t i = 0; i < index.manifest.paths.size(); i++) {
+        build_manifest->paths.push_back(build_manifest_intern(build_manifest, index.manifest.paths[i]));
+        build_manifest->manifest_component_names.push_back(build_manifest_intern(build_manifest, index.manifest.manifest_component_names[i]));
+        build_manifest->digests.push_back(build_manifest_intern(build_manifest, index.manifest.digests[i]));
+        build_manifest->file_count++;
+    }
+    for (size_t i = 0; i < index.manifest.identities.size(); i++) {
+        const ipsw_manifest_identity_t& cached = index.manifest.identities[i];
+        build_identity_t identity;
+        identity.device_class = build_manifest_intern(build_manifest, cached.device_class);
+        identity.files        = cached.files;
+        for (size_t j = 0; j < cached.component_names.size(); j++) {
+            identity.component_names.push_back(build_manifest_intern(build_manifest, cached.component_names[j]));
         }
-        /* Cleanup */
-        free(manifest_iter);
-        plist_free(root_node);
+        build_manifest->identities.push_back(identity);
+    }
+}
+
+static void save_build_manifest_to_index(ipsw_archive_t archive, const build_manifest_t& build_manifest) {
+    ipsw_index_t* index = archive.index;
+    index->manifest.product_type          = build_manifest.product_type;
+    index->manifest.device_class          = build_manifest.device_class;
+    index->manifest.product_build_version = build_manifest.product_build_version;
+    index->manifest.paths.assign(build_manifest.paths.begin(), build_manifest.paths.end());
+    index->manifest.manifest_component_names.assign(build_manifest.manifest_component_names.begin(), build_manifest.manifest_component_names.end());
+    index->manifest.digests.assign(build_manifest.digests.begin(), build_manifest.digests.end());
+    index->manifest.identities.resize(build_manifest.identities.size());
+    for (size_t i = 0; i < build_manifest.identities.size(); i++) {
+        const build_identity_t& identity = build_manifest.identities[i];
+        index->manifest.identities[i].device_class = identity.device_class;
+        index->manifest.identities[i].files        = identity.files;
+        index->manifest.identities[i].component_names.assign(identity.component_names.begin(), identity.component_names.end());
+    }
+    index->has_manifest = true;
+    
+    /* Resolve where every component's data starts now, so a warm run doesn't have to read the local headers */
+    void* context = NULL;
+    zip_directory_reader_t reader = archive_reader(archive, &context);
+    for (uint32_t i = 0; i < build_manifest.file_count; i++) {
+        auto it = archive.directory->name_index.find(string(build_manifest.paths[i]));
+        if (it != archive.directory->name_index.end()) {
+            zip_directory_entry_t& entry = archive.directory->entries[it->second];
+            zip_directory_data_offset(reader, context, entry, &entry.data_offset);
+        }
+    }
+    
+    if (ipsw_index_save(*index, *archive.directory) != ILE_SUCCESS) {
+        log_message(WARNING, "Failed to save the index for this IPSW, the next run will parse it again");
+    }
+}
+
+ile_error_t parse_build_manifest_info(ipsw_archive_t archive, build_manifest_t* build_manifest) {
+    if (archive.index && archive.index->has_manifest) {
+        /* Warm run, the manifest was already parsed */
+        load_build_manifest_from_index(*archive.index, build_manifest);
+        return ILE_SUCCESS;
+    }
+    
+    ile_error_t ret = parse_build_manifest_plist(archive, build_manifest);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    if (archive.index) {
+        save_build_manifest_to_index(archive, *build_manifest);
+    }
+    
+    return ILE_SUCCESS;
+}
+
+ile_error_t parse_build_manifest(ipsw_archive_t archive, build_manifest_t* build_manifest) {
+    ile_error_t ret = parse_build_manifest_info(archive, build_manifest);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    /* Keys are only looked up if something is actually encrypted */
+    vector<uint32_t> indices;
+    for (uint32_t i = 0; i < build_manifest->file_count; i++) {
+        indices.push_back(i);
+    }
+    ret = detect_encrypted_components(archive, indices, build_manifest);
+    if (ret != ILE_SUCCESS) {
+        return ret;
     }
     
     /* Attempt to append keys */
@@ -227,7 +927,16 @@ ile_error_t parse_build_manifest(ipsw_archive_t archive, build_manifest_t* build
         return ret;
     }
     
-    return ILE_SUCCESS;
+    /* Wrong keys fail here on two AES blocks each instead of after decrypting everything, and local ones are backed up by the key servers before giving up */
+    ret = validate_component_keys(archive, indices, build_manifest);
+    if (ret == ILE_E_WRONG_KEYS && append_remote_keys_to_build_manifest(build_manifest) == ILE_SUCCESS) {
+        ret = validate_component_keys(archive, indices, build_manifest);
+    }
+    if (ret == ILE_E_WRONG_KEYS) {
+        reject_keys(*build_manifest);
+    }
+    
+    return ret;
 }
 
 ile_error_t write_report(ipsw_archive_t ipsw, build_manifest_t build_manifest, const char* output_dir_path) {
@@ -247,9 +956,9 @@ ile_error_t write_report(ipsw_archive_t ipsw, build_manifest_t build_manifest, c
     }
     
     /* Populate device_info_node */
-    plist_dict_set_item(device_info_node, "product_type",          plist_new_string(build_manifest.product_type));
-    plist_dict_set_item(device_info_node, "device_class",          plist_new_string(build_manifest.device_class));
-    plist_dict_set_item(device_info_node, "product_build_version", plist_new_string(build_manifest.product_build_version));
+    plist_dict_set_item(device_info_node, "product_type",          plist_new_string(build_manifest.product_type.data()));
+    plist_dict_set_item(device_info_node, "device_class",          plist_new_string(build_manifest.device_class.data()));
+    plist_dict_set_item(device_info_node, "product_build_version", plist_new_string(build_manifest.product_build_version.data()));
     
     /* Populate files_info_node */
     plist_dict_set_item(files_info_node, "file_count", plist_new_uint(build_manifest.file_count));
@@ -261,21 +970,70 @@ ile_error_t write_report(ipsw_archive_t ipsw, build_manifest_t build_manifest, c
         }
         
         /* Populate the entry with all info for this index, then update the array */
-        plist_dict_set_item(entry, "path",                    plist_new_string(build_manifest.paths[i]));
-        plist_dict_set_item(entry, "manifest_component_name", plist_new_string(build_manifest.manifest_component_names[i]));
-        plist_dict_set_item(entry, "encrypted",               plist_new_bool(build_manifest.keys[i].available));
-        if (build_manifest.keys[i].available) {
-            plist_dict_set_item(entry, "iv",                  plist_new_string(build_manifest.keys[i].iv));
-            plist_dict_set_item(entry, "key",                 plist_new_string(build_manifest.keys[i].key));
+        plist_dict_set_item(entry, "path",                    plist_new_string(build_manifest.paths[i].data()));
+        plist_dict_set_item(entry, "manifest_component_name", plist_new_string(build_manifest.manifest_component_names[i].data()));
+        if (!build_manifest.digests[i].empty()) {
+            plist_dict_set_item(entry, "digest",              plist_new_string(build_manifest.digests[i].data()));
+        }
+        /* Only known once the file has been checked for a KBAG */
+        if (i < build_manifest.encrypted.size()) {
+            plist_dict_set_item(entry, "encrypted",           plist_new_bool(build_manifest.encrypted[i]));
+        }
+        if (i < build_manifest.keys.size() && build_manifest.keys[i].available) {
+            const key_candidate_t& key = build_manifest.keys[i].candidates.front();
+            plist_dict_set_item(entry, "iv",                  plist_new_string(key.iv.data()));
+            plist_dict_set_item(entry, "key",                 plist_new_string(key.key.data()));
+            plist_dict_set_item(entry, "key_source",          plist_new_string(key.source.data()));
+            plist_dict_set_item(entry, "key_candidates",      plist_new_uint(build_manifest.keys[i].candidates.size()));
         }
         
         plist_array_append_item(files_info_array, entry);
     }
     plist_dict_set_item(files_info_node, "files", files_info_array);
     
+    /* Populate identities_node with the files every identity uses, which were only decoded once no matter how many use them */
+    plist_t identities_node = plist_new_array();
+    if (!identities_node) {
+        plist_free(root_node);
+        return ILE_E_FAILED_TO_CREATE_PLIST_OBJECT;
+    }
+    for (size_t i = 0; i < build_manifest.identities.size(); i++) {
+        const build_identity_t& identity = build_manifest.identities[i];
+        plist_t identity_node   = plist_new_dict();
+        plist_t components_node = plist_new_array();
+        plist_dict_set_item(identity_node, "device_class", plist_new_string(identity.device_class.data()));
+        for (size_t j = 0; j < identity.files.size(); j++) {
+            plist_t component_node = plist_new_dict();
+            plist_dict_set_item(component_node, "manifest_component_name", plist_new_string(identity.component_names[j].data()));
+            plist_dict_set_item(component_node, "path",                    plist_new_string(build_manifest.paths[identity.files[j]].data()));
+            plist_array_append_item(components_node, component_node);
+        }
+        plist_dict_set_item(identity_node, "components", components_node);
+        plist_array_append_item(identities_node, identity_node);
+    }
+    
     /* Append the nodes to the root node */
     plist_dict_set_item(root_node, "device_info", device_info_node);
     plist_dict_set_item(root_node, "files_info",  files_info_node);
+    plist_dict_set_item(root_node, "identities",  identities_node);
+    
+    /* How the requests for this build's keys went, including ones a batch made for it up front */
+    http_stats_t stats;
+    get_key_request_stats(build_manifest, &stats);
+    if (stats.requests > 0) {
+        plist_t key_requests_node = plist_new_dict();
+        plist_dict_set_item(key_requests_node, "requests",       plist_new_uint(stats.requests));
+        plist_dict_set_item(key_requests_node, "attempts",       plist_new_uint(stats.attempts));
+        plist_dict_set_item(key_requests_node, "retries",        plist_new_uint(stats.retries));
+        plist_dict_set_item(key_requests_node, "hedges",         plist_new_uint(stats.hedges));
+        plist_dict_set_item(key_requests_node, "hedge_wins",     plist_new_uint(stats.hedge_wins));
+        plist_dict_set_item(key_requests_node, "failures",       plist_new_uint(stats.failures));
+        plist_dict_set_item(key_requests_node, "throttled",      plist_new_uint(stats.throttled));
+        plist_dict_set_item(key_requests_node, "latency_p50_ms", plist_new_uint(stats.latency_p50_ms));
+        plist_dict_set_item(key_requests_node, "latency_p95_ms", plist_new_uint(stats.latency_p95_ms));
+        plist_dict_set_item(key_requests_node, "latency_max_ms", plist_new_uint(stats.latency_max_ms));
+        plist_dict_set_item(root_node, "key_requests", key_requests_node);
+    }
     
     /* Create the path and write out to a file */
     char* report_output_path = NULL;
@@ -10,38 +10,123 @@
 
 #include <stdio.h>
 #include <vector>
+#include <string_view>
 #include <zip.h>
+#include "string_arena.hpp"
+#include "zip_directory.hpp"
+#include "ipsw_index.hpp"
+#include "http_source.hpp"
 
 using namespace std;
 
+typedef enum {
+    IPSW_BACKEND_LIBZIP = 0,
+    IPSW_BACKEND_MMAP   = 1,
+    IPSW_BACKEND_HTTP   = 2
+} ipsw_backend_t;
+
+typedef struct {
+    int fd;
+    const uint8_t* base;
+    uint64_t size;
+} ipsw_mapping_t;
+
 typedef struct {
     zip* data;
     const char* path;
+    
+    /* Set by ipsw_open, libzip is only used if the IPSW can't be mapped */
+    ipsw_backend_t backend;
+    ipsw_mapping_t* mapping;
+    zip_directory_t* directory;
+    
+    /* Set instead of the mapping when the path is an http(s) URL */
+    http_source_t* remote;
+    
+    /* Cached directory and manifest for repeat runs, NULL if the cache isn't available */
+    ipsw_index_t* index;
 } ipsw_archive_t;
 
+typedef struct {
+    const char* data;
+    size_t size;
+    
+    /* Non-NULL when the view had to be inflated into its own buffer instead of pointing into the IPSW */
+    char* owned;
+} ipsw_file_view_t;
+
+typedef struct {
+    string_view iv;
+    string_view key;
+    
+    /* The iv and key decoded once when they were looked up, key_size is 0 if they weren't valid AES hex */
+    uint8_t iv_bytes[16];
+    uint8_t key_bytes[32];
+    uint8_t key_size;
+    
+    /* Where the key came from, for the report */
+    string_view source;
+} key_candidate_t;
+
 typedef struct {
     bool available;
-    const char* iv;
-    const char* key;
+    
+    /* Every key the key sources had for the file, user supplied ones first. The front one is used, validate_component_keys moves the first one that decrypts the file there */
+    vector<key_candidate_t> candidates;
+    
+    /* Set by validate_component_keys when none of the candidates decrypt the file */
+    bool rejected;
 } firmware_key_t;
 
 typedef struct {
+    string_view device_class;
+    
+    /* Each of the identity's components, as an index into the build manifest's paths and the name this identity gives it */
+    vector<uint32_t> files;
+    vector<string_view> component_names;
+} build_identity_t;
+
+typedef struct {
+    /* Owns every string below, which are all null terminated. Released by build_manifest_free */
+    string_arena_t* arena;
+    
     /* Required for making the API request */
-    char* product_type;
-    char* device_class;
-    char* product_build_version;
+    string_view product_type;
+    string_view device_class;
+    string_view product_build_version;
     
-    /* Resources for either parsing the API response or actually performing on the files themselves */
+    /* Resources for either parsing the API response or actually performing on the files themselves. Every file is listed once, under the first component name that refers to it */
     uint32_t file_count;
-    vector<const char*> paths;
-    vector<const char*> manifest_component_names;
+    vector<string_view> paths;
+    vector<string_view> manifest_component_names;
     
-    /* Key Related */
+    /* The manifest's Digest for every file as hex, empty if it doesn't have one */
+    vector<string_view> digests;
+    
+    /* Every build identity, merged by DeviceClass. The first one is the device the keys are looked up for */
+    vector<build_identity_t> identities;
+    
+    /* Key Related. A file only needs keys if its payload doesn't start as an ibootim or compressed data, files past the end of encrypted haven't been checked and are assumed to */
+    vector<bool> encrypted;
     vector<firmware_key_t> keys;
 } build_manifest_t;
 
 /**
- Opens an IPSW zip archive
+ Copies a string into the build manifest's arena
+ @param build_manifest Pointer to the build manifest
+ @param value The string
+ @return A null terminated view that stays valid until build_manifest_free
+ */
+string_view build_manifest_intern(build_manifest_t* build_manifest, string_view value);
+
+/**
+ Releases everything a build manifest holds
+ @param build_manifest Pointer to the build manifest
+ */
+void build_manifest_free(build_manifest_t* build_manifest);
+
+/**
+ Opens an IPSW zip archive, memory mapping it when possible and falling back to libzip otherwise. http(s) URLs are read with range requests
  @param archive Pointer to the IPSW archive
  @return ile_error_t error code
  */
@@ -64,7 +149,96 @@ void ipsw_close(ipsw_archive_t* archive);
 ile_error_t extract_ipsw_file_to_memory(ipsw_archive_t archive, const char* filename, char** buffer, size_t* size);
 
 /**
- Parses a build manifest to get info required for a wikiproxy API request and gets useful info about paths
+ Gets a read-only view of a file in the IPSW. Stored files in a mapped IPSW point straight into the mapping, everything else is inflated into a buffer owned by the view
+ @param archive The IPSW archive
+ @param filename The name of the file
+ @param view Pointer to the view, which must be released with ipsw_release_file_view
+ @return ile_error_t error code
+ */
+ile_error_t ipsw_view_file(ipsw_archive_t archive, const char* filename, ipsw_file_view_t* view);
+
+/**
+ Gets a read-only view of the start of a file in the IPSW, without reading or inflating the rest of it. Stored files in a mapped IPSW point straight into the mapping, everything else is read into a buffer owned by the view. Nothing is checked against the file's CRC
+ @param archive The IPSW archive
+ @param filename The name of the file
+ @param max_size The most bytes to read from the start of the file
+ @param view Pointer to the view, which must be released with ipsw_release_file_view. It is shorter than max_size if the file is
+ @return ile_error_t error code
+ */
+ile_error_t ipsw_view_file_head(ipsw_archive_t archive, const char* filename, size_t max_size, ipsw_file_view_t* view);
+
+/**
+ Gets a file's CRC-32 and uncompressed size from the zip directory without reading the file
+ @param archive The IPSW archive
+ @param filename The name of the file
+ @param crc32 Pointer to the return CRC-32
+ @param size Pointer to the return size
+ @return ile_error_t error code
+ */
+ile_error_t ipsw_stat_file(ipsw_archive_t archive, const char* filename, uint32_t* crc32, uint64_t* size);
+
+/**
+ Releases a view from ipsw_view_file or ipsw_view_file_head
+ @param view Pointer to the view
+ */
+void ipsw_release_file_view(ipsw_file_view_t* view);
+
+/**
+ Tells the kernel which files are about to be read so a mapped IPSW can page them in ahead of time, or downloads them ahead of time for a remote IPSW
+ @param archive The IPSW archive
+ @param filenames The names of the files
+ */
+void ipsw_advise_files(ipsw_archive_t archive, const vector<string_view>& filenames);
+
+/**
+ Downloads just the start of each file ahead of time for a remote IPSW, enough for ipsw_view_file_head with the same max_size. Does nothing for local IPSWs
+ @param archive The IPSW archive
+ @param filenames The names of the files
+ @param max_size The most bytes of each file that will be read
+ */
+void ipsw_advise_file_heads(ipsw_archive_t archive, const vector<string_view>& filenames, size_t max_size);
+
+/**
+ Checks whether one archive handle can be used by several threads at once
+ @param archive The IPSW archive
+ @return True if the handle can be shared between threads
+ */
+bool ipsw_is_thread_safe(ipsw_archive_t archive);
+
+typedef enum {
+    MANIFEST_PARSER_STREAMING = 0,
+    MANIFEST_PARSER_DOM       = 1
+} manifest_parser_t;
+
+/**
+ Loads BuildManifest.plist (or BuildManifesto.plist on older models) into memory
+ @param archive The IPSW archive
+ @param buffer Pointer to a return buffer, which must be freed
+ @param size Pointer to a return size
+ @return ile_error_t error code
+ */
+ile_error_t load_build_manifest_file(ipsw_archive_t archive, char** buffer, size_t* size);
+
+/**
+ Parses the contents of a build manifest for the device info and component paths with a specific parser. The streaming parser only reads what's needed, the DOM parser builds the whole plist with libplist
+ @param buffer The build manifest's contents, XML or binary
+ @param size The size of the contents
+ @param parser Which parser to use
+ @param build_manifest Pointer to the build manifest structure that will be populated with the parsed data
+ @return ile_error_t error code
+ */
+ile_error_t parse_build_manifest_buffer(const char* buffer, size_t size, manifest_parser_t parser, build_manifest_t* build_manifest);
+
+/**
+ Parses a build manifest for the device info and component paths without looking up any keys. The result is taken from the IPSW's index sidecar when there is one, and stored in it otherwise
+ @param archive The IPSW archive
+ @param build_manifest Pointer to the build manifest structure that will be populated with the parsed data
+ @return ile_error_t error code
+ */
+ile_error_t parse_build_manifest_info(ipsw_archive_t archive, build_manifest_t* build_manifest);
+
+/**
+ Parses a build manifest to get info required for a wikiproxy API request and gets useful info about paths, then appends the keys for it
  @param archive The IPSW archive
  @param build_manifest Pointer to the build manifest structure that will be populated with the parsed data
  @return ile_error_t error code
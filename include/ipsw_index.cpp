@@ -0,0 +1,275 @@
+//
+//  ipsw_index.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <string>
+#include <vector>
+#include "utilities.hpp"
+#include "zip_directory.hpp"
+#include "ipsw_index.hpp"
+
+using namespace std;
+
+/* Sidecars are only ever read back on the machine that wrote them, so values are stored in native byte order */
+static void put_bytes(vector<uint8_t>& out, const void* data, size_t size) {
+    out.insert(out.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+}
+
+template <typename T> static void put_value(vector<uint8_t>& out, T value) {
+    put_bytes(out, &value, sizeof(value));
+}
+
+static void put_string(vector<uint8_t>& out, const string& value) {
+    put_value<uint32_t>(out, (uint32_t)value.size());
+    put_bytes(out, value.data(), value.size());
+}
+
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    size_t position;
+} index_reader_t;
+
+static bool get_bytes(index_reader_t* reader, void* out, size_t size) {
+    if (size > reader->size - reader->position) {
+        return false;
+    }
+    memcpy(out, reader->data + reader->position, size);
+    reader->position += size;
+    return true;
+}
+
+template <typename T> static bool get_value(index_reader_t* reader, T* value) {
+    return get_bytes(reader, value, sizeof(T));
+}
+
+static bool get_string(index_reader_t* reader, string* value) {
+    uint32_t size = 0;
+    if (!get_value(reader, &size) || size > reader->size - reader->position) {
+        return false;
+    }
+    value->assign((const char*)reader->data + reader->position, size);
+    reader->position += size;
+    return true;
+}
+
+ile_error_t ipsw_index_init(const uint8_t* central_directory, zip_central_directory_location_t location, uint64_t file_size, ipsw_index_t* index) {
+    index->path         = NULL;
+    index->has_manifest = false;
+    memset(&index->fingerprint, 0, sizeof(index->fingerprint));
+    index->fingerprint.file_size                = file_size;
+    index->fingerprint.central_directory_offset = location.offset;
+    index->fingerprint.central_directory_size   = location.size;
+    
+    /* Hash the central directory */
+    unsigned int hash_size = 0;
+    if (!EVP_Digest(central_directory, location.size, index->fingerprint.central_directory_hash, &hash_size, EVP_sha256(), NULL)) {
+        return ILE_E_THIRD_PARTY_ERROR;
+    }
+    
+    /* The sidecar is named after the hash so renamed or copied IPSWs still hit */
+    char* cache_dir_path = NULL;
+    ile_error_t ret = get_cache_dir("index", &cache_dir_path);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    char hash_string[sizeof(index->fingerprint.central_directory_hash) * 2 + 1];
+    for (size_t i = 0; i < sizeof(index->fingerprint.central_directory_hash); i++) {
+        snprintf(&hash_string[i * 2], 3, "%02x", index->fingerprint.central_directory_hash[i]);
+    }
+    asprintf(&index->path, "%s/%s.idx", cache_dir_path, hash_string);
+    free(cache_dir_path);
+    if (!index->path) {
+        return ILE_E_OUT_OF_MEMORY;
+    }
+    
+    return ILE_SUCCESS;
+}
+
+ile_error_t ipsw_index_load(ipsw_index_t* index, zip_directory_t* directory) {
+    if (!index->path) {
+        return ILE_E_CACHE_MISS;
+    }
+    
+    /* Read the whole sidecar */
+    FILE* fp = fopen(index->path, "rb");
+    if (!fp) {
+        return ILE_E_CACHE_MISS;
+    }
+    vector<uint8_t> contents;
+    uint8_t chunk[0x10000];
+    size_t read_size = 0;
+    while ((read_size = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        contents.insert(contents.end(), chunk, chunk + read_size);
+    }
+    fclose(fp);
+    index_reader_t reader = { contents.data(), contents.size(), 0 };
+    
+    /* Check the header and fingerprint */
+    char magic[8];
+    uint32_t version = 0;
+    ipsw_fingerprint_t fingerprint;
+    if (!get_bytes(&reader, magic, sizeof(magic)) || memcmp(magic, IPSW_INDEX_MAGIC, sizeof(magic)) != 0 ||
+        !get_value(&reader, &version) || version != IPSW_INDEX_VERSION ||
+        !get_value(&reader, &fingerprint) || memcmp(&fingerprint, &index->fingerprint, sizeof(fingerprint)) != 0) {
+        return ILE_E_CACHE_MISS;
+    }
+    
+    /* Entries */
+    uint64_t entry_count = 0;
+    if (!get_value(&reader, &entry_count)) {
+        return ILE_E_CACHE_MISS;
+    }
+    zip_directory_t loaded;
+    loaded.file_size                = fingerprint.file_size;
+    loaded.central_directory_offset = fingerprint.central_directory_offset;
+    loaded.central_directory_size   = fingerprint.central_directory_size;
+    loaded.entries.reserve(entry_count);
+    loaded.name_index.reserve(entry_count);
+    for (uint64_t i = 0; i < entry_count; i++) {
+        zip_directory_entry_t entry;
+        if (!get_string(&reader, &entry.name) ||
+            !get_value(&reader, &entry.local_header_offset) ||
+            !get_value(&reader, &entry.data_offset) ||
+            !get_value(&reader, &entry.compressed_size) ||
+            !get_value(&reader, &entry.uncompressed_size) ||
+            !get_value(&reader, &entry.crc32) ||
+            !get_value(&reader, &entry.compression_method) ||
+            !get_value(&reader, &entry.flags)) {
+            return ILE_E_CACHE_MISS;
+        }
+        zip_directory_add(&loaded, entry);
+    }
+    
+    /* Parsed manifest table */
+    uint8_t has_manifest = 0;
+    ipsw_manifest_table_t manifest;
+    if (!get_value(&reader, &has_manifest)) {
+        return ILE_E_CACHE_MISS;
+    }
+    if (has_manifest) {
+        uint32_t file_count = 0;
+        if (!get_string(&reader, &manifest.product_type) ||
+            !get_string(&reader, &manifest.device_class) ||
+            !get_string(&reader, &manifest.product_build_version) ||
+            !get_value(&reader, &file_count)) {
+            return ILE_E_CACHE_MISS;
+        }
+        manifest.paths.resize(file_count);
+        manifest.manifest_component_names.resize(file_count);
+        manifest.digests.resize(file_count);
+        for (uint32_t i = 0; i < file_count; i++) {
+            if (!get_string(&reader, &manifest.paths[i]) || !get_string(&reader, &manifest.manifest_component_names[i]) || !get_string(&reader, &manifest.digests[i])) {
+                return ILE_E_CACHE_MISS;
+            }
+        }
+        
+        /* Identities refer to the files above by index */
+        uint32_t identity_count = 0;
+        if (!get_value(&reader, &identity_count) || identity_count > reader.size - reader.position) {
+            return ILE_E_CACHE_MISS;
+        }
+        manifest.identities.resize(identity_count);
+        for (uint32_t i = 0; i < identity_count; i++) {
+            ipsw_manifest_identity_t& identity = manifest.identities[i];
+            uint32_t component_count = 0;
+            if (!get_string(&reader, &identity.device_class) || !get_value(&reader, &component_count) || component_count > reader.size - reader.position) {
+                return ILE_E_CACHE_MISS;
+            }
+            identity.files.resize(component_count);
+            identity.component_names.resize(component_count);
+            for (uint32_t j = 0; j < component_count; j++) {
+                if (!get_value(&reader, &identity.files[j]) || identity.files[j] >= file_count || !get_string(&reader, &identity.component_names[j])) {
+                    return ILE_E_CACHE_MISS;
+                }
+            }
+        }
+    }
+    
+    /* Only hand anything over once the whole sidecar checked out */
+    *directory             = move(loaded);
+    index->has_manifest    = has_manifest != 0;
+    index->manifest        = move(manifest);
+    return ILE_SUCCESS;
+}
+
+ile_error_t ipsw_index_save(const ipsw_index_t& index, const zip_directory_t& directory) {
+    if (!index.path) {
+        return ILE_E_CACHE_UNAVAILABLE;
+    }
+    
+    /* Serialize */
+    vector<uint8_t> out;
+    put_bytes(out, IPSW_INDEX_MAGIC, 8);
+    put_value<uint32_t>(out, IPSW_INDEX_VERSION);
+    put_value(out, index.fingerprint);
+    put_value<uint64_t>(out, directory.entries.size());
+    for (size_t i = 0; i < directory.entries.size(); i++) {
+        const zip_directory_entry_t& entry = directory.entries[i];
+        put_string(out, entry.name);
+        put_value(out, entry.local_header_offset);
+        put_value(out, entry.data_offset);
+        put_value(out, entry.compressed_size);
+        put_value(out, entry.uncompressed_size);
+        put_value(out, entry.crc32);
+        put_value(out, entry.compression_method);
+        put_value(out, entry.flags);
+    }
+    put_value<uint8_t>(out, index.has_manifest ? 1 : 0);
+    if (index.has_manifest) {
+        put_string(out, index.manifest.product_type);
+        put_string(out, index.manifest.device_class);
+        put_string(out, index.manifest.product_build_version);
+        put_value<uint32_t>(out, (uint32_t)index.manifest.paths.size());
+        for (size_t i = 0; i < index.manifest.paths.size(); i++) {
+            put_string(out, index.manifest.paths[i]);
+            put_string(out, index.manifest.manifest_component_names[i]);
+            put_string(out, index.manifest.digests[i]);
+        }
+        put_value<uint32_t>(out, (uint32_t)index.manifest.identities.size());
+        for (size_t i = 0; i < index.manifest.identities.size(); i++) {
+            const ipsw_manifest_identity_t& identity = index.manifest.identities[i];
+            put_string(out, identity.device_class);
+            put_value<uint32_t>(out, (uint32_t)identity.files.size());
+            for (size_t j = 0; j < identity.files.size(); j++) {
+                put_value(out, identity.files[j]);
+                put_string(out, identity.component_names[j]);
+            }
+        }
+    }
+    
+    /* Write to a temporary file and rename it over the sidecar so readers never see a partial one */
+    char* temp_path = NULL;
+    asprintf(&temp_path, "%s.%d.tmp", index.path, (int)getpid());
+    if (!temp_path) {
+        return ILE_E_OUT_OF_MEMORY;
+    }
+    FILE* fp = fopen(temp_path, "wb");
+    if (!fp) {
+        free(temp_path);
+        return ILE_E_FAILED_TO_OPEN_FILE_FOR_WRITING;
+    }
+    const bool written = fwrite(out.data(), 1, out.size(), fp) == out.size();
+    if (fclose(fp) != 0 || !written || rename(temp_path, index.path) != 0) {
+        remove(temp_path);
+        free(temp_path);
+        return ILE_E_FAILED_TO_OPEN_FILE_FOR_WRITING;
+    }
+    
+    free(temp_path);
+    return ILE_SUCCESS;
+}
+
+void ipsw_index_free(ipsw_index_t* index) {
+    free(index->path);
+    index->path = NULL;
+    index->has_manifest = false;
+    index->manifest = ipsw_manifest_table_t();
+}
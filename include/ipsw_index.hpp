@@ -0,0 +1,89 @@
+//
+//  ipsw_index.hpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#ifndef ipsw_index_hpp
+#define ipsw_index_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "utilities.hpp"
+#include "zip_directory.hpp"
+
+using namespace std;
+
+#define IPSW_INDEX_MAGIC   "ILEIDX01"
+#define IPSW_INDEX_VERSION 5
+
+/* The modification time is left out, copying an IPSW changes it and the central directory hash already tells archives apart */
+typedef struct {
+    uint64_t file_size;
+    uint64_t central_directory_offset;
+    uint64_t central_directory_size;
+    uint8_t central_directory_hash[32];
+} ipsw_fingerprint_t;
+
+typedef struct {
+    string device_class;
+    vector<uint32_t> files;
+    vector<string> component_names;
+} ipsw_manifest_identity_t;
+
+typedef struct {
+    string product_type;
+    string device_class;
+    string product_build_version;
+    vector<string> paths;
+    vector<string> manifest_component_names;
+    vector<string> digests;
+    vector<ipsw_manifest_identity_t> identities;
+} ipsw_manifest_table_t;
+
+typedef struct {
+    /* Path to the sidecar in the cache, named after the central directory hash */
+    char* path;
+    ipsw_fingerprint_t fingerprint;
+    
+    /* Filled in by ipsw_index_load on a warm run, or by parse_build_manifest on a cold one */
+    bool has_manifest;
+    ipsw_manifest_table_t manifest;
+} ipsw_index_t;
+
+/**
+ Fingerprints an IPSW by its size and a SHA-256 of its central directory
+ @param central_directory The central directory's bytes
+ @param location Where the central directory is in the IPSW
+ @param file_size The size of the IPSW
+ @param index Pointer to the index, whose fingerprint and sidecar path are set
+ @return ile_error_t error code
+ */
+ile_error_t ipsw_index_init(const uint8_t* central_directory, zip_central_directory_location_t location, uint64_t file_size, ipsw_index_t* index);
+
+/**
+ Loads the directory and parsed manifest from the index sidecar if it matches the fingerprint
+ @param index Pointer to the index
+ @param directory Pointer to the directory to populate
+ @return ile_error_t error code, ILE_E_CACHE_MISS if there is no matching sidecar
+ */
+ile_error_t ipsw_index_load(ipsw_index_t* index, zip_directory_t* directory);
+
+/**
+ Writes the directory and parsed manifest out to the index sidecar
+ @param index The index
+ @param directory The directory
+ @return ile_error_t error code
+ */
+ile_error_t ipsw_index_save(const ipsw_index_t& index, const zip_directory_t& directory);
+
+/**
+ Releases an index
+ @param index Pointer to the index
+ */
+void ipsw_index_free(ipsw_index_t* index);
+
+#endif /* ipsw_index_hpp */
@@ -0,0 +1,299 @@
+//
+//  key_cache.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include "utilities.hpp"
+#include "key_cache.hpp"
+
+using namespace std;
+
+#define KEY_CACHE_FLAG_NEGATIVE 0x1
+
+/*
+ Every file is a fixed header, a fixed size record per image pointing into a string blob, then the blob itself.
+ Values are in native byte order since the cache never leaves the machine that wrote it
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    int64_t fetched_at;
+    uint32_t record_count;
+    uint32_t blob_size;
+} key_cache_header_t;
+
+typedef struct {
+    uint32_t image_offset;
+    uint32_t image_size;
+    uint32_t iv_offset;
+    uint32_t iv_size;
+    uint32_t key_offset;
+    uint32_t key_size;
+} key_cache_record_t;
+
+void key_table_add(key_table_t* table, key_record_t record) {
+    vector<size_t>& indices = table->image_index[record.image];
+    for (size_t i = 0; i < indices.size(); i++) {
+        const key_record_t& existing = table->records[indices[i]];
+        if (existing.iv == record.iv && existing.key == record.key) {
+            return;
+        }
+    }
+    
+    hex_decode(record.iv.c_str(),  &record.iv_bytes);
+    hex_decode(record.key.c_str(), &record.key_bytes);
+    indices.push_back(table->records.size());
+    table->records.push_back(move(record));
+}
+
+void key_table_merge(key_table_t* table, const key_table_t& other) {
+    for (size_t i = 0; i < other.records.size(); i++) {
+        key_table_add(table, other.records[i]);
+    }
+}
+
+vector<const key_record_t*> key_table_find(const key_table_t& table, const char* image) {
+    vector<const key_record_t*> records;
+    auto it = table.image_index.find(image);
+    if (it != table.image_index.end()) {
+        for (size_t i = 0; i < it->second.size(); i++) {
+            records.push_back(&table.records[it->second[i]]);
+        }
+    }
+    
+    return records;
+}
+
+static int64_t ttl_from_env(const char* name, int64_t fallback) {
+    const char* value = getenv(name);
+    if (!value || !*value) {
+        return fallback;
+    }
+    
+    char* end = NULL;
+    const long long ttl = strtoll(value, &end, 10);
+    return (end && *end == '\0' && ttl >= 0) ? (int64_t)ttl : fallback;
+}
+
+static ile_error_t key_cache_path(const char* product_type, const char* device_class, const char* product_build_version, const char* extension, char** path) {
+    char* cache_dir_path = NULL;
+    ile_error_t ret = get_cache_dir("keys", &cache_dir_path);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    /* One file per build, with anything that can't go in a file name replaced */
+    string name = string(product_type) + "_" + device_class + "_" + product_build_version;
+    for (size_t i = 0; i < name.size(); i++) {
+        const char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == ',' || c == '.' || c == '-' || c == '_')) {
+            name[i] = '_';
+        }
+    }
+    asprintf(path, "%s/%s.%s", cache_dir_path, name.c_str(), extension);
+    free(cache_dir_path);
+    if (!*path) {
+        return ILE_E_OUT_OF_MEMORY;
+    }
+    
+    return ILE_SUCCESS;
+}
+
+static bool blob_range_valid(const key_cache_header_t* header, uint32_t offset, uint32_t size) {
+    return offset <= header->blob_size && size <= header->blob_size - offset;
+}
+
+ile_error_t key_cache_lookup(const char* product_type, const char* device_class, const char* product_build_version, key_table_t* table) {
+    char* path = NULL;
+    ile_error_t ret = key_cache_path(product_type, device_class, product_build_version, "keys", &path);
+    if (ret != ILE_SUCCESS) {
+        return ILE_E_CACHE_MISS;
+    }
+    
+    /* Map the file and read the table straight out of it */
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) {
+        return ILE_E_CACHE_MISS;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(key_cache_header_t)) {
+        close(fd);
+        return ILE_E_CACHE_MISS;
+    }
+    void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return ILE_E_CACHE_MISS;
+    }
+    const size_t size = (size_t)st.st_size;
+    
+    /* Check the header and that the entry is still fresh */
+    key_cache_header_t header;
+    memcpy(&header, base, sizeof(header));
+    const bool negative = (header.flags & KEY_CACHE_FLAG_NEGATIVE) != 0;
+    const int64_t ttl   = negative ? ttl_from_env("ILE_KEY_CACHE_NEGATIVE_TTL", KEY_CACHE_DEFAULT_NEGATIVE_TTL) : ttl_from_env("ILE_KEY_CACHE_TTL", KEY_CACHE_DEFAULT_TTL);
+    const int64_t age   = (int64_t)time(NULL) - header.fetched_at;
+    const uint64_t expected_size = sizeof(header) + (uint64_t)header.record_count * sizeof(key_cache_record_t) + header.blob_size;
+    if (memcmp(header.magic, KEY_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != KEY_CACHE_VERSION ||
+        expected_size != size || age < 0 || age >= ttl) {
+        munmap(base, size);
+        return ILE_E_CACHE_MISS;
+    }
+    
+    /* Records */
+    const uint8_t* records = (const uint8_t*)base + sizeof(header);
+    const char* blob       = (const char*)records + (size_t)header.record_count * sizeof(key_cache_record_t);
+    key_table_t loaded;
+    loaded.records.reserve(header.record_count);
+    for (uint32_t i = 0; i < header.record_count; i++) {
+        key_cache_record_t record;
+        memcpy(&record, records + (size_t)i * sizeof(record), sizeof(record));
+        if (!blob_range_valid(&header, record.image_offset, record.image_size) ||
+            !blob_range_valid(&header, record.iv_offset, record.iv_size) ||
+            !blob_range_valid(&header, record.key_offset, record.key_size)) {
+            munmap(base, size);
+            return ILE_E_CACHE_MISS;
+        }
+        key_record_t loaded_record;
+        loaded_record.image.assign(blob + record.image_offset, record.image_size);
+        loaded_record.iv.assign(blob + record.iv_offset,       record.iv_size);
+        loaded_record.key.assign(blob + record.key_offset,     record.key_size);
+        loaded_record.source = KEY_SOURCE_CACHE;
+        key_table_add(&loaded, loaded_record);
+    }
+    munmap(base, size);
+    
+    *table = move(loaded);
+    return ILE_SUCCESS;
+}
+
+static uint32_t append_to_blob(string& blob, const string& value) {
+    const uint32_t offset = (uint32_t)blob.size();
+    blob += value;
+    return offset;
+}
+
+ile_error_t key_cache_store(const char* product_type, const char* device_class, const char* product_build_version, const key_table_t& table) {
+    /* Don't bother writing entries that would never be used */
+    const bool negative = table.records.empty();
+    if ((negative ? ttl_from_env("ILE_KEY_CACHE_NEGATIVE_TTL", KEY_CACHE_DEFAULT_NEGATIVE_TTL) : ttl_from_env("ILE_KEY_CACHE_TTL", KEY_CACHE_DEFAULT_TTL)) == 0) {
+        return ILE_SUCCESS;
+    }
+    
+    char* path = NULL;
+    ile_error_t ret = key_cache_path(product_type, device_class, product_build_version, "keys", &path);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    /* Serialize */
+    key_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, KEY_CACHE_MAGIC, sizeof(header.magic));
+    header.version      = KEY_CACHE_VERSION;
+    header.flags        = negative ? KEY_CACHE_FLAG_NEGATIVE : 0;
+    header.fetched_at   = (int64_t)time(NULL);
+    header.record_count = (uint32_t)table.records.size();
+    vector<key_cache_record_t> records(table.records.size());
+    string blob;
+    for (size_t i = 0; i < table.records.size(); i++) {
+        records[i].image_size   = (uint32_t)table.records[i].image.size();
+        records[i].image_offset = append_to_blob(blob, table.records[i].image);
+        records[i].iv_size      = (uint32_t)table.records[i].iv.size();
+        records[i].iv_offset    = append_to_blob(blob, table.records[i].iv);
+        records[i].key_size     = (uint32_t)table.records[i].key.size();
+        records[i].key_offset   = append_to_blob(blob, table.records[i].key);
+    }
+    header.blob_size = (uint32_t)blob.size();
+    
+    /* Write to a temporary file and rename it into place so a concurrent lookup never sees a partial one */
+    char* temp_path = NULL;
+    asprintf(&temp_path, "%s.%d.tmp", path, (int)getpid());
+    if (!temp_path) {
+        free(path);
+        return ILE_E_OUT_OF_MEMORY;
+    }
+    FILE* fp = fopen(temp_path, "wb");
+    if (!fp) {
+        free(temp_path);
+        free(path);
+        return ILE_E_FAILED_TO_OPEN_FILE_FOR_WRITING;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, fp) == 1;
+    written = written && (records.empty() || fwrite(records.data(), sizeof(key_cache_record_t), records.size(), fp) == records.size());
+    written = written && (blob.empty() || fwrite(blob.data(), 1, blob.size(), fp) == blob.size());
+    if (fclose(fp) != 0 || !written || rename(temp_path, path) != 0) {
+        remove(temp_path);
+        free(temp_path);
+        free(path);
+        return ILE_E_FAILED_TO_OPEN_FILE_FOR_WRITING;
+    }
+    
+    free(temp_path);
+    free(path);
+    return ILE_SUCCESS;
+}
+
+ile_error_t key_cache_remove(const char* product_type, const char* device_class, const char* product_build_version) {
+    char* path = NULL;
+    ile_error_t ret = key_cache_path(product_type, device_class, product_build_version, "keys", &path);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    ret = (unlink(path) == 0 || errno == ENOENT) ? ILE_SUCCESS : ILE_E_FAILED_TO_OPEN_FILE_FOR_WRITING;
+    free(path);
+    return ret;
+}
+
+ile_error_t key_cache_lock(const char* product_type, const char* device_class, const char* product_build_version, bool wait, int* fd) {
+    *fd = -1;
+    char* path = NULL;
+    ile_error_t ret = key_cache_path(product_type, device_class, product_build_version, "lock", &path);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    /* The lock file is left behind, removing it would let a process lock a file another one just unlinked */
+    int lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    free(path);
+    if (lock_fd < 0) {
+        return ILE_E_CACHE_UNAVAILABLE;
+    }
+    int rc = 0;
+    while ((rc = flock(lock_fd, wait ? LOCK_EX : (LOCK_EX | LOCK_NB))) != 0 && errno == EINTR) {
+        continue;
+    }
+    if (rc != 0) {
+        const bool busy = (errno == EWOULDBLOCK);
+        close(lock_fd);
+        return busy ? ILE_E_CACHE_LOCKED : ILE_E_CACHE_UNAVAILABLE;
+    }
+    
+    *fd = lock_fd;
+    return ILE_SUCCESS;
+}
+
+void key_cache_unlock(int fd) {
+    if (fd < 0) {
+        return;
+    }
+    
+    flock(fd, LOCK_UN);
+    close(fd);
+}
@@ -0,0 +1,117 @@
+//
+//  key_cache.hpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#ifndef key_cache_hpp
+#define key_cache_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "utilities.hpp"
+
+using namespace std;
+
+#define KEY_CACHE_MAGIC   "ILEKEY01"
+#define KEY_CACHE_VERSION 1
+
+/* The source of every record the key cache returns */
+#define KEY_SOURCE_CACHE "key cache"
+
+/* How long entries stay fresh, overridable in seconds with ILE_KEY_CACHE_TTL and ILE_KEY_CACHE_NEGATIVE_TTL (0 turns that kind of entry off) */
+#define KEY_CACHE_DEFAULT_TTL          (30 * 24 * 60 * 60)
+#define KEY_CACHE_DEFAULT_NEGATIVE_TTL (24 * 60 * 60)
+
+typedef struct {
+    string image;
+    string iv;
+    string key;
+    
+    /* Where the record came from (a key file, the key cache, wikiproxy...), for the report. Not saved in the key cache */
+    string source;
+    
+    /* Decoded by key_table_add, empty if the hex wasn't valid */
+    vector<uint8_t> iv_bytes;
+    vector<uint8_t> key_bytes;
+} key_record_t;
+
+/* Keys for one build, the same no matter which shape the wikiproxy response had. An image can have several records when sources disagree */
+typedef struct {
+    vector<key_record_t> records;
+    unordered_map<string, vector<size_t>> image_index;
+} key_table_t;
+
+/**
+ Adds a record to a key table, indexing it by image name and decoding its iv and key. A record with the same iv and key as an earlier one for the image is dropped, any other is kept as another candidate behind the earlier ones
+ @param table Pointer to the table
+ @param record The record
+ */
+void key_table_add(key_table_t* table, key_record_t record);
+
+/**
+ Adds every record of another table, after the table's own
+ @param table Pointer to the table
+ @param other The table to add the records of
+ */
+void key_table_merge(key_table_t* table, const key_table_t& other);
+
+/**
+ Finds the records for an image
+ @param table The table
+ @param image The image name
+ @return The records in the order they were added, empty if the table has no keys for the image
+ */
+vector<const key_record_t*> key_table_find(const key_table_t& table, const char* image);
+
+/**
+ Looks up the keys for a build in the on-disk key cache
+ @param product_type The product type
+ @param device_class The device class
+ @param product_build_version The build version
+ @param table Pointer to the table to populate, which is empty for a cached build without keys
+ @return ile_error_t error code, ILE_E_CACHE_MISS if there is no fresh entry
+ */
+ile_error_t key_cache_lookup(const char* product_type, const char* device_class, const char* product_build_version, key_table_t* table);
+
+/**
+ Stores the keys for a build in the on-disk key cache. An empty table is stored as a negative entry
+ @param product_type The product type
+ @param device_class The device class
+ @param product_build_version The build version
+ @param table The keys
+ @return ile_error_t error code
+ */
+ile_error_t key_cache_store(const char* product_type, const char* device_class, const char* product_build_version, const key_table_t& table);
+
+/**
+ Removes the entry for a build from the on-disk key cache, for keys that turned out to be wrong
+ @param product_type The product type
+ @param device_class The device class
+ @param product_build_version The build version
+ @return ile_error_t error code, ILE_SUCCESS if there was no entry
+ */
+ile_error_t key_cache_remove(const char* product_type, const char* device_class, const char* product_build_version);
+
+/**
+ Locks a build's lock file in the key cache, so processes that look up the same build at once make one set of requests. Whoever gets the lock second should look in the key cache again before asking the key servers
+ @param product_type The product type
+ @param device_class The device class
+ @param product_build_version The build version
+ @param wait Whether to wait for another process to release the lock
+ @param fd Pointer to the lock, to release with key_cache_unlock. -1 if it wasn't taken
+ @return ile_error_t error code, ILE_E_CACHE_LOCKED if another process has it and wait is false
+ */
+ile_error_t key_cache_lock(const char* product_type, const char* device_class, const char* product_build_version, bool wait, int* fd);
+
+/**
+ Releases a lock taken with key_cache_lock
+ @param fd The lock, -1 does nothing
+ */
+void key_cache_unlock(int fd);
+
+#endif /* key_cache_hpp */
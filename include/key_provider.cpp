@@ -0,0 +1,188 @@
+//
+//  key_provider.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <plist/plist.h>
+#include "utilities.hpp"
+#include "api.hpp"
+#include "key_provider.hpp"
+
+using namespace std;
+
+/* The key file is kept parsed for the whole run since standard input can only be read once */
+static plist_t key_file_root = NULL;
+static string key_file_source;
+static string key_dir;
+
+static bool read_stream(FILE* fp, string* contents) {
+    char chunk[0x4000];
+    size_t read_size = 0;
+    while ((read_size = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        contents->append(chunk, read_size);
+    }
+    
+    return !ferror(fp);
+}
+
+static ile_error_t read_key_file(FILE* fp, plist_t* root_node) {
+    string contents;
+    if (!read_stream(fp, &contents) || contents.empty()) {
+        return ILE_E_FAILED_TO_LOAD_KEY_FILE;
+    }
+    
+    /* Binary and XML plists are told apart from JSON by their first bytes */
+    size_t start = contents.find_first_not_of(" \t\r\n");
+    plist_err_t err = PLIST_ERR_UNKNOWN;
+    if (plist_is_binary(contents.data(), (uint32_t)contents.size())) {
+        err = plist_from_bin(contents.data(), (uint32_t)contents.size(), root_node);
+    } else if (start != string::npos && contents[start] == '<') {
+        err = plist_from_xml(contents.data(), (uint32_t)contents.size(), root_node);
+    } else {
+        err = plist_from_json(contents.data(), (uint32_t)contents.size(), root_node);
+    }
+    if (err != PLIST_ERR_SUCCESS || plist_get_node_type(*root_node) != PLIST_DICT) {
+        plist_free(*root_node);
+        *root_node = NULL;
+        return ILE_E_FAILED_TO_LOAD_KEY_FILE;
+    }
+    
+    return ILE_SUCCESS;
+}
+
+static ile_error_t load_key_file_path(const char* path, plist_t* root_node) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        return ILE_E_FAILED_TO_LOAD_KEY_FILE;
+    }
+    ile_error_t ret = read_key_file(fp, root_node);
+    fclose(fp);
+    
+    return ret;
+}
+
+/* A single response never has a dictionary at the top level, a bundle of them only has dictionaries */
+static plist_t find_build_node(plist_t root_node, const char* product_type, const char* device_class, const char* product_build_version) {
+    bool is_bundle = false;
+    plist_dict_iter iterator = NULL;
+    plist_dict_new_iter(root_node, &iterator);
+    if (!iterator) {
+        return NULL;
+    }
+    const uint32_t ROOT_NODE_SIZE = plist_dict_get_size(root_node);
+    for (uint32_t i = 0; i < ROOT_NODE_SIZE && !is_bundle; i++) {
+        char* key = NULL;
+        plist_t item = NULL;
+        plist_dict_next_item(root_node, iterator, &key, &item);
+        free(key);
+        is_bundle = (plist_get_node_type(item) == PLIST_DICT);
+    }
+    free(iterator);
+    if (!is_bundle) {
+        return root_node;
+    }
+    
+    /* Most specific name first */
+    const string names[] = {
+        string(product_type) + "/" + device_class + "/" + product_build_version,
+        string(product_type) + "/" + product_build_version,
+        string(product_build_version)
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        plist_t node = plist_dict_get_item(root_node, names[i].c_str());
+        if (node && plist_get_node_type(node) == PLIST_DICT) {
+            return node;
+        }
+    }
+    
+    return NULL;
+}
+
+ile_error_t key_providers_configure(const char* key_file_path, const char* key_dir_path) {
+    key_providers_cleanup();
+    
+    if (key_file_path) {
+        const bool from_stdin = !strcmp(key_file_path, KEY_FILE_STDIN);
+        ile_error_t ret = from_stdin ? read_key_file(stdin, &key_file_root) : load_key_file_path(key_file_path, &key_file_root);
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+        key_file_source = from_stdin ? "standard input" : key_file_path;
+    }
+    if (key_dir_path) {
+        key_dir = key_dir_path;
+    }
+    
+    return ILE_SUCCESS;
+}
+
+ile_error_t key_providers_lookup(const char* product_type, const char* device_class, const char* product_build_version, key_table_t* table, string* source) {
+    /* Both are asked, so keys they disagree on can be tried against the files */
+    *table = key_table_t();
+    string sources;
+    
+    /* The key file */
+    if (key_file_root) {
+        plist_t node = find_build_node(key_file_root, product_type, device_class, product_build_version);
+        key_table_t file_table;
+        if (node && parse_key_node(node, key_file_source.c_str(), &file_table) == ILE_SUCCESS) {
+            key_table_merge(table, file_table);
+            sources = key_file_source;
+        }
+    }
+    
+    /* The key folder, with the same names as the key file uses but flattened into file names. The most specific file wins */
+    bool found_in_dir = false;
+    if (!key_dir.empty()) {
+        const string names[] = {
+            string(product_type) + "_" + device_class + "_" + product_build_version,
+            string(product_type) + "_" + product_build_version,
+            string(product_build_version)
+        };
+        const char* extensions[] = { ".json", ".plist" };
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]) && !found_in_dir; i++) {
+            for (size_t j = 0; j < sizeof(extensions) / sizeof(extensions[0]) && !found_in_dir; j++) {
+                const string path = key_dir + "/" + names[i] + extensions[j];
+                if (access(path.c_str(), R_OK) != 0) {
+                    continue;
+                }
+                
+                plist_t root_node = NULL;
+                if (load_key_file_path(path.c_str(), &root_node) != ILE_SUCCESS) {
+                    log_message(WARNING, "Skipping a key file in the key folder that isn't a JSON or plist of keys");
+                    continue;
+                }
+                plist_t node = find_build_node(root_node, product_type, device_class, product_build_version);
+                key_table_t dir_table;
+                ile_error_t ret = node ? parse_key_node(node, path.c_str(), &dir_table) : ILE_E_KEYS_NOT_FOUND;
+                plist_free(root_node);
+                if (ret == ILE_SUCCESS) {
+                    key_table_merge(table, dir_table);
+                    sources += sources.empty() ? path : " and " + path;
+                    found_in_dir = true;
+                }
+            }
+        }
+    }
+    if (sources.empty()) {
+        return ILE_E_KEYS_NOT_FOUND;
+    }
+    
+    if (source) {
+        *source = sources;
+    }
+    return ILE_SUCCESS;
+}
+
+void key_providers_cleanup(void) {
+    plist_free(key_file_root);
+    key_file_root = NULL;
+    key_file_source.clear();
+    key_dir.clear();
+}
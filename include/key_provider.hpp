@@ -0,0 +1,45 @@
+//
+//  key_provider.hpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#ifndef key_provider_hpp
+#define key_provider_hpp
+
+#include <stdio.h>
+#include <string>
+#include "utilities.hpp"
+#include "key_cache.hpp"
+
+using namespace std;
+
+/* Read the key file from standard input instead of a path */
+#define KEY_FILE_STDIN "-"
+
+/**
+ Sets up the local key sources, which are asked before the key cache and wikiproxy. The key file is read right away so standard input is only consumed once
+ @param key_file_path A JSON or plist of keys, KEY_FILE_STDIN to read one from standard input, or NULL for none
+ @param key_dir_path A folder of per-build JSON or plist key files, or NULL for none
+ @return ile_error_t error code, ILE_E_FAILED_TO_LOAD_KEY_FILE if the key file can't be used
+ */
+ile_error_t key_providers_configure(const char* key_file_path, const char* key_dir_path);
+
+/**
+ Looks up the keys for a build in the key file and the key folder, with the key file's records ahead of the folder's where both have keys for an image. A key file is either one key response that applies to every build, or a dictionary of them named <ProductType>/<DeviceClass>/<Build>, <ProductType>/<Build> or <Build>. The folder has one response per build in <ProductType>_<DeviceClass>_<Build>, <ProductType>_<Build> or <Build>, ending in .json or .plist
+ @param product_type The product type
+ @param device_class The device class
+ @param product_build_version The build version
+ @param table Pointer to the table to populate, whose records name the file they came from
+ @param source Pointer to a return description of where the keys came from, can be NULL
+ @return ile_error_t error code, ILE_E_KEYS_NOT_FOUND if no local source has the build
+ */
+ile_error_t key_providers_lookup(const char* product_type, const char* device_class, const char* product_build_version, key_table_t* table, string* source);
+
+/**
+ Releases the loaded key file
+ */
+void key_providers_cleanup(void);
+
+#endif /* key_provider_hpp */
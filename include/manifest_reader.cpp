@@ -0,0 +1,927 @@
+//
+//  manifest_reader.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include "utilities.hpp"
+#include "manifest_reader.hpp"
+
+using namespace std;
+
+#define BPLIST_MAGIC        "bplist00"
+#define BPLIST_TRAILER_SIZE 32
+
+/* Object types, from the high nibble of an object's marker byte */
+#define BPLIST_TYPE_DATA         0x4
+#define BPLIST_TYPE_ASCII_STRING 0x5
+#define BPLIST_TYPE_UTF16_STRING 0x6
+#define BPLIST_TYPE_ARRAY        0xA
+#define BPLIST_TYPE_DICT         0xD
+
+typedef struct {
+    string name;
+    string path;
+
+    /* Hex, empty if the component doesn't have a Digest */
+    string digest;
+} pending_component_t;
+
+typedef struct {
+    manifest_reader_handler_t handler;
+    bool found_fields[MANIFEST_FIELD_COUNT];
+    bool found_identities;
+    uint32_t identities_seen;
+    uint32_t identities_reported;
+
+    /* The identity being read. XML can list its Manifest before its Info, so components are held until the identity ends */
+    bool has_device_class;
+    string device_class;
+    vector<pending_component_t> pending_components;
+
+    /* Reused for every key and string so reading doesn't allocate once they've grown */
+    string key;
+    string name;
+    string value;
+} manifest_read_state_t;
+
+static void report_field(manifest_read_state_t* state, manifest_field_t field, const string& value) {
+    if (state->found_fields[field]) {
+        return;
+    }
+
+    state->found_fields[field] = true;
+    state->handler.field(state->handler.context, field, value.c_str());
+}
+
+static void begin_identity(manifest_read_state_t* state) {
+    state->has_device_class = false;
+    state->pending_components.clear();
+}
+
+/* Hands the identity that was just read to the handler. Only the first identity has to be complete, later ones are skipped if they aren't */
+static ile_error_t report_identity(manifest_read_state_t* state, bool has_manifest) {
+    const bool first = (state->identities_seen++ == 0);
+    if (!state->has_device_class || !has_manifest) {
+        return first ? ILE_E_PLIST_OBJECT_NOT_FOUND : ILE_SUCCESS;
+    }
+
+    state->handler.identity(state->handler.context, state->device_class.c_str());
+    for (size_t i = 0; i < state->pending_components.size(); i++) {
+        const pending_component_t& component = state->pending_components[i];
+        state->handler.component(state->handler.context, component.name.c_str(), component.path.c_str(), component.digest.c_str());
+    }
+    state->identities_reported++;
+    return ILE_SUCCESS;
+}
+
+static void append_utf8(string* out, uint32_t codepoint) {
+    if (codepoint < 0x80) {
+        out->push_back((char)codepoint);
+    } else if (codepoint < 0x800) {
+        out->push_back((char)(0xC0 | (codepoint >> 6)));
+        out->push_back((char)(0x80 | (codepoint & 0x3F)));
+    } else if (codepoint < 0x10000) {
+        out->push_back((char)(0xE0 | (codepoint >> 12)));
+        out->push_back((char)(0x80 | ((codepoint >> 6) & 0x3F)));
+        out->push_back((char)(0x80 | (codepoint & 0x3F)));
+    } else {
+        out->push_back((char)(0xF0 | (codepoint >> 18)));
+        out->push_back((char)(0x80 | ((codepoint >> 12) & 0x3F)));
+        out->push_back((char)(0x80 | ((codepoint >> 6) & 0x3F)));
+        out->push_back((char)(0x80 | (codepoint & 0x3F)));
+    }
+}
+
+/* XML */
+
+static int base64_value(char c) {
+    if (c >= 'A' && c <= 'Z') {
+        return c - 'A';
+    } else if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 26;
+    } else if (c >= '0' && c <= '9') {
+        return c - '0' + 52;
+    } else if (c == '+') {
+        return 62;
+    } else if (c == '/') {
+        return 63;
+    }
+    return -1;
+}
+
+/* <data> is base64, wrapped over several lines */
+static bool base64_to_hex(const string& text, string* hex) {
+    vector<uint8_t> bytes;
+    uint32_t bits = 0;
+    int bit_count = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        const char c = text[i];
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            continue;
+        }
+        if (c == '=') {
+            break;
+        }
+        const int value = base64_value(c);
+        if (value < 0) {
+            return false;
+        }
+        bits = (bits << 6) | (uint32_t)value;
+        bit_count += 6;
+        if (bit_count >= 8) {
+            bit_count -= 8;
+            bytes.push_back((uint8_t)(bits >> bit_count));
+        }
+    }
+
+    *hex = hex_encode(bytes.data(), bytes.size());
+    return true;
+}
+
+typedef struct {
+    const char* p;
+    const char* end;
+} xml_cursor_t;
+
+typedef struct {
+    string_view name;
+    bool closing;
+    bool empty;
+} xml_tag_t;
+
+static bool xml_skip_past(xml_cursor_t* cursor, const char* terminator) {
+    const char* found = (const char*)memmem(cursor->p, (size_t)(cursor->end - cursor->p), terminator, strlen(terminator));
+    if (!found) {
+        return false;
+    }
+
+    cursor->p = found + strlen(terminator);
+    return true;
+}
+
+/* Moves past the next element tag, skipping any text, comments, processing instructions and the doctype before it */
+static bool xml_next_tag(xml_cursor_t* cursor, xml_tag_t* tag) {
+    while (true) {
+        const char* open = (const char*)memchr(cursor->p, '<', (size_t)(cursor->end - cursor->p));
+        if (!open || cursor->end - open < 2) {
+            return false;
+        }
+        cursor->p = open + 1;
+        if (*cursor->p == '?') {
+            if (!xml_skip_past(cursor, "?>")) {
+                return false;
+            }
+            continue;
+        }
+        if (*cursor->p == '!') {
+            /* CDATA never shows up in a manifest, so it's left to libplist */
+            const bool comment = (cursor->end - cursor->p >= 3 && !memcmp(cursor->p, "!--", 3));
+            if ((cursor->end - cursor->p >= 8 && !memcmp(cursor->p, "![CDATA[", 8)) || !xml_skip_past(cursor, comment ? "-->" : ">")) {
+                return false;
+            }
+            continue;
+        }
+
+        /* An element, which ends at the next > since plist elements don't have quoted > in their attributes */
+        tag->closing = (*cursor->p == '/');
+        const char* name = cursor->p + (tag->closing ? 1 : 0);
+        const char* name_end = name;
+        while (name_end < cursor->end && *name_end != '>' && *name_end != '/' && *name_end != ' ' && *name_end != '\t' && *name_end != '\r' && *name_end != '\n') {
+            name_end++;
+        }
+        const char* close = (const char*)memchr(name_end, '>', (size_t)(cursor->end - name_end));
+        if (!close || name_end == name) {
+            return false;
+        }
+        tag->name  = string_view(name, (size_t)(name_end - name));
+        tag->empty = !tag->closing && close[-1] == '/';
+        cursor->p  = close + 1;
+        return true;
+    }
+}
+
+static bool xml_decode_text(const char* text, const char* end, string* out) {
+    out->clear();
+    while (text < end) {
+        const char* amp = (const char*)memchr(text, '&', (size_t)(end - text));
+        if (!amp) {
+            out->append(text, (size_t)(end - text));
+            return true;
+        }
+        out->append(text, (size_t)(amp - text));
+        const char* semicolon = (const char*)memchr(amp, ';', (size_t)(end - amp));
+        if (!semicolon) {
+            return false;
+        }
+        const string_view entity(amp + 1, (size_t)(semicolon - amp - 1));
+        if (entity == "lt") {
+            out->push_back('<');
+        } else if (entity == "gt") {
+            out->push_back('>');
+        } else if (entity == "amp") {
+            out->push_back('&');
+        } else if (entity == "quot") {
+            out->push_back('"');
+        } else if (entity == "apos") {
+            out->push_back('\'');
+        } else if (entity.size() > 1 && entity[0] == '#') {
+            const bool hex = (entity[1] == 'x');
+            const string digits(entity.substr(hex ? 2 : 1));
+            char* digits_end = NULL;
+            const unsigned long codepoint = strtoul(digits.c_str(), &digits_end, hex ? 16 : 10);
+            if (digits.empty() || *digits_end != '\0' || codepoint > 0x10FFFF) {
+                return false;
+            }
+            append_utf8(out, (uint32_t)codepoint);
+        } else {
+            return false;
+        }
+        text = semicolon + 1;
+    }
+
+    return true;
+}
+
+/* Reads the text of an element that was just opened, up to and including its closing tag */
+static bool xml_read_text(xml_cursor_t* cursor, const xml_tag_t& open, string* out) {
+    if (open.empty) {
+        out->clear();
+        return true;
+    }
+
+    const char* text = cursor->p;
+    const char* text_end = (const char*)memchr(text, '<', (size_t)(cursor->end - text));
+    if (!text_end) {
+        return false;
+    }
+    cursor->p = text_end;
+    xml_tag_t close;
+    return xml_decode_text(text, text_end, out) && xml_next_tag(cursor, &close) && close.closing && close.name == open.name;
+}
+
+/* Skips the rest of a dict or array whose opening tag was already read */
+static bool xml_skip_to_close(xml_cursor_t* cursor) {
+    size_t depth = 1;
+    xml_tag_t tag;
+    while (depth) {
+        if (!xml_next_tag(cursor, &tag)) {
+            return false;
+        }
+        if (!tag.empty && (tag.name == "dict" || tag.name == "array")) {
+            depth = tag.closing ? depth - 1 : depth + 1;
+        }
+    }
+
+    return true;
+}
+
+/* Skips a value whose opening tag was already read */
+static bool xml_skip_value(xml_cursor_t* cursor, const xml_tag_t& open) {
+    if (open.empty) {
+        return true;
+    }
+    if (open.name == "dict" || open.name == "array") {
+        return xml_skip_to_close(cursor);
+    }
+
+    /* Scalars can't contain elements, so the next tag closes it. Large data blobs are skipped with a single memchr */
+    xml_tag_t close;
+    return xml_next_tag(cursor, &close) && close.closing && close.name == open.name;
+}
+
+/* Reads the next key of a dict and the opening tag of its value, *done is set instead at the end of the dict */
+static bool xml_next_entry(xml_cursor_t* cursor, string* key, xml_tag_t* value, bool* done) {
+    xml_tag_t tag;
+    if (!xml_next_tag(cursor, &tag)) {
+        return false;
+    }
+    if (tag.closing) {
+        *done = true;
+        return tag.name == "dict";
+    }
+
+    *done = false;
+    return tag.name == "key" && xml_read_text(cursor, tag, key) && xml_next_tag(cursor, value) && !value->closing;
+}
+
+/* Reads a string value into the state's value buffer, anything else is skipped and reported as not being a string */
+static ile_error_t xml_read_string(xml_cursor_t* cursor, const xml_tag_t& open, manifest_read_state_t* state) {
+    if (open.name != "string") {
+        return xml_skip_value(cursor, open) ? ILE_E_FAILED_TO_GET_PLIST_STR_VAL : ILE_E_PLIST_CONVERSION_FAILED;
+    }
+
+    return xml_read_text(cursor, open, &state->value) ? ILE_SUCCESS : ILE_E_PLIST_CONVERSION_FAILED;
+}
+
+/* Gets the first string out of an array and skips the rest */
+static ile_error_t xml_read_first_string(xml_cursor_t* cursor, const xml_tag_t& open, manifest_read_state_t* state, manifest_field_t field) {
+    if (open.name != "array" || open.empty) {
+        return xml_skip_value(cursor, open) ? ILE_SUCCESS : ILE_E_PLIST_CONVERSION_FAILED;
+    }
+
+    xml_tag_t tag;
+    if (!xml_next_tag(cursor, &tag)) {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+    if (tag.closing) {
+        return ILE_SUCCESS;
+    }
+    ile_error_t ret = xml_read_string(cursor, tag, state);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    report_field(state, field, state->value);
+
+    return xml_skip_to_close(cursor) ? ILE_SUCCESS : ILE_E_PLIST_CONVERSION_FAILED;
+}
+
+/* Reads one component of the Manifest dict, reporting it if it has an Info/Path */
+static ile_error_t xml_read_component(xml_cursor_t* cursor, const xml_tag_t& open, manifest_read_state_t* state) {
+    if (open.name != "dict") {
+        return ILE_E_PLIST_OBJECT_NOT_FOUND;
+    }
+    if (open.empty) {
+        return ILE_SUCCESS;
+    }
+
+    /* Digest can come before or after Info, so the component is only kept once its dict ends */
+    pending_component_t component;
+    component.name = state->name;
+    bool has_path  = false;
+    bool done      = false;
+    xml_tag_t value;
+    while (true) {
+        if (!xml_next_entry(cursor, &state->key, &value, &done)) {
+            return ILE_E_PLIST_CONVERSION_FAILED;
+        }
+        if (done) {
+            if (has_path) {
+                state->pending_components.push_back(move(component));
+            }
+            return ILE_SUCCESS;
+        }
+        if (state->key == "Digest" && value.name == "data") {
+            if (!xml_read_text(cursor, value, &state->value) || !base64_to_hex(state->value, &component.digest)) {
+                return ILE_E_PLIST_CONVERSION_FAILED;
+            }
+            continue;
+        }
+        if (state->key != "Info" || value.name != "dict" || value.empty) {
+            if (!xml_skip_value(cursor, value)) {
+                return ILE_E_PLIST_CONVERSION_FAILED;
+            }
+            continue;
+        }
+
+        /* Info */
+        bool info_done = false;
+        xml_tag_t info_value;
+        while (true) {
+            if (!xml_next_entry(cursor, &state->key, &info_value, &info_done)) {
+                return ILE_E_PLIST_CONVERSION_FAILED;
+            }
+            if (info_done) {
+                break;
+            }
+            if (state->key == "Path" && info_value.name == "string") {
+                if (!xml_read_text(cursor, info_value, &component.path)) {
+                    return ILE_E_PLIST_CONVERSION_FAILED;
+                }
+                has_path = true;
+            } else if (!xml_skip_value(cursor, info_value)) {
+                return ILE_E_PLIST_CONVERSION_FAILED;
+            }
+        }
+    }
+}
+
+static ile_error_t xml_read_identity(xml_cursor_t* cursor, manifest_read_state_t* state) {
+    bool done           = false;
+    bool found_manifest = false;
+    xml_tag_t value;
+    begin_identity(state);
+    while (true) {
+        if (!xml_next_entry(cursor, &state->key, &value, &done)) {
+            return ILE_E_PLIST_CONVERSION_FAILED;
+        }
+        if (done) {
+            return report_identity(state, found_manifest);
+        }
+
+        ile_error_t ret = ILE_SUCCESS;
+        if (state->key == "Info" && value.name == "dict" && !value.empty) {
+            /* Only the DeviceClass is needed out of the identity's info */
+            bool info_done = false;
+            xml_tag_t info_value;
+            while (ret == ILE_SUCCESS) {
+                if (!xml_next_entry(cursor, &state->key, &info_value, &info_done)) {
+                    return ILE_E_PLIST_CONVERSION_FAILED;
+                }
+                if (info_done) {
+                    break;
+                }
+                if (state->key == "DeviceClass") {
+                    ret = xml_read_string(cursor, info_value, state);
+                    if (ret == ILE_SUCCESS) {
+                        state->has_device_class = true;
+                        state->device_class     = state->value;
+                    }
+                } else if (!xml_skip_value(cursor, info_value)) {
+                    return ILE_E_PLIST_CONVERSION_FAILED;
+                }
+            }
+        } else if (state->key == "Manifest" && value.name == "dict" && !found_manifest) {
+            /* Every component in order */
+            found_manifest = true;
+            bool manifest_done = value.empty;
+            xml_tag_t component;
+            while (!manifest_done && ret == ILE_SUCCESS) {
+                if (!xml_next_entry(cursor, &state->name, &component, &manifest_done)) {
+                    return ILE_E_PLIST_CONVERSION_FAILED;
+                }
+                if (!manifest_done) {
+                    ret = xml_read_component(cursor, component, state);
+                }
+            }
+        } else if (!xml_skip_value(cursor, value)) {
+            return ILE_E_PLIST_CONVERSION_FAILED;
+        }
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+    }
+}
+
+static ile_error_t xml_read_manifest(const char* buffer, size_t size, manifest_read_state_t* state) {
+    xml_cursor_t cursor = { buffer, buffer + size };
+    xml_tag_t tag;
+    if (!xml_next_tag(&cursor, &tag) || tag.closing || tag.name != "plist") {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+    if (!xml_next_tag(&cursor, &tag) || tag.closing || tag.name != "dict") {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+    if (tag.empty) {
+        return ILE_E_PLIST_OBJECT_NOT_FOUND;
+    }
+
+    bool done = false;
+    xml_tag_t value;
+    while (true) {
+        if (!xml_next_entry(&cursor, &state->key, &value, &done)) {
+            return ILE_E_PLIST_CONVERSION_FAILED;
+        }
+        if (done) {
+            return ILE_SUCCESS;
+        }
+
+        ile_error_t ret = ILE_SUCCESS;
+        if (state->key == "ProductBuildVersion") {
+            ret = xml_read_string(&cursor, value, state);
+            if (ret == ILE_SUCCESS) {
+                report_field(state, MANIFEST_FIELD_PRODUCT_BUILD_VERSION, state->value);
+            }
+        } else if (state->key == "SupportedProductTypes") {
+            ret = xml_read_first_string(&cursor, value, state, MANIFEST_FIELD_PRODUCT_TYPE);
+        } else if (state->key == "BuildIdentities" && value.name == "array" && !value.empty) {
+            /* Every identity, universal IPSWs have at least one per board */
+            state->found_identities = true;
+            xml_tag_t identity;
+            while (ret == ILE_SUCCESS) {
+                if (!xml_next_tag(&cursor, &identity)) {
+                    return ILE_E_PLIST_CONVERSION_FAILED;
+                }
+                if (identity.closing) {
+                    break;
+                }
+                if (identity.name == "dict" && !identity.empty) {
+                    ret = xml_read_identity(&cursor, state);
+                } else if (state->identities_seen++ == 0) {
+                    ret = ILE_E_PLIST_OBJECT_NOT_FOUND;
+                } else if (!xml_skip_value(&cursor, identity)) {
+                    ret = ILE_E_PLIST_CONVERSION_FAILED;
+                }
+            }
+        } else if (!xml_skip_value(&cursor, value)) {
+            ret = ILE_E_PLIST_CONVERSION_FAILED;
+        }
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+
+        /* Nothing after this point would be used */
+        if (state->found_identities && state->found_fields[MANIFEST_FIELD_PRODUCT_BUILD_VERSION] && state->found_fields[MANIFEST_FIELD_PRODUCT_TYPE]) {
+            return ILE_SUCCESS;
+        }
+    }
+}
+
+/* Binary */
+
+typedef struct {
+    const uint8_t* base;
+    uint64_t size;
+    uint8_t offset_size;
+    uint8_t ref_size;
+    uint64_t object_count;
+    uint64_t top_object;
+    uint64_t offset_table_offset;
+} bplist_t;
+
+typedef struct {
+    uint8_t type;
+    uint64_t count;
+
+    /* Where the object's contents start, after its marker and length */
+    uint64_t start;
+} bplist_object_t;
+
+static uint64_t bplist_read_uint(const uint8_t* p, uint8_t size) {
+    uint64_t value = 0;
+    for (uint8_t i = 0; i < size; i++) {
+        value = (value << 8) | p[i];
+    }
+
+    return value;
+}
+
+static bool bplist_open(const char* buffer, size_t size, bplist_t* plist) {
+    if (size < strlen(BPLIST_MAGIC) + BPLIST_TRAILER_SIZE) {
+        return false;
+    }
+
+    /* The trailer says how big offsets and references are and where the offset table is */
+    const uint8_t* trailer = (const uint8_t*)buffer + size - BPLIST_TRAILER_SIZE;
+    plist->base                = (const uint8_t*)buffer;
+    plist->size                = size;
+    plist->offset_size         = trailer[6];
+    plist->ref_size            = trailer[7];
+    plist->object_count        = bplist_read_uint(trailer + 8, 8);
+    plist->top_object          = bplist_read_uint(trailer + 16, 8);
+    plist->offset_table_offset = bplist_read_uint(trailer + 24, 8);
+    const uint64_t table_end   = size - BPLIST_TRAILER_SIZE;
+    return plist->offset_size >= 1 && plist->offset_size <= 8 && plist->ref_size >= 1 && plist->ref_size <= 8 &&
+           plist->offset_table_offset <= table_end && plist->object_count <= (table_end - plist->offset_table_offset) / plist->offset_size &&
+           plist->top_object < plist->object_count;
+}
+
+static bool bplist_object(const bplist_t& plist, uint64_t ref, bplist_object_t* object) {
+    if (ref >= plist.object_count) {
+        return false;
+    }
+    const uint64_t offset = bplist_read_uint(plist.base + plist.offset_table_offset + ref * plist.offset_size, plist.offset_size);
+    if (offset >= plist.offset_table_offset) {
+        return false;
+    }
+
+    /* A length of 0xF means the real one follows as an integer object */
+    const uint8_t marker = plist.base[offset];
+    object->type  = marker >> 4;
+    object->count = marker & 0xF;
+    object->start = offset + 1;
+    if (object->count == 0xF && object->type != 0x0 && object->type != 0x1 && object->type != 0x2 && object->type != 0x3) {
+        if (object->start >= plist.offset_table_offset || (plist.base[object->start] >> 4) != 0x1) {
+            return false;
+        }
+        const uint8_t int_size = (uint8_t)(1 << (plist.base[object->start] & 0xF));
+        if (int_size > 8 || plist.offset_table_offset - object->start - 1 < int_size) {
+            return false;
+        }
+        object->count = bplist_read_uint(plist.base + object->start + 1, int_size);
+        object->start += 1 + int_size;
+    }
+
+    return true;
+}
+
+/* Gets the reference stored at an index of a dict or array's contents, a dict's values come after all of its keys */
+static bool bplist_ref(const bplist_t& plist, const bplist_object_t& container, uint64_t index, uint64_t* ref) {
+    const uint64_t available = plist.offset_table_offset - container.start;
+    if (index >= available / plist.ref_size) {
+        return false;
+    }
+
+    *ref = bplist_read_uint(plist.base + container.start + index * plist.ref_size, plist.ref_size);
+    return true;
+}
+
+static bool bplist_is_container(const bplist_t& plist, const bplist_object_t& object) {
+    const uint64_t refs = (object.type == BPLIST_TYPE_DICT) ? 2 : 1;
+    return (object.type == BPLIST_TYPE_DICT || object.type == BPLIST_TYPE_ARRAY) && object.count <= (plist.offset_table_offset - object.start) / plist.ref_size / refs;
+}
+
+/* Reads a string object, false in *is_string if it's something else */
+static bool bplist_read_string(const bplist_t& plist, uint64_t ref, string* out, bool* is_string) {
+    bplist_object_t object;
+    if (!bplist_object(plist, ref, &object)) {
+        return false;
+    }
+    *is_string = (object.type == BPLIST_TYPE_ASCII_STRING || object.type == BPLIST_TYPE_UTF16_STRING);
+    if (!*is_string) {
+        return true;
+    }
+
+    const uint64_t available = plist.offset_table_offset - object.start;
+    const uint8_t* p = plist.base + object.start;
+    out->clear();
+    if (object.type == BPLIST_TYPE_ASCII_STRING) {
+        if (object.count > available) {
+            return false;
+        }
+        out->assign((const char*)p, (size_t)object.count);
+        return true;
+    }
+
+    /* UTF-16BE, which needs converting */
+    if (object.count > available / 2) {
+        return false;
+    }
+    for (uint64_t i = 0; i < object.count; i++) {
+        uint32_t unit = (uint32_t)bplist_read_uint(p + i * 2, 2);
+        if (unit >= 0xD800 && unit < 0xDC00 && i + 1 < object.count) {
+            const uint32_t low = (uint32_t)bplist_read_uint(p + (i + 1) * 2, 2);
+            if (low >= 0xDC00 && low < 0xE000) {
+                unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                i++;
+            }
+        }
+        append_utf8(out, unit);
+    }
+
+    return true;
+}
+
+/* Finds a key in a dict, *value_ref is set to the object count if it isn't there */
+static bool bplist_dict_find(const bplist_t& plist, const bplist_object_t& dict, const char* key, manifest_read_state_t* state, uint64_t* value_ref) {
+    *value_ref = plist.object_count;
+    for (uint64_t i = 0; i < dict.count; i++) {
+        uint64_t key_ref = 0;
+        bool is_string   = false;
+        if (!bplist_ref(plist, dict, i, &key_ref) || !bplist_read_string(plist, key_ref, &state->key, &is_string)) {
+            return false;
+        }
+        if (is_string && state->key == key) {
+            return bplist_ref(plist, dict, dict.count + i, value_ref);
+        }
+    }
+
+    return true;
+}
+
+/* Looks up a key that should hold a dict, *found is false if it doesn't */
+static bool bplist_dict_find_dict(const bplist_t& plist, const bplist_object_t& dict, const char* key, manifest_read_state_t* state, bplist_object_t* value, bool* found) {
+    uint64_t value_ref = 0;
+    if (!bplist_dict_find(plist, dict, key, state, &value_ref)) {
+        return false;
+    }
+
+    *found = (value_ref < plist.object_count);
+    if (!*found) {
+        return true;
+    }
+    if (!bplist_object(plist, value_ref, value)) {
+        return false;
+    }
+    *found = (value->type == BPLIST_TYPE_DICT);
+    return !*found || bplist_is_container(plist, *value);
+}
+
+/* Reports a string field, which is looked up in a dict or taken from an array's first element */
+static ile_error_t bplist_report_string(const bplist_t& plist, uint64_t ref, manifest_read_state_t* state, manifest_field_t field) {
+    if (ref >= plist.object_count) {
+        return ILE_SUCCESS;
+    }
+
+    bool is_string = false;
+    if (!bplist_read_string(plist, ref, &state->value, &is_string)) {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+    if (!is_string) {
+        return ILE_E_FAILED_TO_GET_PLIST_STR_VAL;
+    }
+    report_field(state, field, state->value);
+    return ILE_SUCCESS;
+}
+
+static ile_error_t bplist_read_components(const bplist_t& plist, const bplist_object_t& manifest, manifest_read_state_t* state) {
+    for (uint64_t i = 0; i < manifest.count; i++) {
+        uint64_t name_ref      = 0;
+        uint64_t component_ref = 0;
+        bool is_string         = false;
+        bplist_object_t component;
+        if (!bplist_ref(plist, manifest, i, &name_ref) || !bplist_ref(plist, manifest, manifest.count + i, &component_ref) ||
+            !bplist_read_string(plist, name_ref, &state->name, &is_string) || !bplist_object(plist, component_ref, &component)) {
+            return ILE_E_PLIST_CONVERSION_FAILED;
+        }
+        if (!is_string || component.type != BPLIST_TYPE_DICT) {
+            return ILE_E_PLIST_OBJECT_NOT_FOUND;
+        }
+        if (!bplist_is_container(plist, component)) {
+            return ILE_E_PLIST_CONVERSION_FAILED;
+        }
+
+        /* Info/Path */
+        bplist_object_t info;
+        bool found = false;
+        if (!bplist_dict_find_dict(plist, component, "Info", state, &info, &found)) {
+            return ILE_E_PLIST_CONVERSION_FAILED;
+        }
+        if (!found) {
+            continue;
+        }
+        uint64_t path_ref = 0;
+        if (!bplist_dict_find(plist, info, "Path", state, &path_ref)) {
+            return ILE_E_PLIST_CONVERSION_FAILED;
+        }
+        if (path_ref >= plist.object_count) {
+            continue;
+        }
+        if (!bplist_read_string(plist, path_ref, &state->value, &is_string)) {
+            return ILE_E_PLIST_CONVERSION_FAILED;
+        }
+        if (!is_string) {
+            continue;
+        }
+
+        /* And its Digest, if it has one */
+        pending_component_t pending;
+        pending.name = state->name;
+        pending.path = state->value;
+        uint64_t digest_ref = 0;
+        bplist_object_t digest;
+        if (!bplist_dict_find(plist, component, "Digest", state, &digest_ref)) {
+            return ILE_E_PLIST_CONVERSION_FAILED;
+        }
+        if (digest_ref < plist.object_count) {
+            if (!bplist_object(plist, digest_ref, &digest)) {
+                return ILE_E_PLIST_CONVERSION_FAILED;
+            }
+            if (digest.type == BPLIST_TYPE_DATA) {
+                if (digest.count > plist.offset_table_offset - digest.start) {
+                    return ILE_E_PLIST_CONVERSION_FAILED;
+                }
+                pending.digest = hex_encode(plist.base + digest.start, (size_t)digest.count);
+            }
+        }
+        state->pending_components.push_back(move(pending));
+    }
+
+    return ILE_SUCCESS;
+}
+
+static ile_error_t bplist_read_identity(const bplist_t& plist, uint64_t ref, manifest_read_state_t* state) {
+    bplist_object_t identity;
+    if (!bplist_object(plist, ref, &identity)) {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+    begin_identity(state);
+    if (identity.type != BPLIST_TYPE_DICT) {
+        return report_identity(state, false);
+    }
+    if (!bplist_is_container(plist, identity)) {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+
+    /* Its DeviceClass */
+    bplist_object_t info;
+    bool found = false;
+    if (!bplist_dict_find_dict(plist, identity, "Info", state, &info, &found)) {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+    if (found) {
+        uint64_t device_class_ref = 0;
+        bool is_string            = false;
+        if (!bplist_dict_find(plist, info, "DeviceClass", state, &device_class_ref)) {
+            return ILE_E_PLIST_CONVERSION_FAILED;
+        }
+        if (device_class_ref < plist.object_count) {
+            if (!bplist_read_string(plist, device_class_ref, &state->device_class, &is_string)) {
+                return ILE_E_PLIST_CONVERSION_FAILED;
+            }
+            if (!is_string) {
+                return ILE_E_FAILED_TO_GET_PLIST_STR_VAL;
+            }
+            state->has_device_class = true;
+        }
+    }
+
+    /* And its components */
+    bplist_object_t manifest;
+    if (!bplist_dict_find_dict(plist, identity, "Manifest", state, &manifest, &found)) {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+    if (found) {
+        ile_error_t ret = bplist_read_components(plist, manifest, state);
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+    }
+
+    return report_identity(state, found);
+}
+
+static ile_error_t bplist_read_manifest(const char* buffer, size_t size, manifest_read_state_t* state) {
+    /* Objects are looked up by reference as they're needed, so nothing that isn't used is ever touched */
+    bplist_t plist;
+    bplist_object_t root;
+    if (!bplist_open(buffer, size, &plist) || !bplist_object(plist, plist.top_object, &root)) {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+    if (root.type != BPLIST_TYPE_DICT) {
+        return ILE_E_PLIST_OBJECT_NOT_FOUND;
+    }
+    if (!bplist_is_container(plist, root)) {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+
+    /* ProductBuildVersion */
+    uint64_t ref = 0;
+    if (!bplist_dict_find(plist, root, "ProductBuildVersion", state, &ref)) {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+    ile_error_t ret = bplist_report_string(plist, ref, state, MANIFEST_FIELD_PRODUCT_BUILD_VERSION);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+
+    /* The first SupportedProductTypes entry */
+    bplist_object_t array;
+    if (!bplist_dict_find(plist, root, "SupportedProductTypes", state, &ref)) {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+    if (ref < plist.object_count) {
+        if (!bplist_object(plist, ref, &array)) {
+            return ILE_E_PLIST_CONVERSION_FAILED;
+        }
+        if (array.type == BPLIST_TYPE_ARRAY && array.count > 0) {
+            if (!bplist_ref(plist, array, 0, &ref)) {
+                return ILE_E_PLIST_CONVERSION_FAILED;
+            }
+            ret = bplist_report_string(plist, ref, state, MANIFEST_FIELD_PRODUCT_TYPE);
+            if (ret != ILE_SUCCESS) {
+                return ret;
+            }
+        }
+    }
+
+    /* Every build identity */
+    if (!bplist_dict_find(plist, root, "BuildIdentities", state, &ref)) {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+    if (ref >= plist.object_count) {
+        return ILE_SUCCESS;
+    }
+    if (!bplist_object(plist, ref, &array)) {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+    if (array.type != BPLIST_TYPE_ARRAY) {
+        return ILE_SUCCESS;
+    }
+    if (!bplist_is_container(plist, array)) {
+        return ILE_E_PLIST_CONVERSION_FAILED;
+    }
+    state->found_identities = true;
+    for (uint64_t i = 0; i < array.count; i++) {
+        if (!bplist_ref(plist, array, i, &ref)) {
+            return ILE_E_PLIST_CONVERSION_FAILED;
+        }
+        ret = bplist_read_identity(plist, ref, state);
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+    }
+
+    return ILE_SUCCESS;
+}
+
+ile_error_t manifest_read(const char* buffer, size_t size, manifest_reader_handler_t handler) {
+    manifest_read_state_t state;
+    state.handler             = handler;
+    state.found_identities    = false;
+    state.identities_seen     = 0;
+    state.identities_reported = 0;
+    state.has_device_class    = false;
+    memset(state.found_fields, 0, sizeof(state.found_fields));
+
+    const bool binary = (size >= strlen(BPLIST_MAGIC) && !memcmp(buffer, BPLIST_MAGIC, strlen(BPLIST_MAGIC)));
+    ile_error_t ret = binary ? bplist_read_manifest(buffer, size, &state) : xml_read_manifest(buffer, size, &state);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+
+    /* Everything the DOM parser requires has to be there too */
+    for (int i = 0; i < MANIFEST_FIELD_COUNT; i++) {
+        if (!state.found_fields[i]) {
+            return ILE_E_PLIST_OBJECT_NOT_FOUND;
+        }
+    }
+    return state.identities_reported ? ILE_SUCCESS : ILE_E_PLIST_OBJECT_NOT_FOUND;
+}
@@ -0,0 +1,46 @@
+//
+//  manifest_reader.hpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#ifndef manifest_reader_hpp
+#define manifest_reader_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include "utilities.hpp"
+
+using namespace std;
+
+typedef enum {
+    MANIFEST_FIELD_PRODUCT_BUILD_VERSION = 0,
+    MANIFEST_FIELD_PRODUCT_TYPE          = 1
+} manifest_field_t;
+
+#define MANIFEST_FIELD_COUNT 2
+
+typedef struct {
+    void* context;
+
+    /* Called once for ProductBuildVersion and the first SupportedProductTypes entry */
+    void (*field)(void* context, manifest_field_t field, const char* value);
+
+    /* Called once per build identity with its DeviceClass, in the order they appear. Identities after the first without a DeviceClass or Manifest are skipped */
+    void (*identity)(void* context, const char* device_class);
+
+    /* Called after an identity for every entry in its Manifest that has an Info/Path, in the order they appear. The digest is hex, or empty if the entry doesn't have one */
+    void (*component)(void* context, const char* name, const char* path, const char* digest);
+} manifest_reader_handler_t;
+
+/**
+ Reads the fields iLogoExtractor needs out of a BuildManifest, for every build identity, in one pass without building a plist tree. XML and binary plists are both supported, everything else in the manifest is skipped over. Strings passed to the handler are only valid for the duration of the call
+ @param buffer The BuildManifest's contents
+ @param size The size of the contents
+ @param handler The callbacks to report the fields to
+ @return ile_error_t error code, ILE_E_PLIST_CONVERSION_FAILED if the plist couldn't be read this way
+ */
+ile_error_t manifest_read(const char* buffer, size_t size, manifest_reader_handler_t handler);
+
+#endif /* manifest_reader_hpp */
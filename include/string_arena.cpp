@@ -0,0 +1,65 @@
+//
+//  string_arena.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "string_arena.hpp"
+
+using namespace std;
+
+static char* string_arena_allocate(string_arena_t* arena, size_t size) {
+    /* Big strings get a block to themselves so they don't waste the rest of the current one */
+    if (size > STRING_ARENA_BLOCK_SIZE / 4) {
+        char* block = (char*)malloc(size);
+        if (!block) {
+            throw bad_alloc();
+        }
+        arena->blocks.push_back(block);
+        return block;
+    }
+    
+    if (size > arena->remaining) {
+        char* block = (char*)malloc(STRING_ARENA_BLOCK_SIZE);
+        if (!block) {
+            throw bad_alloc();
+        }
+        arena->blocks.push_back(block);
+        arena->cursor    = block;
+        arena->remaining = STRING_ARENA_BLOCK_SIZE;
+    }
+    char* allocation = arena->cursor;
+    arena->cursor    += size;
+    arena->remaining -= size;
+    return allocation;
+}
+
+string_view string_arena_intern(string_arena_t* arena, string_view value) {
+    auto it = arena->interned.find(value);
+    if (it != arena->interned.end()) {
+        return *it;
+    }
+    
+    /* Keep a null terminator so views can still be handed to C APIs with data() */
+    char* copy = string_arena_allocate(arena, value.size() + 1);
+    memcpy(copy, value.data(), value.size());
+    copy[value.size()] = '\0';
+    
+    string_view interned(copy, value.size());
+    arena->interned.insert(interned);
+    return interned;
+}
+
+void string_arena_free(string_arena_t* arena) {
+    arena->interned.clear();
+    for (size_t i = 0; i < arena->blocks.size(); i++) {
+        free(arena->blocks[i]);
+    }
+    arena->blocks.clear();
+    arena->cursor    = NULL;
+    arena->remaining = 0;
+}
@@ -0,0 +1,44 @@
+//
+//  string_arena.hpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#ifndef string_arena_hpp
+#define string_arena_hpp
+
+#include <stdio.h>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+/* Strings are packed into blocks of this size, anything larger than a quarter of a block gets its own */
+#define STRING_ARENA_BLOCK_SIZE 0x4000
+
+typedef struct {
+    vector<char*> blocks;
+    char* cursor;
+    size_t remaining;
+    
+    /* Every string handed out, so repeats share one copy */
+    unordered_set<string_view> interned;
+} string_arena_t;
+
+/**
+ Copies a string into the arena, or finds the copy that's already there
+ @param arena Pointer to the arena
+ @param value The string
+ @return A view of the arena's copy, which is null terminated and stays valid until string_arena_free
+ */
+string_view string_arena_intern(string_arena_t* arena, string_view value);
+
+/**
+ Releases every string in the arena at once
+ @param arena Pointer to the arena
+ */
+void string_arena_free(string_arena_t* arena);
+
+#endif /* string_arena_hpp */
@@ -11,6 +11,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <errno.h>
 #include <vector>
 #include <plist/plist.h>
 #include "utilities.hpp"
@@ -71,6 +72,26 @@ const char* ile_strerror(ile_error_t error) {
             return "Failed to create a plist object while writing the report";
         case ILE_E_FAILED_TO_WRITE_OUT_REPORT:
             return "Failed to write out the report";
+        case ILE_E_FAILED_TO_MAP_IPSW:
+            return "Failed to memory map the IPSW";
+        case ILE_E_CACHE_UNAVAILABLE:
+            return "The cache directory is not available";
+        case ILE_E_CACHE_MISS:
+            return "Nothing usable was found in the cache";
+        case ILE_E_NO_BATCH_INPUTS:
+            return "No IPSWs were found for the batch";
+        case ILE_E_BATCH_HAD_FAILURES:
+            return "Some IPSWs in the batch failed, see summary.plist";
+        case ILE_E_KEYS_NOT_FOUND:
+            return "Wikiproxy has no keys for this build";
+        case ILE_E_FAILED_TO_LOAD_KEY_FILE:
+            return "The key file could not be read or isn't a JSON or plist of keys";
+        case ILE_E_WRONG_KEYS:
+            return "Some of the firmware keys don't decrypt their components";
+        case ILE_E_REMOTE_TIMED_OUT:
+            return "The IPSW's server stopped responding";
+        case ILE_E_CACHE_LOCKED:
+            return "Another process is looking up the same keys";
     }
 }
 
@@ -129,14 +150,21 @@ bool valid_magic(const char* filename, const char* expected_magic) {
     }
 }
 
+bool is_http_url(const char* path) {
+    return !strncmp(path, "http://", 7) || !strncmp(path, "https://", 8);
+}
+
 ile_error_t check_io_setup(const char* ipsw_path, const char* output_dir_path) {
-    /* IPSW */
-    if (access(ipsw_path, F_OK) != 0) {
+    /* IPSW, a remote one can only be checked once it's opened */
+    if (is_http_url(ipsw_path)) {
+        log_message(INFO, "The IPSW is remote, it will be read with range requests");
+    } else if (access(ipsw_path, F_OK) != 0) {
         return ILE_E_IPSW_DOES_NOT_EXIST;
     } else if (!valid_magic(ipsw_path, IPSW_MAGIC)) {
         return ILE_E_UNABLE_TO_VERIFY_IPSW_TYPE;
+    } else {
+        log_message(INFO, "The IPSW is ok at first glance");
     }
-    log_message(INFO, "The IPSW is ok at first glance");
     
     /* Output Dir */
     DIR* dp = opendir(output_dir_path);
@@ -168,82 +196,152 @@ ile_error_t open_work(const char* output_dir_path, char** work_dir_path) {
     return ILE_SUCCESS;
 }
 
-ile_error_t close_work(char** work_dir_path) {
-    /* Delete all items in the directory */
-    DIR* dp = opendir(*work_dir_path);
-    struct dirent* next_file;
-    char* filename = NULL;
-    
-    while ((next_file = readdir(dp)) != NULL) {
-        /* Craft the filename */
-        asprintf(&filename, "%s/%s", *work_dir_path, next_file->d_name);
-        remove(filename);
-        free(filename);
+static bool make_dir_if_missing(const char* path) {
+    return mkdir(path, 0777) == 0 || errno == EEXIST;
+}
+
+ile_error_t get_cache_dir(const char* name, char** cache_dir_path) {
+    /* Figure out the cache root */
+    char* root = NULL;
+    const char* env = getenv("ILE_CACHE_DIR");
+    if (env && *env) {
+        root = strdup(env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) && *env) {
+        asprintf(&root, "%s/iLogoExtractor", env);
+    } else if ((env = getenv("HOME")) && *env) {
+        char* dot_cache = NULL;
+        asprintf(&dot_cache, "%s/.cache", env);
+        if (!dot_cache || !make_dir_if_missing(dot_cache)) {
+            free(dot_cache);
+            return ILE_E_CACHE_UNAVAILABLE;
+        }
+        free(dot_cache);
+        asprintf(&root, "%s/.cache/iLogoExtractor", env);
+    }
+    if (!root) {
+        return ILE_E_CACHE_UNAVAILABLE;
     }
     
-    /* Delete the directory */
-    if (rmdir(*work_dir_path) != 0) {
-        printf("%d\n", rmdir(*work_dir_path));
-        printf("%s\n", *work_dir_path);
-        free(*work_dir_path);
-        return ILE_E_COULD_NOT_DELETE_WORK_DIR;
+    /* Create the root and the named directory inside it */
+    if (!make_dir_if_missing(root)) {
+        free(root);
+        return ILE_E_CACHE_UNAVAILABLE;
+    }
+    asprintf(cache_dir_path, "%s/%s", root, name);
+    free(root);
+    if (!*cache_dir_path) {
+        return ILE_E_OUT_OF_MEMORY;
+    }
+    if (!make_dir_if_missing(*cache_dir_path)) {
+        free(*cache_dir_path);
+        *cache_dir_path = NULL;
+        return ILE_E_CACHE_UNAVAILABLE;
     }
     
-    /* Free resources and return */
-    free(*work_dir_path);
     return ILE_SUCCESS;
 }
 
-bool is_duplicate_vector_key(vector<const char*> vector, const char* key) {
-    /* Enumerate over every index in the vector, checking if any equal the key */
-    for (size_t i = 0; i < vector.size(); i++) {
-        if (!strcmp(vector[i], key)) {
-            /* Already exists */
-            return true;
-        }
-    }
-    
-    /* Loop didn't find anything - doesn't exist yet */
-    return false;
+bool string_set_contains(const string_set_t& set, const char* value) {
+    return set.members.count(string_view(value)) != 0;
 }
 
-const char* manifest_component_name_fixup(const char* original_name) {
-    if (!strcmp(original_name, "BatteryPlugin")) {
-        return "GlyphPlugin";
-    } else if (!strcmp(original_name, "BatteryCharging")) {
-        return "GlyphCharging";
-    } else {
-        /* Don't fix */
-        return original_name;
+bool string_set_insert(string_set_t* set, const char* value) {
+    if (string_set_contains(*set, value)) {
+        return false;
     }
+    
+    set->storage.emplace_back(value);
+    set->members.insert(string_view(set->storage.back()));
+    return true;
 }
 
-ile_error_t fwrite_img3_vector(vector<uint8_t> vector, const char* output_path) {
+ile_error_t fwrite_im4p_buffer(const void* buffer, size_t size, const char* output_path) {
     FILE* fp = fopen(output_path, "wb");
     if (!fp) {
         return ILE_E_FAILED_TO_OPEN_FILE_FOR_WRITING;
     }
     
     /* Write and close */
-    fwrite(vector.data(), vector.size(), sizeof(uint8_t), fp);
+    fwrite(buffer, size, 1, fp);
     fclose(fp);
     
     return ILE_SUCCESS;
 }
 
-ile_error_t fwrite_im4p_buffer(const void* buffer, size_t size, const char* output_path) {
-    FILE* fp = fopen(output_path, "wb");
-    if (!fp) {
-        return ILE_E_FAILED_TO_OPEN_FILE_FOR_WRITING;
+ile_error_t link_or_copy_file(const char* source_path, const char* destination_path) {
+    /* A hard link costs nothing, copying is only for file systems that can't do them */
+    if (link(source_path, destination_path) == 0) {
+        return ILE_SUCCESS;
     }
     
-    /* Write and close */
-    fwrite(buffer, size, 1, fp);
-    fclose(fp);
+    FILE* source = fopen(source_path, "rb");
+    if (!source) {
+        return ILE_E_FAILED_TO_OPEN_FILE_FOR_READING;
+    }
+    FILE* destination = fopen(destination_path, "wb");
+    if (!destination) {
+        fclose(source);
+        return ILE_E_FAILED_TO_OPEN_FILE_FOR_WRITING;
+    }
+    char chunk[0x10000];
+    size_t read_size = 0;
+    bool written     = true;
+    while (written && (read_size = fread(chunk, 1, sizeof(chunk), source)) > 0) {
+        written = fwrite(chunk, 1, read_size, destination) == read_size;
+    }
+    fclose(source);
+    if (fclose(destination) != 0 || !written) {
+        remove(destination_path);
+        return ILE_E_FAILED_TO_OPEN_FILE_FOR_WRITING;
+    }
     
     return ILE_SUCCESS;
 }
 
+static int hex_digit_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+string hex_encode(const uint8_t* data, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    string hex;
+    hex.reserve(size * 2);
+    for (size_t i = 0; i < size; i++) {
+        hex.push_back(digits[data[i] >> 4]);
+        hex.push_back(digits[data[i] & 0xF]);
+    }
+    
+    return hex;
+}
+
+bool hex_decode(const char* hex, vector<uint8_t>* output) {
+    const size_t len = strlen(hex);
+    output->clear();
+    if (len % 2 != 0) {
+        return false;
+    }
+    
+    output->reserve(len / 2);
+    for (size_t i = 0; i < len; i += 2) {
+        const int high = hex_digit_value(hex[i]);
+        const int low  = hex_digit_value(hex[i + 1]);
+        if (high < 0 || low < 0) {
+            output->clear();
+            return false;
+        }
+        output->push_back((uint8_t)((high << 4) | low));
+    }
+    
+    return true;
+}
+
 const char* get_file_name_from_path(const char* path) {
     const char* filename = strrchr(path, '/');
     return (filename != NULL) ? (filename + 1) : path;
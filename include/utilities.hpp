@@ -10,6 +10,10 @@
 
 #include <stdio.h>
 #include <vector>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_set>
 #include <cstdint>
 
 using namespace std;
@@ -51,7 +55,17 @@ typedef enum {
     ILE_E_IBOOTIM_CORRUPT                 = -22,
     ILE_E_THIRD_PARTY_ERROR               = -23,
     ILE_E_FAILED_TO_CREATE_PLIST_OBJECT   = -24,
-    ILE_E_FAILED_TO_WRITE_OUT_REPORT      = -25
+    ILE_E_FAILED_TO_WRITE_OUT_REPORT      = -25,
+    ILE_E_FAILED_TO_MAP_IPSW              = -26,
+    ILE_E_CACHE_UNAVAILABLE               = -27,
+    ILE_E_CACHE_MISS                      = -28,
+    ILE_E_NO_BATCH_INPUTS                 = -29,
+    ILE_E_BATCH_HAD_FAILURES              = -30,
+    ILE_E_KEYS_NOT_FOUND                  = -31,
+    ILE_E_FAILED_TO_LOAD_KEY_FILE         = -32,
+    ILE_E_WRONG_KEYS                      = -33,
+    ILE_E_REMOTE_TIMED_OUT                = -34,
+    ILE_E_CACHE_LOCKED                    = -35
 } ile_error_t;
 
 typedef enum {
@@ -84,7 +98,14 @@ void log_message(message_class_t message_class, const char* message);
 bool valid_magic(const char* filename, const char* expected_magic);
 
 /**
- Makes sure I/O is ready to go, with an IPSW that exists and is a zip, and an output dir that doesn't exist (which is created by this function)
+ Checks if a path is an http:// or https:// URL
+ @param path The path
+ @return True if the path is a URL
+ */
+bool is_http_url(const char* path);
+
+/**
+ Makes sure I/O is ready to go, with an IPSW that exists and is a zip (or is a URL, which is checked when it's opened), and an output dir that doesn't exist (which is created by this function)
  @param ipsw_path Path to the IPSW
  @param output_dir_path Path to the output directory
  @return ile_error_t error code
@@ -100,34 +121,34 @@ ile_error_t check_io_setup(const char* ipsw_path, const char* output_dir_path);
 ile_error_t open_work(const char* output_dir_path, char** work_dir_path);
 
 /**
- Closes a work environment
- @param work_dir_path Path to the work directory, is pointer so it can be freed
+ Gets (and creates if necessary) a directory inside the iLogoExtractor cache, which is $ILE_CACHE_DIR, $XDG_CACHE_HOME/iLogoExtractor or ~/.cache/iLogoExtractor
+ @param name The name of the directory inside the cache
+ @param cache_dir_path Pointer to the char* that will hold the full path, must be freed
  @return ile_error_t error code
  */
-ile_error_t close_work(char** work_dir_path);
+ile_error_t get_cache_dir(const char* name, char** cache_dir_path);
 
-/**
- Checks if a key already exists in a vectory (type char*)
- @param vector The vector of char* to be checked
- @param key The key to be searched for in the vector
- @return True if the key already exists, false if not
- */
-bool is_duplicate_vector_key(vector<const char*> vector, const char* key);
+/* A set of strings with constant time lookups. The set owns its strings (a deque never moves them) and indexes views of them */
+typedef struct {
+    deque<string> storage;
+    unordered_set<string_view> members;
+} string_set_t;
 
 /**
- Fixes up component names so that wikiproxy's response will recognize the key
- @param name The original component's name
- @return The fixed name
+ Checks if a string is in a set
+ @param set The set
+ @param value The string
+ @return True if the string is in the set
  */
-const char* manifest_component_name_fixup(const char* name);
+bool string_set_contains(const string_set_t& set, const char* value);
 
 /**
- Writes out an img3 vector (vector of uint8_t)
- @param vector The vector source
- @param output_path The path to save the file
- @return ile_error_t error code
+ Adds a string to a set
+ @param set Pointer to the set
+ @param value The string
+ @return True if the string was added, false if it was already in the set
  */
-ile_error_t fwrite_img3_vector(vector<uint8_t> vector, const char* output_path);
+bool string_set_insert(string_set_t* set, const char* value);
 
 /**
  Writes out a char* buffer
@@ -138,6 +159,30 @@ ile_error_t fwrite_img3_vector(vector<uint8_t> vector, const char* output_path);
  */
 ile_error_t fwrite_im4p_buffer(const void* buffer, size_t size, const char* output_path);
 
+/**
+ Hard links a file to a new path, or copies it if it can't be linked
+ @param source_path The existing file
+ @param destination_path The new path, which must not exist yet
+ @return ile_error_t error code
+ */
+ile_error_t link_or_copy_file(const char* source_path, const char* destination_path);
+
+/**
+ Encodes bytes as a lowercase hex string
+ @param data The bytes
+ @param size The number of bytes
+ @return The hex string
+ */
+string hex_encode(const uint8_t* data, size_t size);
+
+/**
+ Decodes a hex string into bytes
+ @param hex The hex string, upper or lower case
+ @param output Pointer to the vector that receives the bytes
+ @return True if the whole string was valid hex with an even length
+ */
+bool hex_decode(const char* hex, vector<uint8_t>* output);
+
 /**
  Returns just the filename from a path
  @param path The path to the file
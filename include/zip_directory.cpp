@@ -0,0 +1,300 @@
+//
+//  zip_directory.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <vector>
+#include "utilities.hpp"
+#include "zip_directory.hpp"
+
+using namespace std;
+
+#define ZIP_END_OF_CENTRAL_DIR_SIZE    22
+#define ZIP64_LOCATOR_SIZE             20
+#define ZIP64_END_OF_CENTRAL_DIR_SIZE  56
+#define ZIP_CENTRAL_HEADER_SIZE        46
+#define ZIP_LOCAL_HEADER_SIZE          30
+#define ZIP_MAX_COMMENT_SIZE           0xFFFF
+#define ZIP64_EXTRA_FIELD_ID           0x0001
+
+/* Zip fields are little endian and unaligned */
+static uint16_t read_le16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t read_le64(const uint8_t* p) {
+    return (uint64_t)read_le32(p) | ((uint64_t)read_le32(p + 4) << 32);
+}
+
+static void apply_zip64_extra_field(const uint8_t* extra, uint16_t extra_size, zip_directory_entry_t* entry, uint32_t raw_uncompressed_size, uint32_t raw_compressed_size, uint32_t raw_local_header_offset) {
+    size_t i = 0;
+    while (i + 4 <= extra_size) {
+        const uint16_t id   = read_le16(&extra[i]);
+        const uint16_t size = read_le16(&extra[i + 2]);
+        if (i + 4 + size > extra_size) {
+            return;
+        }
+        
+        if (id == ZIP64_EXTRA_FIELD_ID) {
+            /* Only the fields that overflowed in the main record are present, in this order */
+            const uint8_t* p   = &extra[i + 4];
+            const uint8_t* end = p + size;
+            if (raw_uncompressed_size == 0xFFFFFFFF && p + 8 <= end) {
+                entry->uncompressed_size = read_le64(p); p += 8;
+            }
+            if (raw_compressed_size == 0xFFFFFFFF && p + 8 <= end) {
+                entry->compressed_size = read_le64(p); p += 8;
+            }
+            if (raw_local_header_offset == 0xFFFFFFFF && p + 8 <= end) {
+                entry->local_header_offset = read_le64(p); p += 8;
+            }
+            return;
+        }
+        
+        i += 4 + size;
+    }
+}
+
+ile_error_t zip_directory_locate(zip_directory_reader_t reader, void* context, uint64_t file_size, zip_central_directory_location_t* location) {
+    if (file_size < ZIP_END_OF_CENTRAL_DIR_SIZE) {
+        return ILE_E_FAILED_TO_HANDLE_ZIP;
+    }
+    
+    /* The end of central directory record is somewhere in the last 64K + 22 bytes, behind the comment */
+    const uint64_t tail_size   = (file_size < (ZIP_MAX_COMMENT_SIZE + ZIP_END_OF_CENTRAL_DIR_SIZE + ZIP64_LOCATOR_SIZE)) ? file_size : (ZIP_MAX_COMMENT_SIZE + ZIP_END_OF_CENTRAL_DIR_SIZE + ZIP64_LOCATOR_SIZE);
+    const uint64_t tail_offset = file_size - tail_size;
+    vector<uint8_t> tail(tail_size);
+    ile_error_t ret = reader(context, tail_offset, tail.data(), tail_size);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    int64_t eocd = -1;
+    for (int64_t i = (int64_t)tail_size - ZIP_END_OF_CENTRAL_DIR_SIZE; i >= 0; i--) {
+        if (read_le32(&tail[i]) == ZIP_END_OF_CENTRAL_DIR_SIGNATURE) {
+            eocd = i;
+            break;
+        }
+    }
+    if (eocd < 0) {
+        return ILE_E_FAILED_TO_HANDLE_ZIP;
+    }
+    
+    location->entry_count = read_le16(&tail[eocd + 10]);
+    location->size        = read_le32(&tail[eocd + 12]);
+    location->offset      = read_le32(&tail[eocd + 16]);
+    
+    /* IPSWs are usually larger than 4GB, so look for the zip64 records right before the regular one */
+    if (eocd >= ZIP64_LOCATOR_SIZE && read_le32(&tail[eocd - ZIP64_LOCATOR_SIZE]) == ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIGNATURE) {
+        const uint64_t zip64_eocd_offset = read_le64(&tail[eocd - ZIP64_LOCATOR_SIZE + 8]);
+        uint8_t zip64_eocd[ZIP64_END_OF_CENTRAL_DIR_SIZE];
+        if (zip64_eocd_offset + ZIP64_END_OF_CENTRAL_DIR_SIZE > file_size) {
+            return ILE_E_FAILED_TO_HANDLE_ZIP;
+        }
+        ret = reader(context, zip64_eocd_offset, zip64_eocd, sizeof(zip64_eocd));
+        if (ret != ILE_SUCCESS) {
+            return ret;
+        }
+        if (read_le32(zip64_eocd) != ZIP64_END_OF_CENTRAL_DIR_SIGNATURE) {
+            return ILE_E_FAILED_TO_HANDLE_ZIP;
+        }
+        location->entry_count = read_le64(&zip64_eocd[32]);
+        location->size        = read_le64(&zip64_eocd[40]);
+        location->offset      = read_le64(&zip64_eocd[48]);
+    }
+    if (location->offset > file_size || location->size > (file_size - location->offset)) {
+        return ILE_E_FAILED_TO_HANDLE_ZIP;
+    }
+    
+    return ILE_SUCCESS;
+}
+
+ile_error_t zip_directory_parse(const uint8_t* cd, zip_central_directory_location_t location, uint64_t file_size, zip_directory_t* directory) {
+    const uint64_t cd_size = location.size;
+    
+    directory->file_size                = file_size;
+    directory->central_directory_offset = location.offset;
+    directory->central_directory_size   = location.size;
+    directory->entries.clear();
+    directory->name_index.clear();
+    directory->entries.reserve(location.entry_count);
+    directory->name_index.reserve(location.entry_count);
+    
+    size_t p = 0;
+    for (uint64_t i = 0; i < location.entry_count; i++) {
+        if (p + ZIP_CENTRAL_HEADER_SIZE > cd_size || read_le32(&cd[p]) != ZIP_CENTRAL_HEADER_SIGNATURE) {
+            return ILE_E_FAILED_TO_HANDLE_ZIP;
+        }
+        
+        const uint16_t name_size    = read_le16(&cd[p + 28]);
+        const uint16_t extra_size   = read_le16(&cd[p + 30]);
+        const uint16_t comment_size = read_le16(&cd[p + 32]);
+        if (p + ZIP_CENTRAL_HEADER_SIZE + name_size + extra_size + comment_size > cd_size) {
+            return ILE_E_FAILED_TO_HANDLE_ZIP;
+        }
+        
+        zip_directory_entry_t entry;
+        const uint32_t raw_compressed_size     = read_le32(&cd[p + 20]);
+        const uint32_t raw_uncompressed_size   = read_le32(&cd[p + 24]);
+        const uint32_t raw_local_header_offset = read_le32(&cd[p + 42]);
+        entry.flags               = read_le16(&cd[p + 8]);
+        entry.compression_method  = read_le16(&cd[p + 10]);
+        entry.crc32               = read_le32(&cd[p + 16]);
+        entry.compressed_size     = raw_compressed_size;
+        entry.uncompressed_size   = raw_uncompressed_size;
+        entry.local_header_offset = raw_local_header_offset;
+        entry.data_offset         = 0;
+        entry.name.assign((const char*)&cd[p + ZIP_CENTRAL_HEADER_SIZE], name_size);
+        apply_zip64_extra_field(&cd[p + ZIP_CENTRAL_HEADER_SIZE + name_size], extra_size, &entry, raw_uncompressed_size, raw_compressed_size, raw_local_header_offset);
+        
+        zip_directory_add(directory, entry);
+        p += ZIP_CENTRAL_HEADER_SIZE + name_size + extra_size + comment_size;
+    }
+    
+    return ILE_SUCCESS;
+}
+
+ile_error_t zip_directory_read(zip_directory_reader_t reader, void* context, uint64_t file_size, zip_directory_t* directory) {
+    zip_central_directory_location_t location;
+    ile_error_t ret = zip_directory_locate(reader, context, file_size, &location);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    /* Read the whole central directory in one go */
+    vector<uint8_t> cd(location.size);
+    ret = reader(context, location.offset, cd.data(), location.size);
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    
+    return zip_directory_parse(cd.data(), location, file_size, directory);
+}
+
+void zip_directory_add(zip_directory_t* directory, const zip_directory_entry_t& entry) {
+    /* The first entry wins if a name is repeated, like zip_name_locate */
+    directory->name_index.emplace(entry.name, directory->entries.size());
+    directory->entries.push_back(entry);
+}
+
+const zip_directory_entry_t* zip_directory_find(const zip_directory_t& directory, const char* name) {
+    auto it = directory.name_index.find(name);
+    if (it == directory.name_index.end()) {
+        return NULL;
+    }
+    
+    return &directory.entries[it->second];
+}
+
+ile_error_t zip_directory_data_offset(zip_directory_reader_t reader, void* context, const zip_directory_entry_t& entry, uint64_t* data_offset) {
+    if (entry.data_offset) {
+        *data_offset = entry.data_offset;
+        return ILE_SUCCESS;
+    }
+    
+    /* The local header's name and extra field sizes can differ from the central directory's, so it has to be read */
+    uint8_t local_header[ZIP_LOCAL_HEADER_SIZE];
+    ile_error_t ret = reader(context, entry.local_header_offset, local_header, sizeof(local_header));
+    if (ret != ILE_SUCCESS) {
+        return ret;
+    }
+    if (read_le32(local_header) != ZIP_LOCAL_HEADER_SIGNATURE) {
+        return ILE_E_FAILED_TO_HANDLE_ZIP;
+    }
+    
+    *data_offset = entry.local_header_offset + ZIP_LOCAL_HEADER_SIZE + read_le16(&local_header[26]) + read_le16(&local_header[28]);
+    return ILE_SUCCESS;
+}
+
+ile_error_t zip_directory_inflate(const zip_directory_entry_t& entry, const void* compressed, void* output) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    
+    /* Zip stores raw deflate streams without a zlib header */
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        return ILE_E_OUT_OF_MEMORY;
+    }
+    
+    /* zlib counts in uInt, so feed anything larger in chunks */
+    const uint8_t* in  = (const uint8_t*)compressed;
+    uint8_t* out       = (uint8_t*)output;
+    uint64_t in_left   = entry.compressed_size;
+    uint64_t out_left  = entry.uncompressed_size;
+    int rc = Z_OK;
+    while (rc == Z_OK) {
+        if (stream.avail_in == 0 && in_left > 0) {
+            stream.next_in  = (Bytef*)in;
+            stream.avail_in = (uInt)((in_left > 0x40000000) ? 0x40000000 : in_left);
+            in      += stream.avail_in;
+            in_left -= stream.avail_in;
+        }
+        if (stream.avail_out == 0 && out_left > 0) {
+            stream.next_out  = out;
+            stream.avail_out = (uInt)((out_left > 0x40000000) ? 0x40000000 : out_left);
+            out      += stream.avail_out;
+            out_left -= stream.avail_out;
+        }
+        rc = inflate(&stream, Z_NO_FLUSH);
+        if (rc == Z_BUF_ERROR && (in_left > 0 || out_left > 0)) {
+            rc = Z_OK;
+        }
+    }
+    const uint64_t total_out = stream.total_out;
+    inflateEnd(&stream);
+    
+    if (rc != Z_STREAM_END || total_out != entry.uncompressed_size) {
+        return ILE_E_FAILED_TO_HANDLE_ZIP;
+    }
+    if (!zip_directory_verify_crc(entry, output)) {
+        return ILE_E_FAILED_TO_HANDLE_ZIP;
+    }
+    
+    return ILE_SUCCESS;
+}
+
+ile_error_t zip_directory_inflate_head(const void* compressed, uint64_t compressed_size, void* output, size_t max_size, size_t* size) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    *size = 0;
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        return ILE_E_OUT_OF_MEMORY;
+    }
+    
+    /* Only ever a few blocks, so one call's worth of input and output */
+    stream.next_in   = (Bytef*)compressed;
+    stream.avail_in  = (uInt)((compressed_size > 0x40000000) ? 0x40000000 : compressed_size);
+    stream.next_out  = (Bytef*)output;
+    stream.avail_out = (uInt)max_size;
+    int rc = Z_OK;
+    while (rc == Z_OK && stream.avail_out > 0) {
+        rc = inflate(&stream, Z_NO_FLUSH);
+    }
+    *size = stream.total_out;
+    inflateEnd(&stream);
+    
+    /* Running out of input just means a shorter head */
+    return (rc == Z_OK || rc == Z_STREAM_END || rc == Z_BUF_ERROR) ? ILE_SUCCESS : ILE_E_FAILED_TO_HANDLE_ZIP;
+}
+
+bool zip_directory_verify_crc(const zip_directory_entry_t& entry, const void* data) {
+    uLong crc = crc32(0L, Z_NULL, 0);
+    const uint8_t* p = (const uint8_t*)data;
+    uint64_t left    = entry.uncompressed_size;
+    while (left > 0) {
+        const uInt chunk = (uInt)((left > 0x40000000) ? 0x40000000 : left);
+        crc   = crc32(crc, p, chunk);
+        p    += chunk;
+        left -= chunk;
+    }
+    
+    return (uint32_t)crc == entry.crc32;
+}
@@ -0,0 +1,151 @@
+//
+//  zip_directory.hpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+
+#ifndef zip_directory_hpp
+#define zip_directory_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "utilities.hpp"
+
+using namespace std;
+
+/* Zip record signatures */
+#define ZIP_LOCAL_HEADER_SIGNATURE        0x04034b50
+#define ZIP_CENTRAL_HEADER_SIGNATURE      0x02014b50
+#define ZIP_END_OF_CENTRAL_DIR_SIGNATURE  0x06054b50
+#define ZIP64_END_OF_CENTRAL_DIR_SIGNATURE 0x06064b50
+#define ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIGNATURE 0x07064b50
+
+/* Compression methods that can be read without libzip */
+#define ZIP_METHOD_STORED  0
+#define ZIP_METHOD_DEFLATE 8
+
+typedef struct {
+    string name;
+    uint64_t local_header_offset;
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    uint16_t compression_method;
+    uint16_t flags;
+    uint32_t crc32;
+    
+    /* 0 until the local header has been read, see zip_directory_data_offset */
+    uint64_t data_offset;
+} zip_directory_entry_t;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t entry_count;
+} zip_central_directory_location_t;
+
+typedef struct {
+    uint64_t file_size;
+    uint64_t central_directory_offset;
+    uint64_t central_directory_size;
+    vector<zip_directory_entry_t> entries;
+    unordered_map<string, size_t> name_index;
+} zip_directory_t;
+
+/**
+ Reads raw bytes out of whatever holds the zip (a mapping, a remote file...)
+ @param context The reader's context
+ @param offset The offset in the zip to read from
+ @param buffer The buffer to read into
+ @param length The number of bytes to read
+ @return ile_error_t error code
+ */
+typedef ile_error_t (*zip_directory_reader_t)(void* context, uint64_t offset, void* buffer, size_t length);
+
+/**
+ Finds the central directory of a zip from its end records, including zip64 archives
+ @param reader The function used to read bytes from the zip
+ @param context The reader's context
+ @param file_size The total size of the zip
+ @param location Pointer to the location structure to populate
+ @return ile_error_t error code
+ */
+ile_error_t zip_directory_locate(zip_directory_reader_t reader, void* context, uint64_t file_size, zip_central_directory_location_t* location);
+
+/**
+ Parses the raw bytes of a central directory
+ @param central_directory The central directory's bytes
+ @param location Where the central directory was found
+ @param file_size The total size of the zip
+ @param directory Pointer to the directory structure to populate
+ @return ile_error_t error code
+ */
+ile_error_t zip_directory_parse(const uint8_t* central_directory, zip_central_directory_location_t location, uint64_t file_size, zip_directory_t* directory);
+
+/**
+ Reads the central directory of a zip, including zip64 archives
+ @param reader The function used to read bytes from the zip
+ @param context The reader's context
+ @param file_size The total size of the zip
+ @param directory Pointer to the directory structure to populate
+ @return ile_error_t error code
+ */
+ile_error_t zip_directory_read(zip_directory_reader_t reader, void* context, uint64_t file_size, zip_directory_t* directory);
+
+/**
+ Finds an entry in the central directory by name
+ @param directory The directory
+ @param name The name of the entry
+ @return The entry or NULL if it doesn't exist
+ */
+const zip_directory_entry_t* zip_directory_find(const zip_directory_t& directory, const char* name);
+
+/**
+ Resolves where an entry's data starts by reading its local header, unless it is already known
+ @param reader The function used to read bytes from the zip
+ @param context The reader's context
+ @param entry The entry
+ @param data_offset Return pointer for the offset of the entry's data
+ @return ile_error_t error code
+ */
+ile_error_t zip_directory_data_offset(zip_directory_reader_t reader, void* context, const zip_directory_entry_t& entry, uint64_t* data_offset);
+
+/**
+ Adds an entry to a directory and its name index
+ @param directory Pointer to the directory
+ @param entry The entry
+ */
+void zip_directory_add(zip_directory_t* directory, const zip_directory_entry_t& entry);
+
+/**
+ Inflates a deflated entry from its raw compressed bytes and verifies its CRC
+ @param entry The entry
+ @param compressed The entry's compressed data
+ @param output The buffer to inflate into, at least entry.uncompressed_size bytes
+ @return ile_error_t error code
+ */
+ile_error_t zip_directory_inflate(const zip_directory_entry_t& entry, const void* compressed, void* output);
+
+/**
+ Inflates the start of a deflated entry from the first of its compressed bytes. Nothing is checked against the CRC since the rest of the entry isn't read
+ @param compressed The start of the entry's compressed data
+ @param compressed_size The number of compressed bytes
+ @param output The buffer to inflate into
+ @param max_size The size of the output buffer
+ @param size Pointer to the return size, less than max_size if the entry or the compressed bytes ran out first
+ @return ile_error_t error code
+ */
+ile_error_t zip_directory_inflate_head(const void* compressed, uint64_t compressed_size, void* output, size_t max_size, size_t* size);
+
+/**
+ Verifies the CRC of an entry's uncompressed data
+ @param entry The entry
+ @param data The entry's uncompressed data
+ @return True if the CRC matches the central directory
+ */
+bool zip_directory_verify_crc(const zip_directory_entry_t& entry, const void* data);
+
+#endif /* zip_directory_hpp */
@@ -7,10 +7,39 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <string>
+#include <vector>
 #include "include/utilities.hpp"
-#include "include/ipsw.hpp"
+#include "include/batch.hpp"
+#include "include/benchmark.hpp"
+#include "include/diff.hpp"
+#include "include/http_client.hpp"
 #include "include/api.hpp"
-#include "include/extraction.hpp"
+#include "include/key_provider.hpp"
+
+/* Anything past these is a typo, not a request */
+#define MAX_JOBS       1024
+#define MAX_ITERATIONS 1000000
+
+/* The whole argument has to be a number no bigger than max, strtoul alone would take "abc" as 0 and "-1" as a huge count */
+static bool parse_count(const char* value, uint32_t max, uint32_t* count) {
+    if (!value || *value < '0' || *value > '9') {
+        return false;
+    }
+    
+    char* end = NULL;
+    errno = 0;
+    const unsigned long parsed = strtoul(value, &end, 10);
+    if (errno != 0 || !end || *end != '\0' || parsed > max) {
+        return false;
+    }
+    
+    *count = (uint32_t)parsed;
+    return true;
+}
 
 int main(int argc, char* argv[]) {
     /* Windows is not supported yet. Let the user know and abort. */
@@ -18,70 +47,124 @@ int main(int argc, char* argv[]) {
         printf("iLogoExtractor does not currently support running on Windows due to API differences between it, Linux, and macOS.\n");
         return -1;
     #endif
-
+    
+    /* Options */
+    bool keep_work = false;
+    bool no_prompt = false;
+    uint32_t jobs  = 1;
+    uint32_t iterations = BENCHMARK_DEFAULT_ITERATIONS;
+    const char* key_file_path = NULL;
+    const char* key_dir_path  = NULL;
+    const char* key_endpoint  = NULL;
+    static struct option long_options[] = {
+        { "keep-work",    no_argument,       NULL, 'w' },
+        { "jobs",         required_argument, NULL, 'j' },
+        { "iterations",   required_argument, NULL, 'n' },
+        { "keys",         required_argument, NULL, 'k' },
+        { "key-dir",      required_argument, NULL, 'K' },
+        { "no-prompt",    no_argument,       NULL, 'P' },
+        { "key-endpoint", required_argument, NULL, 'e' },
+        { NULL,           0,                 NULL, 0   }
+    };
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "wj:n:k:K:Pe:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'w':
+                keep_work = true;
+                break;
+            case 'j':
+                if (!parse_count(optarg, MAX_JOBS, &jobs)) {
+                    argc = 0; // Forces the usage message below
+                }
+                break;
+            case 'n':
+                if (!parse_count(optarg, MAX_ITERATIONS, &iterations)) {
+                    argc = 0; // Forces the usage message below
+                }
+                break;
+            case 'k':
+                key_file_path = optarg;
+                break;
+            case 'K':
+                key_dir_path = optarg;
+                break;
+            case 'P':
+                no_prompt = true;
+                break;
+            case 'e':
+                key_endpoint = optarg;
+                break;
+            default:
+                argc = 0; // Forces the usage message below
+                break;
+        }
+    }
+    
     /* Check Usage */
-    if (argc != 3) {
+    const bool batch_mode   = (argc - optind == 3) && !strcmp(argv[optind], "batch");
+    const bool bench_mode   = (argc - optind == 2) && !strcmp(argv[optind], "bench-manifest");
+    const bool decrypt_mode = (argc - optind == 2) && !strcmp(argv[optind], "bench-decrypt");
+    const bool diff_mode    = (argc - optind == 5) && !strcmp(argv[optind], "diff");
+    if (argc - optind != 2 && !batch_mode && !bench_mode && !diff_mode) {
         printf("A utility to extract iBoot images from an IPSW\n");
-        printf("Usage: %s <IPSW> <Output Folder>\n", argv[0]);
+        printf("Usage: %s [options] <IPSW> <Output Folder>\n", argv[0]);
+        printf("       %s [options] batch <Folder|Glob|List File> <Output Folder>\n", argv[0]);
+        printf("       %s [options] diff <Old IPSW> <Old Output Folder> <IPSW> <Output Folder>\n", argv[0]);
+        printf("       %s [options] bench-manifest <IPSW>\n", argv[0]);
+        printf("       %s [options] bench-decrypt <IPSW>\n", argv[0]);
+        printf("Options:\n");
+        printf("  -w, --keep-work        Keep the decrypted ibootim payloads in <Output Folder>/work\n");
+        printf("  -j, --jobs <N>         Extract N components at once, 0 to use every core (default: 1, at most %d)\n", MAX_JOBS);
+        printf("  -n, --iterations <N>   Run every benchmark N times in bench-manifest and bench-decrypt (default: %d, at most %d)\n", BENCHMARK_DEFAULT_ITERATIONS, MAX_ITERATIONS);
+        printf("  -k, --keys <File|->    Use keys from a JSON or plist key file, - to read it from standard input\n");
+        printf("  -K, --key-dir <Folder> Use keys from per-build JSON or plist key files in a folder\n");
+        printf("  -P, --no-prompt        Never ask for keys, fail when no key source has them\n");
+        printf("  -e, --key-endpoint <URL|Folder>\n");
+        printf("                         Request keys from this URL or folder instead of wikiproxy\n");
         return -1;
     }
     
-    /* Main Program */
-    ile_error_t ret             = ILE_SUCCESS;
-    ipsw_archive_t ipsw         = { NULL, argv[1] };
-    const char* output_dir_path = argv[2];
-    char* work_dir_path         = NULL;
-    
-    /* Pre Checks */
-    ret = check_io_setup(ipsw.path, output_dir_path);
+    /* Key sources are set up once for every IPSW, a key file on standard input leaves nothing to prompt with */
+    ile_error_t ret = key_providers_configure(key_file_path, key_dir_path);
     if (ret != ILE_SUCCESS) {
         log_message(ERROR, ile_strerror(ret));
         return -1;
     }
-    
-    /* Setup a work environment and open the IPSW */
-    ret = open_work(output_dir_path, &work_dir_path);
-    if (ret != ILE_SUCCESS) {
-        log_message(ERROR, ile_strerror(ret));
-        return -1;
+    if (key_endpoint) {
+        set_key_endpoint(key_endpoint);
     }
-    log_message(LOG, "Opening IPSW...");
-    ret = ipsw_open(&ipsw);
-    if (ret != ILE_SUCCESS) {
-        log_message(ERROR, ile_strerror(ret));
-        ret = close_work(&work_dir_path); if (ret != ILE_SUCCESS) { log_message(WARNING, ile_strerror(ret)); }
-        return -1;
+    if (no_prompt || (key_file_path && !strcmp(key_file_path, KEY_FILE_STDIN))) {
+        set_manual_key_entry(false);
     }
     
-    /* Parse the build manifest */
-    log_message(LOG, "Parsing the build manifest...");
-    build_manifest_t build_manifest = { NULL };
-    ret = parse_build_manifest(ipsw, &build_manifest);
-    if (ret != ILE_SUCCESS) {
-        log_message(ERROR, ile_strerror(ret));
-        ret = close_work(&work_dir_path); if (ret != ILE_SUCCESS) { log_message(WARNING, ile_strerror(ret)); }
-        return -1;
+    /* Main Program */
+    process_options_t options = { keep_work, jobs };
+    if (bench_mode) {
+        ret = benchmark_manifest_parsers(argv[optind + 1], iterations);
+    } else if (decrypt_mode) {
+        ret = benchmark_decryption(argv[optind + 1], iterations);
+    } else if (batch_mode) {
+        /* Every IPSW gets its own folder in the output folder */
+        vector<string> ipsw_paths;
+        ret = collect_batch_inputs(argv[optind + 1], &ipsw_paths);
+        if (ret != ILE_SUCCESS) {
+            log_message(ERROR, ile_strerror(ret));
+            return -1;
+        }
+        ret = run_batch(ipsw_paths, argv[optind + 2], options);
+    } else if (diff_mode) {
+        ret = process_ipsw_diff(argv[optind + 1], argv[optind + 2], argv[optind + 3], argv[optind + 4], options);
+    } else {
+        ret = process_ipsw(argv[optind], argv[optind + 1], options);
     }
-    
-    /* Extract any appropriate images */
-    ret = extract_to_output_dir(build_manifest, ipsw, work_dir_path, output_dir_path);
+    http_client_cleanup();
+    key_providers_cleanup();
     if (ret != ILE_SUCCESS) {
-        log_message(ERROR, ile_strerror(ret));
-        ret = close_work(&work_dir_path); if (ret != ILE_SUCCESS) { log_message(WARNING, ile_strerror(ret)); }
+        if (batch_mode || bench_mode || decrypt_mode) {
+            log_message(ERROR, ile_strerror(ret));
+        }
         return -1;
     }
     
-    ret = write_report(ipsw, build_manifest, output_dir_path);
-    if (ret != ILE_SUCCESS) {
-        log_message(WARNING, ile_strerror(ret));
-    }
-    
-    /* Tear down */
-    log_message(LOG, "Tearing down...");
-    ipsw_close(&ipsw);
-    build_manifest.paths.clear(); build_manifest.paths.shrink_to_fit();
-    build_manifest.manifest_component_names.clear(); build_manifest.manifest_component_names.shrink_to_fit();
-    ret = close_work(&work_dir_path); if (ret != ILE_SUCCESS) { log_message(WARNING, ile_strerror(ret)); }
-    
     return 0;
 }
@@ -0,0 +1,141 @@
+//
+//  http_source_test.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+//  Reads a file through http_source from a static file server on 127.0.0.1 that this test
+//  runs itself, with the block cache shrunk to HTTP_SOURCE_MAX_BLOCKS (set by CMake) so
+//  reads bigger than the cache and eviction are exercised with a small file.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <string>
+#include <vector>
+#include "../include/utilities.hpp"
+#include "../include/http_client.hpp"
+#include "../include/http_source.hpp"
+#include "test_server.hpp"
+
+using namespace std;
+
+/* A few blocks more than the cache holds, ending in a partial block */
+#define TEST_FILE_SIZE ((HTTP_SOURCE_MAX_BLOCKS + 2) * HTTP_SOURCE_BLOCK_SIZE + 123)
+
+static test_server_t server;
+static const vector<uint8_t>& file_contents = server.contents;
+
+static bool read_matches(http_source_t* source, uint64_t offset, size_t length) {
+    vector<uint8_t> buffer(length);
+    return http_source_read(source, offset, buffer.data(), length) == ILE_SUCCESS && !memcmp(buffer.data(), file_contents.data() + offset, length);
+}
+
+static void test_reads(const string& url) {
+    http_source_t* source = NULL;
+    CHECK(http_source_open(url.c_str(), &source) == ILE_SUCCESS);
+    if (!source) {
+        return;
+    }
+    CHECK(source->size == TEST_FILE_SIZE);
+    
+    /* A small read is one request, and reading it again comes from the cache */
+    CHECK(read_matches(source, 1000, 100));
+    CHECK(source->request_count == 1);
+    CHECK(read_matches(source, 1000, 100));
+    CHECK(source->request_count == 1);
+    
+    /* Reads that straddle blocks, and the partial block at the end */
+    CHECK(read_matches(source, HTTP_SOURCE_BLOCK_SIZE - 10, 20));
+    CHECK(read_matches(source, TEST_FILE_SIZE - 200, 200));
+    
+    /* Bigger than the whole cache while it's full, which is read in pieces and evicts blocks of the read itself */
+    CHECK(read_matches(source, 0, TEST_FILE_SIZE));
+    CHECK(source->blocks.size() <= HTTP_SOURCE_MAX_BLOCKS);
+    CHECK(source->blocks.size() == source->lru.size());
+    CHECK(read_matches(source, 17, TEST_FILE_SIZE - 34));
+    CHECK(source->blocks.size() <= HTTP_SOURCE_MAX_BLOCKS);
+    
+    /* Past the end */
+    uint8_t byte = 0;
+    CHECK(http_source_read(source, TEST_FILE_SIZE, &byte, 1) != ILE_SUCCESS);
+    CHECK(http_source_read(source, TEST_FILE_SIZE - 1, &byte, 1) == ILE_SUCCESS && byte == file_contents[TEST_FILE_SIZE - 1]);
+    
+    http_source_close(source);
+}
+
+static void test_prefetch(const string& url) {
+    http_source_t* source = NULL;
+    CHECK(http_source_open(url.c_str(), &source) == ILE_SUCCESS);
+    if (!source) {
+        return;
+    }
+    
+    /* Ranges within the coalescing gap of each other are one request, and reads of them don't need another */
+    vector<pair<uint64_t, uint64_t>> ranges;
+    ranges.push_back(make_pair((uint64_t)HTTP_SOURCE_BLOCK_SIZE + 10, (uint64_t)50));
+    ranges.push_back(make_pair((uint64_t)10, (uint64_t)50));
+    CHECK(http_source_prefetch(source, ranges) == ILE_SUCCESS);
+    CHECK(source->request_count == 1);
+    CHECK(read_matches(source, 10, 50));
+    CHECK(read_matches(source, HTTP_SOURCE_BLOCK_SIZE + 10, 50));
+    CHECK(source->request_count == 1);
+    
+    http_source_close(source);
+}
+
+static void test_stalled_read(const string& url) {
+    /* A short timeout so the stalled range is given up on quickly */
+    http_policy_t policy;
+    http_client_get_policy(&policy);
+    policy.timeout_ms = 1000;
+    http_client_set_policy(policy);
+    
+    http_source_t* source = NULL;
+    CHECK(http_source_open(url.c_str(), &source) == ILE_SUCCESS);
+    if (!source) {
+        return;
+    }
+    
+    server.stall.store(true);
+    uint8_t byte = 0;
+    CHECK(http_source_read(source, 0, &byte, 1) == ILE_E_REMOTE_TIMED_OUT);
+    CHECK(source->blocks.empty());
+    server.stall.store(false);
+    
+    /* Nothing was cached, so the same read works once the server does */
+    CHECK(read_matches(source, 0, 100));
+    
+    http_source_close(source);
+}
+
+int main(void) {
+    signal(SIGPIPE, SIG_IGN);
+    server.contents.resize(TEST_FILE_SIZE);
+    for (size_t i = 0; i < server.contents.size(); i++) {
+        server.contents[i] = (uint8_t)((i * 131) ^ (i >> 11));
+    }
+    
+    uint16_t port = 0;
+    int listener  = test_server_start(&server, &port);
+    if (listener < 0) {
+        printf("[FAIL] Could not start the test server\n");
+        return 1;
+    }
+    char url[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%u/test.ipsw", port);
+    
+    test_reads(url);
+    test_prefetch(url);
+    test_stalled_read(url);
+    http_client_cleanup();
+    
+    if (failures > 0) {
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,285 @@
+//
+//  ipsw_remote_test.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+//  Extracts a small IPSW from a static file server on 127.0.0.1 that this test runs itself,
+//  with several workers, and checks that every component is read through the one remote
+//  source the archive was opened with.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <png.h>
+#include <zlib.h>
+#include "../include/utilities.hpp"
+#include "../include/http_client.hpp"
+#include "../include/ipsw.hpp"
+#include "../include/extraction.hpp"
+#include "test_server.hpp"
+
+extern "C" {
+    #include "../include/3rdparty/ibootim/ibootim.h"
+}
+
+using namespace std;
+
+#define TEST_COMPONENT_COUNT 6
+#define TEST_IMAGE_SIZE      4
+#define TEST_JOBS            4
+
+/* Sits between the components and the central directory so the tail ipsw_open downloads doesn't already hold them */
+#define TEST_FILLER_SIZE     (HTTP_SOURCE_BLOCK_SIZE * 2)
+
+static test_server_t server;
+
+static bool read_file(const string& path, vector<uint8_t>* contents) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    uint8_t chunk[0x1000];
+    size_t read_size = 0;
+    while ((read_size = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        contents->insert(contents->end(), chunk, chunk + read_size);
+    }
+    fclose(f);
+    return true;
+}
+
+/* A tiny RGBA png, turned into an ibootim by ibootim itself */
+static bool make_ibootim(const string& dir_path, vector<uint8_t>* ibootim_data) {
+    const string png_path     = dir_path + "/source.png";
+    const string ibootim_path = dir_path + "/source.ibootim";
+    
+    FILE* f = fopen(png_path.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    png_structp write_struct = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info_struct    = write_struct ? png_create_info_struct(write_struct) : NULL;
+    if (!info_struct || setjmp(png_jmpbuf(write_struct))) {
+        png_destroy_write_struct(&write_struct, &info_struct);
+        fclose(f);
+        return false;
+    }
+    png_init_io(write_struct, f);
+    png_set_IHDR(write_struct, info_struct, TEST_IMAGE_SIZE, TEST_IMAGE_SIZE, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(write_struct, info_struct);
+    uint8_t row[TEST_IMAGE_SIZE * 4];
+    for (uint32_t y = 0; y < TEST_IMAGE_SIZE; y++) {
+        for (uint32_t x = 0; x < sizeof(row); x++) {
+            row[x] = (uint8_t)(x * 17 + y * 31);
+        }
+        png_write_row(write_struct, row);
+    }
+    png_write_end(write_struct, NULL);
+    png_destroy_write_struct(&write_struct, &info_struct);
+    fclose(f);
+    
+    ibootim* image = NULL;
+    if (ibootim_load_png(png_path.c_str(), &image) != 0) {
+        return false;
+    }
+    const int rc = ibootim_write(image, ibootim_path.c_str());
+    ibootim_close(image);
+    
+    return rc == 0 && read_file(ibootim_path, ibootim_data);
+}
+
+static void append_der(vector<uint8_t>* out, uint8_t tag, const vector<uint8_t>& contents) {
+    out->push_back(tag);
+    const size_t length = contents.size();
+    if (length < 0x80) {
+        out->push_back((uint8_t)length);
+    } else if (length < 0x100) {
+        out->push_back(0x81);
+        out->push_back((uint8_t)length);
+    } else {
+        out->push_back(0x82);
+        out->push_back((uint8_t)(length >> 8));
+        out->push_back((uint8_t)length);
+    }
+    out->insert(out->end(), contents.begin(), contents.end());
+}
+
+static vector<uint8_t> der_string(const char* value) {
+    return vector<uint8_t>(value, value + strlen(value));
+}
+
+/* An unencrypted IM4P, so extraction never needs keys */
+static vector<uint8_t> make_im4p(const vector<uint8_t>& payload) {
+    vector<uint8_t> contents;
+    append_der(&contents, 0x16, der_string("IM4P"));
+    append_der(&contents, 0x16, der_string("logo"));
+    append_der(&contents, 0x16, der_string("iLogoExtractor test"));
+    append_der(&contents, 0x04, payload);
+    
+    vector<uint8_t> im4p;
+    append_der(&im4p, 0x30, contents);
+    return im4p;
+}
+
+static void append_le16(vector<uint8_t>* out, uint16_t value) {
+    out->push_back((uint8_t)value);
+    out->push_back((uint8_t)(value >> 8));
+}
+
+static void append_le32(vector<uint8_t>* out, uint32_t value) {
+    append_le16(out, (uint16_t)value);
+    append_le16(out, (uint16_t)(value >> 16));
+}
+
+/* A zip of stored entries, which is all the directory reader needs */
+static vector<uint8_t> make_zip(const vector<string>& names, const vector<vector<uint8_t>>& files) {
+    vector<uint8_t> zip_data;
+    vector<uint8_t> central_directory;
+    for (size_t i = 0; i < names.size(); i++) {
+        const uint32_t crc    = (uint32_t)crc32(0, files[i].data(), (uInt)files[i].size());
+        const uint32_t size   = (uint32_t)files[i].size();
+        const uint32_t offset = (uint32_t)zip_data.size();
+        
+        append_le32(&zip_data, 0x04034b50);
+        append_le16(&zip_data, 20);
+        append_le16(&zip_data, 0);
+        append_le16(&zip_data, 0);
+        append_le32(&zip_data, 0);
+        append_le32(&zip_data, crc);
+        append_le32(&zip_data, size);
+        append_le32(&zip_data, size);
+        append_le16(&zip_data, (uint16_t)names[i].size());
+        append_le16(&zip_data, 0);
+        zip_data.insert(zip_data.end(), names[i].begin(), names[i].end());
+        zip_data.insert(zip_data.end(), files[i].begin(), files[i].end());
+        
+        append_le32(&central_directory, 0x02014b50);
+        append_le16(&central_directory, 20);
+        append_le16(&central_directory, 20);
+        append_le16(&central_directory, 0);
+        append_le16(&central_directory, 0);
+        append_le32(&central_directory, 0);
+        append_le32(&central_directory, crc);
+        append_le32(&central_directory, size);
+        append_le32(&central_directory, size);
+        append_le16(&central_directory, (uint16_t)names[i].size());
+        append_le16(&central_directory, 0);
+        append_le16(&central_directory, 0);
+        append_le16(&central_directory, 0);
+        append_le16(&central_directory, 0);
+        append_le32(&central_directory, 0);
+        append_le32(&central_directory, offset);
+        central_directory.insert(central_directory.end(), names[i].begin(), names[i].end());
+    }
+    
+    const uint32_t central_directory_offset = (uint32_t)zip_data.size();
+    zip_data.insert(zip_data.end(), central_directory.begin(), central_directory.end());
+    append_le32(&zip_data, 0x06054b50);
+    append_le16(&zip_data, 0);
+    append_le16(&zip_data, 0);
+    append_le16(&zip_data, (uint16_t)names.size());
+    append_le16(&zip_data, (uint16_t)names.size());
+    append_le32(&zip_data, (uint32_t)central_directory.size());
+    append_le32(&zip_data, central_directory_offset);
+    append_le16(&zip_data, 0);
+    
+    return zip_data;
+}
+
+static void test_parallel_extraction(const string& url, const string& dir_path, const vector<string>& names) {
+    build_manifest_t build_manifest = {};
+    build_identity_t identity;
+    identity.device_class = build_manifest_intern(&build_manifest, "n41ap");
+    for (size_t i = 0; i < names.size(); i++) {
+        const string component_name = "Logo" + to_string(i);
+        build_manifest.paths.push_back(build_manifest_intern(&build_manifest, names[i]));
+        build_manifest.manifest_component_names.push_back(build_manifest_intern(&build_manifest, component_name));
+        build_manifest.digests.push_back(string_view());
+        identity.files.push_back((uint32_t)i);
+        identity.component_names.push_back(build_manifest.manifest_component_names.back());
+    }
+    build_manifest.file_count = (uint32_t)names.size();
+    build_manifest.identities.push_back(identity);
+    
+    ipsw_archive_t archive = { NULL, url.c_str() };
+    CHECK(ipsw_open(&archive) == ILE_SUCCESS);
+    if (!archive.remote) {
+        build_manifest_free(&build_manifest);
+        return;
+    }
+    CHECK(server.head_requests.load() == 1);
+    const uint64_t open_request_count = archive.remote->request_count;
+    
+    const string output_dir_path = dir_path + "/output";
+    mkdir(output_dir_path.c_str(), 0777);
+    CHECK(extract_to_output_dir(build_manifest, archive, NULL, output_dir_path.c_str(), TEST_JOBS) == ILE_SUCCESS);
+    
+    /* No worker opened the IPSW again, and the components all came down with the one prefetch */
+    CHECK(server.head_requests.load() == 1);
+    CHECK(server.range_requests.load() == archive.remote->request_count);
+    CHECK(archive.remote->request_count == open_request_count + 1);
+    
+    for (size_t i = 0; i < names.size(); i++) {
+        struct stat st;
+        const string png_path = output_dir_path + "/Logo" + to_string(i) + ".png";
+        CHECK(stat(png_path.c_str(), &st) == 0 && st.st_size > 0);
+    }
+    
+    ipsw_close(&archive);
+    build_manifest_free(&build_manifest);
+}
+
+int main(void) {
+    /* The server closes connections mid-response on purpose */
+    signal(SIGPIPE, SIG_IGN);
+    
+    /* Keep the index cache out of the user's cache directory */
+    char dir_template[] = "/tmp/ipsw_remote_test.XXXXXX";
+    const char* dir_path = mkdtemp(dir_template);
+    if (!dir_path) {
+        printf("[FAIL] Could not make a temporary directory\n");
+        return 1;
+    }
+    setenv("XDG_CACHE_HOME", dir_path, 1);
+    
+    vector<uint8_t> ibootim_data;
+    if (!make_ibootim(dir_path, &ibootim_data)) {
+        printf("[FAIL] Could not make an ibootim\n");
+        return 1;
+    }
+    
+    vector<string> names;
+    vector<vector<uint8_t>> files;
+    for (uint32_t i = 0; i < TEST_COMPONENT_COUNT; i++) {
+        names.push_back("Firmware/all_flash/logo" + to_string(i) + ".im4p");
+        files.push_back(make_im4p(ibootim_data));
+    }
+    names.push_back("filler");
+    files.push_back(vector<uint8_t>(TEST_FILLER_SIZE, 0));
+    server.contents = make_zip(names, files);
+    names.pop_back();
+    
+    uint16_t port = 0;
+    int listener  = test_server_start(&server, &port);
+    if (listener < 0) {
+        printf("[FAIL] Could not start the test server\n");
+        return 1;
+    }
+    char url[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%u/test.ipsw", port);
+    
+    test_parallel_extraction(url, dir_path, names);
+    
+    http_client_cleanup();
+    if (failures) {
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
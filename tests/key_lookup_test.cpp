@@ -0,0 +1,133 @@
+//
+//  key_lookup_test.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+//  Looks up the keys for one build several times at once, from separate processes and from
+//  threads of one process, against a wikiproxy stand-in on 127.0.0.1 that this test runs
+//  itself, and checks that each set of lookups made a single request.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/utilities.hpp"
+#include "../include/http_client.hpp"
+#include "../include/ipsw.hpp"
+#include "../include/api.hpp"
+#include "test_server.hpp"
+
+using namespace std;
+
+#define TEST_LOOKUPS  2
+#define TEST_DELAY_MS 500
+
+#define TEST_RESPONSE "{\"keys\": [{\"image\": \"AppleLogo\", \"iv\": \"1d8821e656f5ec209609e17f36a98135\", \"key\": \"9f2e6be63d278877187fe3dd27409521906864563befc586842207e9058a239d\"}]}"
+
+static test_server_t server;
+
+/* One encrypted component, so the lookup has to find a key for it */
+static bool lookup_build(const char* product_build_version) {
+    build_manifest_t build_manifest = {};
+    build_manifest.product_type          = build_manifest_intern(&build_manifest, "iPhone5,1");
+    build_manifest.device_class          = build_manifest_intern(&build_manifest, "n41ap");
+    build_manifest.product_build_version = build_manifest_intern(&build_manifest, product_build_version);
+    build_manifest.paths.push_back(build_manifest_intern(&build_manifest, "Firmware/all_flash/applelogo.img3"));
+    build_manifest.manifest_component_names.push_back(build_manifest_intern(&build_manifest, "AppleLogo"));
+    build_manifest.digests.push_back(string_view());
+    build_manifest.file_count = 1;
+    build_manifest.encrypted.assign(1, true);
+    
+    const bool found = (append_keys_to_build_manifest(&build_manifest) == ILE_SUCCESS) && build_manifest.keys.size() == 1 && build_manifest.keys[0].available;
+    build_manifest_free(&build_manifest);
+    return found;
+}
+
+static void test_concurrent_processes(void) {
+    const uint32_t requests_before = server.get_requests.load();
+    
+    /* Nothing is buffered twice, and curl is only set up in the children */
+    fflush(stdout);
+    vector<pid_t> children;
+    for (uint32_t i = 0; i < TEST_LOOKUPS; i++) {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            const bool found = lookup_build("10A405");
+            http_client_cleanup();
+            fflush(stdout);
+            _exit(found ? 0 : 1);
+        }
+        CHECK(pid > 0);
+        if (pid > 0) {
+            children.push_back(pid);
+        }
+    }
+    for (size_t i = 0; i < children.size(); i++) {
+        int status = 0;
+        CHECK(waitpid(children[i], &status, 0) == children[i] && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    
+    /* The second process waited on the build's lock and read the first one's answer from the key cache */
+    CHECK(server.get_requests.load() - requests_before == 1);
+}
+
+static void test_concurrent_threads(void) {
+    const uint32_t requests_before = server.get_requests.load();
+    
+    vector<thread> lookups;
+    vector<char> found(TEST_LOOKUPS, 0);
+    for (uint32_t i = 0; i < TEST_LOOKUPS; i++) {
+        lookups.emplace_back([&found, i] { found[i] = lookup_build("10A403") ? 1 : 0; });
+    }
+    for (size_t i = 0; i < lookups.size(); i++) {
+        lookups[i].join();
+        CHECK(found[i]);
+    }
+    
+    /* The second thread waited on the first one's lookup in this process */
+    CHECK(server.get_requests.load() - requests_before == 1);
+}
+
+int main(void) {
+    signal(SIGPIPE, SIG_IGN);
+    
+    /* A key cache of its own, and nobody to type keys in */
+    char dir_template[] = "/tmp/key_lookup_test.XXXXXX";
+    const char* dir_path = mkdtemp(dir_template);
+    if (!dir_path) {
+        printf("[FAIL] Could not make a temporary directory\n");
+        return 1;
+    }
+    setenv("ILE_CACHE_DIR", dir_path, 1);
+    set_manual_key_entry(false);
+    
+    server.contents.assign(TEST_RESPONSE, TEST_RESPONSE + strlen(TEST_RESPONSE));
+    server.get_delay_ms = TEST_DELAY_MS;
+    uint16_t port = 0;
+    int listener  = test_server_start(&server, &port);
+    if (listener < 0) {
+        printf("[FAIL] Could not start the test server\n");
+        return 1;
+    }
+    char endpoint[64];
+    snprintf(endpoint, sizeof(endpoint), "http://127.0.0.1:%u", port);
+    set_key_endpoint(endpoint);
+    
+    test_concurrent_processes();
+    test_concurrent_threads();
+    http_client_cleanup();
+    
+    if (failures > 0) {
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,155 @@
+//
+//  test_server.hpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+//  Just enough of a static file server on 127.0.0.1 for the tests that read through
+//  http_source or look up keys: HEAD, GET with a single bytes=<start>-<end> range, and
+//  a plain GET of the whole file. Every request is counted so tests can check how many
+//  a read or lookup took.
+//
+
+#ifndef test_server_hpp
+#define test_server_hpp
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#define TEST_MAX_REQUEST_SIZE 0x2000
+
+static uint32_t failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("[FAIL] %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+} while (0)
+
+typedef struct {
+    /* Set before test_server_start, never changed after */
+    vector<uint8_t> contents;
+    
+    /* Plain GETs are answered this late, so lookups that start together overlap */
+    uint32_t get_delay_ms;
+    
+    atomic<uint32_t> head_requests;
+    atomic<uint32_t> range_requests;
+    atomic<uint32_t> get_requests;
+    
+    /* While set, range responses stop halfway through and the connection is held open */
+    atomic<bool> stall;
+} test_server_t;
+
+static void test_server_send_all(int fd, const char* data, size_t size) {
+    size_t sent = 0;
+    while (sent < size) {
+        const ssize_t written = send(fd, data + sent, size - sent, 0);
+        if (written <= 0) {
+            return;
+        }
+        sent += (size_t)written;
+    }
+}
+
+static void test_server_handle_client(test_server_t* server, int fd) {
+    string request;
+    char chunk[0x400];
+    while (request.find("\r\n\r\n") == string::npos && request.size() < TEST_MAX_REQUEST_SIZE) {
+        const ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            close(fd);
+            return;
+        }
+        request.append(chunk, (size_t)received);
+    }
+    
+    char header[256];
+    const vector<uint8_t>& contents = server->contents;
+    if (!strncmp(request.c_str(), "HEAD ", 5)) {
+        server->head_requests++;
+        snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\nAccept-Ranges: bytes\r\nConnection: close\r\n\r\n", contents.size());
+        test_server_send_all(fd, header, strlen(header));
+        close(fd);
+        return;
+    }
+    
+    unsigned long long start = 0;
+    unsigned long long end   = 0;
+    const size_t range = request.find("Range: bytes=");
+    if (!strncmp(request.c_str(), "GET ", 4) && range == string::npos) {
+        server->get_requests++;
+        this_thread::sleep_for(chrono::milliseconds(server->get_delay_ms));
+        snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", contents.size());
+        test_server_send_all(fd, header, strlen(header));
+        test_server_send_all(fd, (const char*)contents.data(), contents.size());
+        close(fd);
+        return;
+    }
+    if (strncmp(request.c_str(), "GET ", 4) != 0 || range == string::npos || sscanf(request.c_str() + range, "Range: bytes=%llu-%llu", &start, &end) != 2 || start > end || end >= contents.size()) {
+        snprintf(header, sizeof(header), "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        test_server_send_all(fd, header, strlen(header));
+        close(fd);
+        return;
+    }
+    server->range_requests++;
+    snprintf(header, sizeof(header), "HTTP/1.1 206 Partial Content\r\nContent-Length: %llu\r\nContent-Range: bytes %llu-%llu/%zu\r\nConnection: close\r\n\r\n", end - start + 1, start, end, contents.size());
+    test_server_send_all(fd, header, strlen(header));
+    if (server->stall.load()) {
+        test_server_send_all(fd, (const char*)contents.data() + start, (size_t)(end - start + 1) / 2);
+        while (server->stall.load()) {
+            this_thread::sleep_for(chrono::milliseconds(50));
+        }
+        close(fd);
+        return;
+    }
+    test_server_send_all(fd, (const char*)contents.data() + start, (size_t)(end - start + 1));
+    close(fd);
+}
+
+static void test_server_serve(test_server_t* server, int listener) {
+    while (true) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        thread(test_server_handle_client, server, fd).detach();
+    }
+}
+
+/* Serves the server's contents on any free port until the process exits, -1 if it couldn't */
+static int test_server_start(test_server_t* server, uint16_t* port) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
+        return -1;
+    }
+    
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family      = AF_INET;
+    address.sin_port        = 0;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t address_size  = sizeof(address);
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0 || getsockname(listener, (struct sockaddr*)&address, &address_size) != 0) {
+        close(listener);
+        return -1;
+    }
+    *port = ntohs(address.sin_port);
+    thread(test_server_serve, server, listener).detach();
+    
+    return listener;
+}
+
+#endif /* test_server_hpp */
@@ -0,0 +1,245 @@
+//
+//  wikiproxy_standin.cpp
+//  iLogoExtractor
+//
+//  Created by Karson Eskind on 10/16/26.
+//
+//  A local stand-in for wikiproxy to measure and test the key path offline. It answers
+//  GET /<ProductType>/<DeviceClass>/<Build> from a folder in that layout (the same one
+//  --key-endpoint reads folders in), with injectable latency, errors and dropped connections.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+#define STANDIN_DEFAULT_PORT     8080
+#define STANDIN_DEFAULT_ROOT     "tools/wikiproxy_responses"
+#define STANDIN_MAX_REQUEST_SIZE 0x2000
+
+/* The same body wikiproxy sends with its 500s, which the client checks for */
+#define STANDIN_SERVER_ERROR "Internal Server Error"
+
+typedef struct {
+    uint16_t port;
+    string root;
+    
+    /* Served for builds the root doesn't have, instead of a 404 */
+    string fallback_path;
+    
+    /* Every response waits latency_ms plus up to jitter_ms */
+    uint32_t latency_ms;
+    uint32_t jitter_ms;
+    
+    /* Chances from 0 to 1 of answering with a 500, or closing the connection without answering */
+    double error_rate;
+    double drop_rate;
+} standin_options_t;
+
+static mutex random_lock;
+static mt19937 generator(random_device{}());
+
+static double random_unit(void) {
+    lock_guard<mutex> guard(random_lock);
+    return uniform_real_distribution<double>(0.0, 1.0)(generator);
+}
+
+static uint32_t random_below(uint32_t limit) {
+    lock_guard<mutex> guard(random_lock);
+    return limit ? uniform_int_distribution<uint32_t>(0, limit)(generator) : 0;
+}
+
+static bool read_file(const string& path, string* contents) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+    
+    char chunk[0x4000];
+    size_t read_size = 0;
+    while ((read_size = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        contents->append(chunk, read_size);
+    }
+    const bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+static void send_all(int fd, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        const ssize_t written = send(fd, data.data() + sent, data.size() - sent, 0);
+        if (written <= 0) {
+            return;
+        }
+        sent += (size_t)written;
+    }
+}
+
+static void send_response(int fd, int status, const char* reason, const string& body) {
+    char header[256];
+    snprintf(header, sizeof(header), "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", status, reason, body.size());
+    send_all(fd, string(header) + body);
+}
+
+static void handle_client(int fd, const standin_options_t* options) {
+    const auto start = chrono::steady_clock::now();
+    
+    /* Only the request line matters, the headers are read so the client isn't cut off mid request */
+    string request;
+    char chunk[0x400];
+    while (request.find("\r\n\r\n") == string::npos && request.size() < STANDIN_MAX_REQUEST_SIZE) {
+        const ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            close(fd);
+            return;
+        }
+        request.append(chunk, (size_t)received);
+    }
+    char method[16] = { 0 };
+    char path[0x400] = { 0 };
+    if (sscanf(request.c_str(), "%15s %1023s", method, path) != 2) {
+        send_response(fd, 400, "Bad Request", "");
+        close(fd);
+        return;
+    }
+    
+    this_thread::sleep_for(chrono::milliseconds(options->latency_ms + random_below(options->jitter_ms)));
+    
+    int status = 200;
+    const double roll = random_unit();
+    if (roll < options->drop_rate) {
+        status = 0;
+    } else if (roll < options->drop_rate + options->error_rate) {
+        status = 500;
+        send_response(fd, status, "Internal Server Error", STANDIN_SERVER_ERROR);
+    } else if (strcmp(method, "GET") != 0) {
+        status = 405;
+        send_response(fd, status, "Method Not Allowed", "");
+    } else {
+        /* Never leave the root */
+        string body;
+        const bool safe = (path[0] == '/') && !strstr(path, "..");
+        if (safe && read_file(options->root + path, &body)) {
+            send_response(fd, status, "OK", body);
+        } else if (safe && !options->fallback_path.empty() && read_file(options->fallback_path, &body)) {
+            send_response(fd, status, "OK", body);
+        } else {
+            status = 404;
+            send_response(fd, status, "Not Found", "{\"error\": \"Not Found\"}");
+        }
+    }
+    close(fd);
+    
+    const auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    if (status == 0) {
+        printf("[LOG] %s %s -> dropped (%lld ms)\n", method, path, (long long)elapsed);
+    } else {
+        printf("[LOG] %s %s -> %d (%lld ms)\n", method, path, status, (long long)elapsed);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[]) {
+    standin_options_t options = { STANDIN_DEFAULT_PORT, STANDIN_DEFAULT_ROOT, "", 0, 0, 0.0, 0.0 };
+    static struct option long_options[] = {
+        { "port",       required_argument, NULL, 'p' },
+        { "root",       required_argument, NULL, 'r' },
+        { "fallback",   required_argument, NULL, 'f' },
+        { "latency-ms", required_argument, NULL, 'l' },
+        { "jitter-ms",  required_argument, NULL, 'j' },
+        { "error-rate", required_argument, NULL, 'e' },
+        { "drop-rate",  required_argument, NULL, 'd' },
+        { NULL,         0,                 NULL, 0   }
+    };
+    int opt = 0;
+    bool usage = false;
+    while ((opt = getopt_long(argc, argv, "p:r:f:l:j:e:d:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                options.port = (uint16_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                options.root = optarg;
+                break;
+            case 'f':
+                options.fallback_path = optarg;
+                break;
+            case 'l':
+                options.latency_ms = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'j':
+                options.jitter_ms = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'e':
+                options.error_rate = strtod(optarg, NULL);
+                break;
+            case 'd':
+                options.drop_rate = strtod(optarg, NULL);
+                break;
+            default:
+                usage = true;
+                break;
+        }
+    }
+    if (usage || optind != argc) {
+        printf("A local stand-in for wikiproxy, serving <Root>/<ProductType>/<DeviceClass>/<Build>\n");
+        printf("Usage: %s [options]\n", argv[0]);
+        printf("Options:\n");
+        printf("  -p, --port <N>         Port to listen on at 127.0.0.1 (default: %d)\n", STANDIN_DEFAULT_PORT);
+        printf("  -r, --root <Folder>    Folder of responses (default: %s)\n", STANDIN_DEFAULT_ROOT);
+        printf("  -f, --fallback <File>  Response for builds the root doesn't have, instead of a 404\n");
+        printf("  -l, --latency-ms <N>   Wait N ms before every response (default: 0)\n");
+        printf("  -j, --jitter-ms <N>    Wait up to N more ms, picked at random (default: 0)\n");
+        printf("  -e, --error-rate <P>   Answer with a 500 with chance P from 0 to 1 (default: 0)\n");
+        printf("  -d, --drop-rate <P>    Close the connection without answering with chance P (default: 0)\n");
+        return -1;
+    }
+    
+    /* Clients that give up early shouldn't take the server down */
+    signal(SIGPIPE, SIG_IGN);
+    
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("socket");
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons(options.port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        perror("bind");
+        close(listener);
+        return -1;
+    }
+    printf("[LOG] Serving %s on http://127.0.0.1:%d\n", options.root.c_str(), options.port);
+    fflush(stdout);
+    
+    /* One thread per connection so injected latency doesn't hold up other requests */
+    while (true) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        thread(handle_client, fd, &options).detach();
+    }
+    
+    return 0;
+}